@@ -120,8 +120,7 @@ void LocalClientIo::onStateChanged(QLocalSocket::LocalSocketState state)
         emit shouldReconnect(this);
     }
     if (state == QLocalSocket::ConnectedState) {
-        m_dataStream.setDevice(connection().data());
-        m_dataStream.resetStatus();
+        initializeDataStream();
     }
 }
 
@@ -108,8 +108,7 @@ void QnxClientIo::onStateChanged(QAbstractSocket::SocketState state)
         m_socket.abort();
         emit shouldReconnect(this);
     } else if (state == QAbstractSocket::ConnectedState) {
-        m_dataStream.setDevice(connection());
-        m_dataStream.resetStatus();
+        initializeDataStream();
     }
 }
 
@@ -0,0 +1,637 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Ford Motor Company
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtRemoteObjects module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qconnection_shm_backend_p.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+const quint32 ringCapacity = 1024 * 1024; //Has to be a power of two
+const int cacheLineSize = 64;
+
+//The server sends the shared memory, its own eventfd and the client's eventfd
+const int descriptorCount = 3;
+
+}
+
+struct ShmRing
+{
+    //Bytes written so far, only advanced by the writer
+    QBasicAtomicInteger<quint32> head;
+    //Raised by the writer while it has data waiting for space
+    QBasicAtomicInt writerWaiting;
+    char padding1[cacheLineSize - sizeof(quint32) - sizeof(int)];
+    //Bytes read so far, only advanced by the reader
+    QBasicAtomicInteger<quint32> tail;
+    //Raised by the reader while it waits for data
+    QBasicAtomicInt readerWaiting;
+    char padding2[cacheLineSize - sizeof(quint32) - sizeof(int)];
+    char data[ringCapacity];
+};
+
+//The peer maps the rings too, so it can move head and tail anywhere. A ring
+//whose head is more than its capacity ahead of its tail is corrupt.
+static bool isValidFill(quint32 used)
+{
+    return used <= ringCapacity;
+}
+
+static void closeDescriptor(int &fd)
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+static bool sendDescriptors(int socket, const int *fds)
+{
+    char byte = 0;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(descriptorCount * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(descriptorCount * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, descriptorCount * sizeof(int));
+
+    ssize_t result;
+    do {
+        result = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (result < 0 && errno == EINTR);
+    return result == 1;
+}
+
+//Returns 1 once the descriptors have been received, 0 if they aren't there
+//yet and -1 if the connection failed
+static int receiveDescriptors(int socket, int *fds)
+{
+    char byte;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(descriptorCount * sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t result;
+    do {
+        result = ::recvmsg(socket, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (result != 1)
+        return -1;
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len != CMSG_LEN(descriptorCount * sizeof(int)))
+        return -1;
+    memcpy(fds, CMSG_DATA(cmsg), descriptorCount * sizeof(int));
+    return 1;
+}
+
+ShmRingDevice::ShmRingDevice(QObject *parent)
+    : QIODevice(parent)
+    , m_socket(-1)
+    , m_localEvent(-1)
+    , m_peerEvent(-1)
+    , m_memory(Q_NULLPTR)
+    , m_rx(Q_NULLPTR)
+    , m_tx(Q_NULLPTR)
+    , m_notifiedHead(0)
+    , m_eventNotifier(Q_NULLPTR)
+    , m_socketNotifier(Q_NULLPTR)
+{
+}
+
+ShmRingDevice::~ShmRingDevice()
+{
+    close();
+}
+
+bool ShmRingDevice::createDescriptors(int &memory, int &serverEvent, int &clientEvent)
+{
+    static QBasicAtomicInt counter = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+    //The name is only needed to create the segment, the peer gets the descriptor
+    const QByteArray name = "/qtro-shm-" + QByteArray::number(QCoreApplication::applicationPid())
+            + '-' + QByteArray::number(counter.fetchAndAddRelaxed(1));
+    memory = ::shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    serverEvent = -1;
+    clientEvent = -1;
+    if (memory < 0)
+        return false;
+    ::shm_unlink(name.constData());
+
+    //A new segment is zero filled, which is the initial state of both rings
+    if (::ftruncate(memory, 2 * sizeof(ShmRing)) == 0) {
+        serverEvent = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        clientEvent = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (serverEvent >= 0 && clientEvent >= 0)
+            return true;
+    }
+
+    closeDescriptor(memory);
+    closeDescriptor(serverEvent);
+    closeDescriptor(clientEvent);
+    return false;
+}
+
+bool ShmRingDevice::open(int socket, int memory, int localEvent, int peerEvent, Side side)
+{
+    Q_ASSERT(!m_memory);
+
+    void *address = ::mmap(Q_NULLPTR, 2 * sizeof(ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0);
+    closeDescriptor(memory);
+    if (address == MAP_FAILED) {
+        qCWarning(QT_REMOTEOBJECT) << "Could not map shared memory" << qt_error_string(errno);
+        closeDescriptor(socket);
+        closeDescriptor(localEvent);
+        closeDescriptor(peerEvent);
+        return false;
+    }
+
+    m_memory = address;
+    m_socket = socket;
+    m_localEvent = localEvent;
+    m_peerEvent = peerEvent;
+
+    //The first ring carries data from the server to the client
+    ShmRing *rings = static_cast<ShmRing *>(address);
+    m_tx = side == ServerSide ? rings : rings + 1;
+    m_rx = side == ServerSide ? rings + 1 : rings;
+    m_notifiedHead = m_rx->tail.load();
+
+    m_eventNotifier = new QSocketNotifier(m_localEvent, QSocketNotifier::Read, this);
+    connect(m_eventNotifier, SIGNAL(activated(int)), this, SLOT(onEvent()));
+    m_socketNotifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    connect(m_socketNotifier, SIGNAL(activated(int)), this, SLOT(onSocketActivated()));
+
+    QIODevice::open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+
+    //Picks up what the peer wrote before it knew we were waiting
+    QMetaObject::invokeMethod(this, "onEvent", Qt::QueuedConnection);
+    return true;
+}
+
+void ShmRingDevice::close()
+{
+    if (!m_memory) {
+        QIODevice::close();
+        return;
+    }
+
+    QIODevice::close();
+
+    //close() can be called from the notifiers' own signals
+    m_eventNotifier->setEnabled(false);
+    m_eventNotifier->deleteLater();
+    m_eventNotifier = Q_NULLPTR;
+    m_socketNotifier->setEnabled(false);
+    m_socketNotifier->deleteLater();
+    m_socketNotifier = Q_NULLPTR;
+
+    ::munmap(m_memory, 2 * sizeof(ShmRing));
+    m_memory = Q_NULLPTR;
+    m_rx = Q_NULLPTR;
+    m_tx = Q_NULLPTR;
+    m_pending.clear();
+
+    //Closing the socket is what tells the peer we are gone
+    closeDescriptor(m_socket);
+    closeDescriptor(m_localEvent);
+    closeDescriptor(m_peerEvent);
+
+    emit disconnected();
+}
+
+qint64 ShmRingDevice::bytesAvailable() const
+{
+    const quint32 used = m_rx ? m_rx->head.loadAcquire() - m_rx->tail.load() : 0;
+    const qint64 available = isValidFill(used) ? used : 0;
+    return available + QIODevice::bytesAvailable();
+}
+
+qint64 ShmRingDevice::bytesToWrite() const
+{
+    return m_pending.size();
+}
+
+qint64 ShmRingDevice::readData(char *data, qint64 maxSize)
+{
+    if (!m_rx)
+        return -1;
+
+    const quint32 tail = m_rx->tail.load();
+    const quint32 used = m_rx->head.loadAcquire() - tail;
+    if (!isValidFill(used)) {
+        //Closed from onEvent(), not while the caller reads
+        QMetaObject::invokeMethod(this, "onEvent", Qt::QueuedConnection);
+        return -1;
+    }
+    const quint32 size = quint32(qMin<qint64>(maxSize, used));
+    if (size == 0)
+        return 0;
+
+    const quint32 offset = tail & (ringCapacity - 1);
+    const quint32 first = qMin(size, ringCapacity - offset);
+    memcpy(data, m_rx->data + offset, first);
+    memcpy(data + first, m_rx->data, size - first);
+    m_rx->tail.storeRelease(tail + size);
+
+    if (m_rx->writerWaiting.fetchAndStoreOrdered(0))
+        wakePeer();
+    return size;
+}
+
+qint64 ShmRingDevice::writeData(const char *data, qint64 size)
+{
+    if (!m_tx)
+        return -1;
+
+    //Anything still waiting for space has to go first
+    if (!m_pending.isEmpty()) {
+        m_pending.append(data, size);
+        flushPending();
+        return size;
+    }
+
+    const qint64 written = push(data, size);
+    if (written < size) {
+        m_pending.append(data + written, size - written);
+        flushPending();
+    }
+    return size;
+}
+
+qint64 ShmRingDevice::push(const char *data, qint64 size)
+{
+    const quint32 head = m_tx->head.load();
+    const quint32 used = head - m_tx->tail.loadAcquire();
+    if (!isValidFill(used))
+        return 0;
+    const quint32 space = ringCapacity - used;
+    const quint32 count = quint32(qMin<qint64>(size, space));
+    if (count == 0)
+        return 0;
+
+    const quint32 offset = head & (ringCapacity - 1);
+    const quint32 first = qMin(count, ringCapacity - offset);
+    memcpy(m_tx->data + offset, data, first);
+    memcpy(m_tx->data, data + first, count - first);
+    m_tx->head.storeRelease(head + count);
+
+    if (m_tx->readerWaiting.fetchAndStoreOrdered(0))
+        wakePeer();
+    return count;
+}
+
+void ShmRingDevice::flushPending()
+{
+    while (!m_pending.isEmpty()) {
+        const qint64 written = push(m_pending.constData(), m_pending.size());
+        if (written > 0) {
+            m_pending.remove(0, written);
+            continue;
+        }
+        //Ask the reader for a wakeup once it made space, and check again in
+        //case it did before seeing the flag
+        m_tx->writerWaiting.fetchAndStoreOrdered(1);
+        if (m_tx->head.load() - m_tx->tail.loadAcquire() >= ringCapacity)
+            break;
+    }
+}
+
+void ShmRingDevice::wakePeer()
+{
+    const quint64 value = 1;
+    const ssize_t result = ::write(m_peerEvent, &value, sizeof(value));
+    Q_UNUSED(result);
+}
+
+void ShmRingDevice::onEvent()
+{
+    if (!m_rx)
+        return;
+
+    quint64 value;
+    const ssize_t result = ::read(m_localEvent, &value, sizeof(value));
+    Q_UNUSED(result);
+
+    if (!isValidFill(m_rx->head.loadAcquire() - m_rx->tail.load())
+            || !isValidFill(m_tx->head.load() - m_tx->tail.loadAcquire())) {
+        qCWarning(QT_REMOTEOBJECT) << "Closing shared memory connection, the peer corrupted the rings";
+        close();
+        return;
+    }
+
+    const qint64 pending = m_pending.size();
+    flushPending();
+    if (m_pending.size() < pending)
+        emit bytesWritten(pending - m_pending.size());
+    if (!m_rx)
+        return;
+
+    //The flag is raised before looking at head, so anything the writer
+    //publishes after that look comes with a wakeup
+    forever {
+        m_rx->readerWaiting.fetchAndStoreOrdered(1);
+        const quint32 head = m_rx->head.loadAcquire();
+        if (head == m_notifiedHead)
+            break;
+        m_notifiedHead = head;
+        emit readyRead();
+        if (!m_rx)
+            return;
+    }
+}
+
+void ShmRingDevice::onSocketActivated()
+{
+    //Nothing is sent over the socket after the handshake, so it only becomes
+    //readable when the peer closed it
+    char byte;
+    const ssize_t result = ::recv(m_socket, &byte, 1, MSG_DONTWAIT);
+    if (result > 0 || (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)))
+        return;
+    close();
+}
+
+ShmClientIo::ShmClientIo(QObject *parent)
+    : ClientIoDevice(parent)
+    , m_device(new ShmRingDevice)
+    , m_handshakeSocket(-1)
+    , m_handshakeNotifier(Q_NULLPTR)
+{
+    connect(m_device.data(), &QIODevice::readyRead, this, &ClientIoDevice::readyRead);
+    connect(m_device.data(), &ShmRingDevice::disconnected, this, &ShmClientIo::onDisconnected);
+}
+
+ShmClientIo::~ShmClientIo()
+{
+    close();
+}
+
+QSharedPointer<QIODevice> ShmClientIo::connection()
+{
+    return m_device;
+}
+
+void ShmClientIo::doClose()
+{
+    abortHandshake();
+    m_device->close();
+    deleteLater();
+}
+
+void ShmClientIo::connectToServer()
+{
+    if (isOpen() || m_handshakeSocket >= 0)
+        return;
+
+    const QString name = url().path();
+    const QString path = name.startsWith(QLatin1Char('/')) ? name
+            : QDir::cleanPath(QDir::tempPath()) + QLatin1Char('/') + name;
+    const QByteArray encodedPath = QFile::encodeName(path);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (encodedPath.size() >= int(sizeof(address.sun_path))) {
+        qCWarning(QT_REMOTEOBJECT) << "Server name too long" << path;
+        return;
+    }
+    memcpy(address.sun_path, encodedPath.constData(), encodedPath.size());
+
+    int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket < 0 || ::connect(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        qCDebug(QT_REMOTEOBJECT) << "Could not connect to" << path << qt_error_string(errno);
+        closeDescriptor(socket);
+        //Host not there, wait and try again
+        emit shouldReconnect(this);
+        return;
+    }
+
+    m_handshakeSocket = socket;
+    m_handshakeNotifier = new QSocketNotifier(socket, QSocketNotifier::Read, this);
+    connect(m_handshakeNotifier, SIGNAL(activated(int)), this, SLOT(onHandshake()));
+}
+
+bool ShmClientIo::isOpen()
+{
+    return !isClosing() && m_device->isOpen();
+}
+
+void ShmClientIo::onHandshake()
+{
+    int fds[descriptorCount];
+    const int result = receiveDescriptors(m_handshakeSocket, fds);
+    if (result == 0)
+        return;
+
+    const int socket = m_handshakeSocket;
+    m_handshakeSocket = -1;
+    abortHandshake();
+    if (result < 0) {
+        ::close(socket);
+        emit shouldReconnect(this);
+        return;
+    }
+
+    if (!m_device->open(socket, fds[0], fds[2], fds[1], ShmRingDevice::ClientSide)) {
+        emit shouldReconnect(this);
+        return;
+    }
+    initializeDataStream();
+}
+
+void ShmClientIo::onDisconnected()
+{
+    if (!isClosing())
+        emit shouldReconnect(this);
+}
+
+void ShmClientIo::abortHandshake()
+{
+    if (m_handshakeNotifier) {
+        m_handshakeNotifier->setEnabled(false);
+        m_handshakeNotifier->deleteLater();
+        m_handshakeNotifier = Q_NULLPTR;
+    }
+    closeDescriptor(m_handshakeSocket);
+}
+
+ShmServerIo::ShmServerIo(ShmRingDevice *conn, QObject *parent)
+    : ServerIoDevice(parent), m_connection(conn)
+{
+    connect(conn, &QIODevice::readyRead, this, &ServerIoDevice::readyRead);
+    connect(conn, &ShmRingDevice::disconnected, this, &ServerIoDevice::disconnected);
+}
+
+QSharedPointer<QIODevice> ShmServerIo::connection() const
+{
+    return m_connection;
+}
+
+void ShmServerIo::doClose()
+{
+    m_connection->close();
+}
+
+void ShmLocalServer::incomingConnection(quintptr socketDescriptor)
+{
+    m_server->addConnection(int(socketDescriptor));
+}
+
+ShmServerImpl::ShmServerImpl(QObject *parent)
+    : QConnectionAbstractServer(parent)
+    , m_server(this)
+{
+}
+
+ShmServerImpl::~ShmServerImpl()
+{
+    m_server.close();
+    qDeleteAll(m_pendingConnections);
+}
+
+void ShmServerImpl::addConnection(int socket)
+{
+    int fds[descriptorCount];
+    if (!ShmRingDevice::createDescriptors(fds[0], fds[1], fds[2])) {
+        qCWarning(QT_REMOTEOBJECT) << "Could not create shared memory for new connection" << qt_error_string(errno);
+        ::close(socket);
+        return;
+    }
+
+    if (!sendDescriptors(socket, fds)) {
+        qCWarning(QT_REMOTEOBJECT) << "Could not pass shared memory to new connection" << qt_error_string(errno);
+        ::close(socket);
+        for (int i = 0; i < descriptorCount; ++i)
+            closeDescriptor(fds[i]);
+        return;
+    }
+
+    ShmRingDevice *device = new ShmRingDevice;
+    if (!device->open(socket, fds[0], fds[1], fds[2], ShmRingDevice::ServerSide)) {
+        delete device;
+        return;
+    }
+    m_pendingConnections.append(device);
+    emit newConnection();
+}
+
+ServerIoDevice *ShmServerImpl::configureNewConnection()
+{
+    if (m_pendingConnections.isEmpty())
+        return Q_NULLPTR;
+
+    return new ShmServerIo(m_pendingConnections.takeFirst(), this);
+}
+
+bool ShmServerImpl::hasPendingConnections() const
+{
+    return !m_pendingConnections.isEmpty();
+}
+
+QUrl ShmServerImpl::address() const
+{
+    QUrl result;
+    result.setPath(m_server.serverName());
+    result.setScheme(QRemoteObjectStringLiterals::shm());
+
+    return result;
+}
+
+bool ShmServerImpl::listen(const QUrl &address)
+{
+    bool res = m_server.listen(address.path());
+    if (!res) {
+        QLocalServer::removeServer(address.path());
+        res = m_server.listen(address.path());
+    }
+    return res;
+}
+
+QAbstractSocket::SocketError ShmServerImpl::serverError() const
+{
+    return m_server.serverError();
+}
+
+void ShmServerImpl::close()
+{
+    m_server.close();
+}
+
+REGISTER_QTRO_SERVER(ShmServerImpl, "shm");
+REGISTER_QTRO_CLIENT(ShmClientIo, "shm");
+
+QT_END_NAMESPACE
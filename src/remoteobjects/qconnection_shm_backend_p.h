@@ -0,0 +1,190 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Ford Motor Company
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtRemoteObjects module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QCONNECTION_SHM_BACKEND_P_H
+#define QCONNECTION_SHM_BACKEND_P_H
+
+#include "qconnectionfactories.h"
+
+#include <QLocalServer>
+#include <QSocketNotifier>
+
+QT_BEGIN_NAMESPACE
+
+struct ShmRing;
+
+//A QIODevice on top of two single producer/single consumer rings in memory
+//shared with the peer process, one per direction. The peer is only woken
+//(through its eventfd) when it went idle waiting for data or for space.
+//The unix socket the descriptors were passed over is kept open to notice
+//the peer going away.
+class ShmRingDevice : public QIODevice
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ShmRingDevice)
+
+public:
+    enum Side { ServerSide, ClientSide };
+
+    explicit ShmRingDevice(QObject *parent = Q_NULLPTR);
+    ~ShmRingDevice();
+
+    bool open(int socket, int memory, int localEvent, int peerEvent, Side side);
+    void close() Q_DECL_OVERRIDE;
+
+    bool isSequential() const Q_DECL_OVERRIDE { return true; }
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+    qint64 bytesToWrite() const Q_DECL_OVERRIDE;
+
+    static bool createDescriptors(int &memory, int &serverEvent, int &clientEvent);
+
+Q_SIGNALS:
+    void disconnected();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+    qint64 writeData(const char *data, qint64 size) Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void onEvent();
+    void onSocketActivated();
+
+private:
+    qint64 push(const char *data, qint64 size);
+    void flushPending();
+    void wakePeer();
+
+    int m_socket;
+    int m_localEvent;
+    int m_peerEvent;
+    void *m_memory;
+    ShmRing *m_rx;
+    ShmRing *m_tx;
+    quint32 m_notifiedHead;
+    QByteArray m_pending;
+    QSocketNotifier *m_eventNotifier;
+    QSocketNotifier *m_socketNotifier;
+};
+
+class ShmClientIo : public ClientIoDevice
+{
+    Q_OBJECT
+
+public:
+    explicit ShmClientIo(QObject *parent = Q_NULLPTR);
+    ~ShmClientIo();
+
+    QSharedPointer<QIODevice> connection() Q_DECL_OVERRIDE;
+    void connectToServer() Q_DECL_OVERRIDE;
+    bool isOpen() Q_DECL_OVERRIDE;
+
+public Q_SLOTS:
+    void onHandshake();
+    void onDisconnected();
+
+protected:
+    void doClose() Q_DECL_OVERRIDE;
+
+private:
+    void abortHandshake();
+
+    QSharedPointer<ShmRingDevice> m_device;
+    int m_handshakeSocket;
+    QSocketNotifier *m_handshakeNotifier;
+};
+
+class ShmServerIo : public ServerIoDevice
+{
+    Q_OBJECT
+public:
+    explicit ShmServerIo(ShmRingDevice *conn, QObject *parent = Q_NULLPTR);
+
+    QSharedPointer<QIODevice> connection() const Q_DECL_OVERRIDE;
+protected:
+    void doClose() Q_DECL_OVERRIDE;
+
+private:
+    QSharedPointer<ShmRingDevice> m_connection;
+};
+
+class ShmServerImpl;
+
+//Only used to get hold of the descriptor of accepted connections, before
+//QLocalServer wraps them into a QLocalSocket
+class ShmLocalServer : public QLocalServer
+{
+public:
+    explicit ShmLocalServer(ShmServerImpl *server) : m_server(server) {}
+
+protected:
+    void incomingConnection(quintptr socketDescriptor) Q_DECL_OVERRIDE;
+
+private:
+    ShmServerImpl *m_server;
+};
+
+class ShmServerImpl : public QConnectionAbstractServer
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ShmServerImpl)
+
+public:
+    explicit ShmServerImpl(QObject *parent);
+    ~ShmServerImpl();
+
+    bool hasPendingConnections() const Q_DECL_OVERRIDE;
+    ServerIoDevice *configureNewConnection() Q_DECL_OVERRIDE;
+    QUrl address() const Q_DECL_OVERRIDE;
+    bool listen(const QUrl &address) Q_DECL_OVERRIDE;
+    QAbstractSocket::SocketError serverError() const Q_DECL_OVERRIDE;
+    void close() Q_DECL_OVERRIDE;
+
+private:
+    friend class ShmLocalServer;
+    void addConnection(int socket);
+
+    ShmLocalServer m_server;
+    QList<ShmRingDevice *> m_pendingConnections;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -128,8 +128,7 @@ void TcpClientIo::onStateChanged(QAbstractSocket::SocketState state)
         emit shouldReconnect(this);
     }
     if (state == QAbstractSocket::ConnectedState) {
-        m_dataStream.setDevice(connection().data());
-        m_dataStream.resetStatus();
+        initializeDataStream();
     }
 }
 
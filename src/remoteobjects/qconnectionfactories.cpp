@@ -41,15 +41,25 @@
 
 #include "qconnectionfactories.h"
 #include "qconnectionfactories_p.h"
+#include "qremoteobjectpacket_p.h"
+
+#include <QtEndian>
 
 QT_BEGIN_NAMESPACE
 
 using namespace QtRemoteObjects;
 
-inline bool fromDataStream(QDataStream &in, QRemoteObjectPacketTypeEnum &type, QString &name)
+// Packets exchanged after the replica has been attached to its source carry
+// the numeric object id negotiated through ObjectList/Init instead of the
+// object name, see QRemoteObjectSourceIoAbstract::registerSource().
+inline bool fromDataStream(QDataStream &in, QRemoteObjectPacketTypeEnum &type, QString &name, int &objectId)
 {
     quint16 _type;
+    in.setByteOrder(QDataStream::BigEndian);
     in >> _type;
+    //The rest of the frame is read in the byte order it was written in
+    in.setByteOrder(_type & littleEndianPacketFlag ? QDataStream::LittleEndian : QDataStream::BigEndian);
+    _type &= ~littleEndianPacketFlag;
     type = Invalid;
     switch (_type) {
     case InitPacket: type = InitPacket; break;
@@ -60,23 +70,166 @@ inline bool fromDataStream(QDataStream &in, QRemoteObjectPacketTypeEnum &type, Q
     case InvokeReplyPacket: type = InvokeReplyPacket; break;
     case PropertyChangePacket: type = PropertyChangePacket; break;
     case ObjectList: type = ObjectList; break;
+    case PropertyChangeBatchPacket: type = PropertyChangeBatchPacket; break;
+    case PayloadReleasePacket: type = PayloadReleasePacket; break;
+    case Handshake: type = Handshake; break;
+    case InvokeTypedPacket: type = InvokeTypedPacket; break;
+    case InvokeCancelPacket: type = InvokeCancelPacket; break;
     default:
         qCWarning(QT_REMOTEOBJECT_IO) << "Invalid packet received" << type;
     }
     if (type == Invalid)
         return false;
-    if (type == ObjectList)
+    if (type == ObjectList || type == Handshake)
+        return true;
+    if (type == InvokePacket || type == InvokeReplyPacket || type == PropertyChangePacket
+            || type == PropertyChangeBatchPacket || type == InvokeTypedPacket || type == InvokeCancelPacket) {
+        in >> objectId;
         return true;
+    }
     in >> name;
     return true;
 }
 
-ClientIoDevice::ClientIoDevice(QObject *parent)
-    : QObject(parent), m_isClosing(false), m_curReadSize(0)
+//Size of the frame starting at pos including its size field, 0 if the size
+//field itself isn't complete yet
+inline qint64 frameSizeAt(const QByteArray &buffer, int pos)
+{
+    if (buffer.size() - pos < static_cast<int>(sizeof(quint32)))
+        return 0;
+    return sizeof(quint32) + qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(buffer.constData() + pos));
+}
+
+PacketReadBuffer::PacketReadBuffer()
+    : m_device(Q_NULLPTR), m_frameEnd(0), m_largeFrameFill(0)
+    , m_carriedOver(0), m_carriedOverReceivedAt(-1), m_lastReadAt(-1), m_frameReceivedAt(-1)
 {
+    //Keeps the allocation when all frames have been consumed
+    m_buffer.reserve(16 * 1024);
+    m_bufferDevice.setBuffer(&m_buffer);
+    m_bufferDevice.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    m_dataStream.setDevice(&m_bufferDevice);
     m_dataStream.setVersion(dataStreamVersion);
 }
 
+void PacketReadBuffer::setDevice(QIODevice *device)
+{
+    m_device = device;
+    m_buffer.clear();
+    m_frameEnd = 0;
+    m_largeFrameDevice.close();
+    m_largeFrame.clear();
+    m_largeFrameFill = 0;
+    m_carriedOver = 0;
+    m_frameReceivedAt = -1;
+    m_dataStream.setDevice(&m_bufferDevice);
+    m_dataStream.resetStatus();
+}
+
+bool PacketReadBuffer::read(QRemoteObjectPacketTypeEnum &type, QString &name, int &objectId)
+{
+    if (!m_device)
+        return false;
+
+    if (m_dataStream.device() == &m_largeFrameDevice) {
+        //Done with the previous frame, the decoder may have taken its buffer
+        m_largeFrameDevice.close();
+        m_largeFrame.clear();
+        m_largeFrameFill = 0;
+        m_dataStream.setDevice(&m_bufferDevice);
+    }
+
+    if (m_largeFrame.isEmpty()) {
+        //m_frameEnd skips whatever the decoder didn't consume of the previous frame
+        qint64 frameSize = frameSizeAt(m_buffer, m_frameEnd);
+        if (frameSize == 0 || (frameSize < largeFrameSize && m_buffer.size() - m_frameEnd < frameSize)) {
+            //What is left is the start of one frame, from this or an earlier read
+            if (m_frameEnd >= m_carriedOver)
+                m_carriedOverReceivedAt = m_lastReadAt;
+            m_buffer.remove(0, m_frameEnd);
+            m_frameEnd = 0;
+            m_carriedOver = m_buffer.size();
+            const qint64 available = m_device->bytesAvailable();
+            if (available > 0) {
+                m_lastReadAt = QRemoteObjectPackets::monotonicMSecs();
+                const int oldSize = m_buffer.size();
+                m_buffer.resize(oldSize + available);
+                const qint64 bytesRead = m_device->read(m_buffer.data() + oldSize, available);
+                m_buffer.resize(oldSize + qMax<qint64>(bytesRead, 0));
+            }
+            frameSize = frameSizeAt(m_buffer, 0);
+            if (frameSize == 0)
+                return false;
+        }
+        m_frameReceivedAt = m_frameEnd < m_carriedOver ? m_carriedOverReceivedAt : m_lastReadAt;
+
+        if (frameSize < largeFrameSize) {
+            if (m_buffer.size() - m_frameEnd < frameSize)
+                return false;
+            m_bufferDevice.seek(m_frameEnd + sizeof(quint32));
+            m_frameEnd += frameSize;
+            m_dataStream.resetStatus();
+            return fromDataStream(m_dataStream, type, name, objectId);
+        }
+
+        if (frameSize > maxFrameSize) {
+            qCWarning(QT_REMOTEOBJECT_IO) << "Closing connection, received a frame of" << frameSize
+                                          << "bytes, more than the maximum of" << maxFrameSize;
+            QIODevice *device = m_device;
+            setDevice(Q_NULLPTR);
+            device->close();
+            return false;
+        }
+
+        //The rest of a large frame is read from the device straight into a
+        //buffer of its own, instead of going through m_buffer
+        m_largeFrame.resize(static_cast<int>(frameSize));
+        m_largeFrameFill = qMin<qint64>(frameSize, m_buffer.size() - m_frameEnd);
+        memcpy(m_largeFrame.data(), m_buffer.constData() + m_frameEnd, m_largeFrameFill);
+        m_frameEnd += m_largeFrameFill;
+    }
+
+    const qint64 bytesRead = m_device->read(m_largeFrame.data() + m_largeFrameFill, m_largeFrame.size() - m_largeFrameFill);
+    if (bytesRead > 0)
+        m_largeFrameFill += bytesRead;
+    if (m_largeFrameFill < m_largeFrame.size())
+        return false;
+
+    m_largeFrameDevice.setBuffer(&m_largeFrame);
+    m_largeFrameDevice.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    m_largeFrameDevice.seek(sizeof(quint32));
+    m_dataStream.setDevice(&m_largeFrameDevice);
+    m_dataStream.resetStatus();
+    return fromDataStream(m_dataStream, type, name, objectId);
+}
+
+//The buffer of the current frame if it is a large one, which the decoder may
+//take ownership of, see QRemoteObjectPackets::deserializeInvokePacket()
+QByteArray *PacketReadBuffer::largeFrame()
+{
+    return m_dataStream.device() == &m_largeFrameDevice ? &m_largeFrame : Q_NULLPTR;
+}
+
+QByteArray PacketReadBuffer::remainingFrame()
+{
+    if (m_dataStream.device() == &m_largeFrameDevice)
+        return m_largeFrame.mid(static_cast<int>(m_largeFrameDevice.pos()));
+    const int pos = static_cast<int>(m_bufferDevice.pos());
+    return m_buffer.mid(pos, m_frameEnd - pos);
+}
+
+qint64 PacketReadBuffer::bytesAvailable() const
+{
+    const qint64 buffered = m_buffer.size() - m_frameEnd;
+    return buffered + (m_device ? m_device->bytesAvailable() : 0);
+}
+
+ClientIoDevice::ClientIoDevice(QObject *parent)
+    : QObject(parent), m_isClosing(false), m_byteOrder(QDataStream::BigEndian)
+    , m_batchDepth(0), m_autoBatch(false), m_flushPosted(false)
+{
+}
+
 ClientIoDevice::~ClientIoDevice()
 {
     if (!m_isClosing)
@@ -86,42 +239,67 @@ ClientIoDevice::~ClientIoDevice()
 void ClientIoDevice::close()
 {
     m_isClosing = true;
+    m_batch.clear();
     doClose();
 }
 
-bool ClientIoDevice::read(QRemoteObjectPacketTypeEnum &type, QString &name)
+bool ClientIoDevice::read(QRemoteObjectPacketTypeEnum &type, QString &name, int &objectId)
 {
-    qCDebug(QT_REMOTEOBJECT_IO) << "ClientIODevice::read()" << m_curReadSize << bytesAvailable();
+    qCDebug(QT_REMOTEOBJECT_IO) << "ClientIODevice::read()" << bytesAvailable();
+    return m_readBuffer.read(type, name, objectId);
+}
 
-    if (m_curReadSize == 0) {
-        if (bytesAvailable() < static_cast<int>(sizeof(quint32)))
-            return false;
+void ClientIoDevice::write(const QByteArray &data)
+{
+    write(data, data.size());
+}
 
-        m_dataStream >> m_curReadSize;
+void ClientIoDevice::write(const QByteArray &data, qint64 size)
+{
+    if (m_batchDepth == 0 && !m_autoBatch) {
+        connection().data()->write(data.data(), size);
+        return;
     }
 
-    qCDebug(QT_REMOTEOBJECT_IO) << "ClientIODevice::read()-looking for map" << m_curReadSize << bytesAvailable();
-
-    if (bytesAvailable() < m_curReadSize)
-        return false;
+    m_batch.append(data.constData(), int(size));
+    if (m_batchDepth == 0 && !m_flushPosted) {
+        m_flushPosted = true;
+        QMetaObject::invokeMethod(this, "flushBatch", Qt::QueuedConnection);
+    }
+}
 
-    m_curReadSize = 0;
-    return fromDataStream(m_dataStream, type, name);
+void ClientIoDevice::beginBatch()
+{
+    ++m_batchDepth;
 }
 
-void ClientIoDevice::write(const QByteArray &data)
+void ClientIoDevice::endBatch()
 {
-    connection().data()->write(data);
+    //The connection may have been created while the batch was open
+    if (m_batchDepth > 0 && --m_batchDepth == 0)
+        flushBatch();
 }
 
-void ClientIoDevice::write(const QByteArray &data, qint64 size)
+void ClientIoDevice::flushBatch()
 {
-    connection().data()->write(data.data(), size);
+    m_flushPosted = false;
+    if (m_batch.isEmpty() || m_batchDepth > 0)
+        return;
+
+    //Like an unbatched write, bytes written before the connection dropped are lost
+    if (!m_isClosing && isOpen())
+        connection().data()->write(m_batch);
+    m_batch.clear();
 }
 
 qint64 ClientIoDevice::bytesAvailable()
 {
-    return connection().data()->bytesAvailable();
+    return m_readBuffer.bytesAvailable();
+}
+
+void ClientIoDevice::initializeDataStream()
+{
+    m_readBuffer.setDevice(connection().data());
 }
 
 QUrl ClientIoDevice::url() const
@@ -145,62 +323,189 @@ QSet<QString> ClientIoDevice::remoteObjects() const
 }
 
 ServerIoDevice::ServerIoDevice(QObject *parent)
-    : QObject(parent), m_isClosing(false), m_curReadSize(0)
+    : QObject(parent), m_isClosing(false)
+    , m_dequeued(0)
+    , m_queuedBytes(0)
+    , m_queuedPackets(0)
+    , m_maxQueuedBytes(0)
+    , m_maxQueuedPackets(0)
+    , m_overflowPolicy(DropSignals)
+    , m_congested(false)
 {
-    m_dataStream.setVersion(dataStreamVersion);
 }
 
 ServerIoDevice::~ServerIoDevice()
 {
 }
 
-bool ServerIoDevice::read(QRemoteObjectPacketTypeEnum &type, QString &name)
+bool ServerIoDevice::read(QRemoteObjectPacketTypeEnum &type, QString &name, int &objectId)
 {
-    qCDebug(QT_REMOTEOBJECT_IO) << "ServerIODevice::read()" << m_curReadSize << bytesAvailable();
+    qCDebug(QT_REMOTEOBJECT_IO) << "ServerIODevice::read()" << bytesAvailable();
+    return m_readBuffer.read(type, name, objectId);
+}
 
-    if (m_curReadSize == 0) {
-        if (bytesAvailable() < static_cast<int>(sizeof(quint32)))
-            return false;
+void ServerIoDevice::close()
+{
+    m_isClosing = true;
+    m_sendQueue.clear();
+    m_queuedProperties.clear();
+    m_queuedBytes = 0;
+    m_queuedPackets = 0;
+    doClose();
+}
 
-        m_dataStream >> m_curReadSize;
-    }
+void ServerIoDevice::write(const QByteArray &data)
+{
+    write(data, data.size());
+}
 
-    qCDebug(QT_REMOTEOBJECT_IO) << "ServerIODevice::read()-looking for map" << m_curReadSize << bytesAvailable();
+void ServerIoDevice::write(const QByteArray &data, qint64 size)
+{
+    if (!connection()->isOpen() || m_isClosing)
+        return;
+
+    //The device only gets what it can pass on soon, so a slow reader backs up
+    //into the send queue, where the limits apply
+    if (m_sendQueue.isEmpty() && connection()->bytesToWrite() < deviceWriteBufferSize)
+        connection()->write(data.constData(), size);
+    else
+        enqueue(data, size);
+}
 
-    if (bytesAvailable() < m_curReadSize)
+//A single PropertyChangePacket can be replaced by a newer one for the same
+//property, its key is made of the object id and property index
+static bool conflationKey(const char *data, qint64 size, quint64 *key)
+{
+    //Size, type, object id, property index and the type id of the value
+    const qint64 headerSize = 3 * sizeof(quint32) + sizeof(quint16) + sizeof(quint32);
+    if (size < headerSize)
+        return false;
+    const uchar *header = reinterpret_cast<const uchar *>(data);
+    const quint16 type = qFromBigEndian<quint16>(header + 4);
+    if (qFromBigEndian<quint32>(header) + sizeof(quint32) != quint64(size)
+            || (type & ~littleEndianPacketFlag) != PropertyChangePacket)
         return false;
+    const bool littleEndian = type & littleEndianPacketFlag;
+    const auto field = [header, littleEndian](int offset) {
+        return littleEndian ? qFromLittleEndian<quint32>(header + offset) : qFromBigEndian<quint32>(header + offset);
+    };
+    //A value of a user type might be the handle of an out of band payload,
+    //which the replica has to see to release it
+    if (field(14) >= QMetaType::User)
+        return false;
+    *key = quint64(field(6)) << 32 | field(10);
+    return true;
+}
+
+//A packet that is all of data, like a cached Init packet, is queued without
+//copying it
+void ServerIoDevice::enqueue(const QByteArray &data, qint64 size)
+{
+    QueuedPacket packet;
+    packet.conflatable = conflationKey(data.constData(), size, &packet.property);
+
+    if (isAboveHighWaterMark()) {
+        if (packet.conflatable) {
+            //Replace the queued change of the same property where it is, so
+            //the new value keeps its place relative to the packets queued since
+            const auto it = m_queuedProperties.constFind(packet.property);
+            if (it != m_queuedProperties.constEnd()) {
+                QByteArray &stale = m_sendQueue[int(*it - m_dequeued)].data;
+                m_queuedBytes += size - stale.size();
+                stale = size == data.size() ? data : QByteArray(data.constData(), size);
+                return;
+            }
+        }
+
+        if (m_overflowPolicy == CloseConnection) {
+            qCWarning(QT_REMOTEOBJECT_IO) << "Closing connection, its send queue is full:" << m_queuedPackets << "packets" << m_queuedBytes << "bytes";
+            close();
+            return;
+        }
+        if (size >= qint64(sizeof(quint32) + sizeof(quint16))
+                && (qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(data.constData()) + 4) & ~littleEndianPacketFlag) == InvokePacket) {
+            qCDebug(QT_REMOTEOBJECT_IO) << "Dropping signal, send queue is full:" << m_queuedPackets << "packets" << m_queuedBytes << "bytes";
+            return;
+        }
+        //Replies, batches and property changes that can't be conflated can't
+        //be dropped either, so they are queued until the hard limit
+        if (isAboveHardLimit()) {
+            qCWarning(QT_REMOTEOBJECT_IO) << "Closing connection, its send queue exceeds twice its limit:" << m_queuedPackets << "packets" << m_queuedBytes << "bytes";
+            close();
+            return;
+        }
+    }
 
-    m_curReadSize = 0;
-    return fromDataStream(m_dataStream, type, name);
+    packet.data = size == data.size() ? data : QByteArray(data.constData(), size);
+    if (packet.conflatable)
+        m_queuedProperties[packet.property] = m_dequeued + m_sendQueue.size();
+    m_sendQueue.append(packet);
+    m_queuedBytes += size;
+    ++m_queuedPackets;
+
+    if (!m_congested && isAboveHighWaterMark()) {
+        m_congested = true;
+        emit congestionChanged(true);
+    }
 }
 
-void ServerIoDevice::close()
+void ServerIoDevice::flushSendQueue()
 {
-    m_isClosing = true;
-    doClose();
+    QIODevice *device = connection().data();
+    if (!device->isOpen() || m_isClosing)
+        return;
+
+    while (!m_sendQueue.isEmpty() && device->bytesToWrite() < deviceWriteBufferSize) {
+        const QueuedPacket packet = m_sendQueue.takeFirst();
+        const qint64 sequence = m_dequeued++;
+        if (packet.conflatable && m_queuedProperties.value(packet.property, -1) == sequence)
+            m_queuedProperties.remove(packet.property);
+        m_queuedBytes -= packet.data.size();
+        --m_queuedPackets;
+        device->write(packet.data);
+    }
+
+    if (m_congested && isBelowLowWaterMark()) {
+        m_congested = false;
+        emit congestionChanged(false);
+    }
 }
 
-void ServerIoDevice::write(const QByteArray &data)
+void ServerIoDevice::setSendQueueLimits(qint64 maxBytes, int maxPackets)
 {
-    if (connection()->isOpen() && !m_isClosing)
-        connection()->write(data);
+    m_maxQueuedBytes = qMax<qint64>(maxBytes, 0);
+    m_maxQueuedPackets = qMax(maxPackets, 0);
 }
 
-void ServerIoDevice::write(const QByteArray &data, qint64 size)
+bool ServerIoDevice::isAboveHighWaterMark() const
 {
-    if (connection()->isOpen() && !m_isClosing)
-        connection()->write(data.data(), size);
+    return (m_maxQueuedBytes > 0 && m_queuedBytes >= m_maxQueuedBytes)
+            || (m_maxQueuedPackets > 0 && m_queuedPackets >= m_maxQueuedPackets);
+}
+
+bool ServerIoDevice::isAboveHardLimit() const
+{
+    return (m_maxQueuedBytes > 0 && m_queuedBytes >= 2 * m_maxQueuedBytes)
+            || (m_maxQueuedPackets > 0 && m_queuedPackets >= 2 * qint64(m_maxQueuedPackets));
+}
+
+//Congestion is only over once half of the queue has been sent, so a reader
+//close to the limit doesn't toggle it with every packet
+bool ServerIoDevice::isBelowLowWaterMark() const
+{
+    return (m_maxQueuedBytes == 0 || m_queuedBytes <= m_maxQueuedBytes / 2)
+            && (m_maxQueuedPackets == 0 || m_queuedPackets <= m_maxQueuedPackets / 2);
 }
 
 qint64 ServerIoDevice::bytesAvailable()
 {
-    return connection()->bytesAvailable();
+    return m_readBuffer.bytesAvailable();
 }
 
 void ServerIoDevice::initializeDataStream()
 {
-    m_dataStream.setDevice(connection().data());
-    m_dataStream.resetStatus();
+    m_readBuffer.setDevice(connection().data());
+    connect(connection().data(), &QIODevice::bytesWritten, this, &ServerIoDevice::flushSendQueue, Qt::UniqueConnection);
 }
 
 QConnectionAbstractServer::QConnectionAbstractServer(QObject *parent)
@@ -43,25 +43,76 @@
 #define QCONNECTIONFACTORIES_H
 
 #include <QAbstractSocket>
+#include <QBuffer>
 #include <QDataStream>
+#include <QHash>
+#include <QList>
 #include <QSharedPointer>
 #include "qtremoteobjectglobal.h"
 
 QT_BEGIN_NAMESPACE
 
+//Receive side framing shared by ServerIoDevice and ClientIoDevice. All bytes
+//the device has are read into one buffer at a time and the packets found in
+//it are decoded from an in-memory stream, instead of from the socket itself.
+class PacketReadBuffer
+{
+    Q_DISABLE_COPY(PacketReadBuffer)
+
+public:
+    PacketReadBuffer();
+
+    void setDevice(QIODevice *device);
+    bool read(QtRemoteObjects::QRemoteObjectPacketTypeEnum &, QString &, int &);
+    qint64 bytesAvailable() const;
+    inline QDataStream& stream() { return m_dataStream; }
+    QByteArray *largeFrame();
+    //The part of the current frame that wasn't read from stream() yet
+    QByteArray remainingFrame();
+    //When the first bytes of the current frame were read from the device, see
+    //QRemoteObjectPackets::monotonicMSecs()
+    qint64 frameReceivedAt() const { return m_frameReceivedAt; }
+
+private:
+    QIODevice *m_device;
+    QByteArray m_buffer;
+    QBuffer m_bufferDevice;
+    QDataStream m_dataStream;
+    int m_frameEnd;
+    QByteArray m_largeFrame;
+    QBuffer m_largeFrameDevice;
+    int m_largeFrameFill;
+    //The incomplete frame kept at the start of m_buffer when it was last
+    //filled came with an earlier read than the bytes after it
+    int m_carriedOver;
+    qint64 m_carriedOverReceivedAt;
+    qint64 m_lastReadAt;
+    qint64 m_frameReceivedAt;
+};
+
 //The Qt servers create QIODevice derived classes from handleConnection.
 //The problem is that they behave differently, so this class adds some
 //consistency.
+//Packets the device can't take right away wait in a send queue. Once the
+//queue reaches its limits, queued property changes are replaced by newer
+//values of the same property, and the overflow policy decides what happens
+//to signals.
 class ServerIoDevice : public QObject
 {
     Q_OBJECT
     Q_DISABLE_COPY(ServerIoDevice)
 
 public:
+    //Same values as QRemoteObjectHostBase::SendQueuePolicy
+    enum OverflowPolicy {
+        DropSignals,
+        CloseConnection
+    };
+
     explicit ServerIoDevice(QObject *parent = Q_NULLPTR);
     virtual ~ServerIoDevice();
 
-    bool read(QtRemoteObjects::QRemoteObjectPacketTypeEnum &, QString &);
+    bool read(QtRemoteObjects::QRemoteObjectPacketTypeEnum &, QString &, int &);
 
     virtual void write(const QByteArray &data);
     virtual void write(const QByteArray &data, qint64);
@@ -69,19 +120,50 @@ public:
     virtual qint64 bytesAvailable();
     virtual QSharedPointer<QIODevice> connection() const = 0;
     void initializeDataStream();
-    QDataStream& stream() { return m_dataStream; }
+    QDataStream& stream() { return m_readBuffer.stream(); }
+    QByteArray *largeFrame() { return m_readBuffer.largeFrame(); }
+    qint64 frameReceivedAt() const { return m_readBuffer.frameReceivedAt(); }
+
+    void setSendQueueLimits(qint64 maxBytes, int maxPackets);
+    void setOverflowPolicy(OverflowPolicy policy) { m_overflowPolicy = policy; }
+    bool isCongested() const { return m_congested; }
 
 Q_SIGNALS:
     void disconnected();
     void readyRead();
+    void congestionChanged(bool congested);
 
 protected:
     virtual void doClose() = 0;
 
+private Q_SLOTS:
+    void flushSendQueue();
+
 private:
+    struct QueuedPacket
+    {
+        QByteArray data; //Empty once replaced by a newer value
+        quint64 property;
+        bool conflatable;
+    };
+
+    void enqueue(const QByteArray &data, qint64 size);
+    bool isAboveHighWaterMark() const;
+    bool isAboveHardLimit() const;
+    bool isBelowLowWaterMark() const;
+
     bool m_isClosing;
-    quint32 m_curReadSize;
-    QDataStream m_dataStream;
+    PacketReadBuffer m_readBuffer;
+    QList<QueuedPacket> m_sendQueue;
+    //Sequence number of the queued change of each property, by object id and index
+    QHash<quint64, qint64> m_queuedProperties;
+    qint64 m_dequeued;
+    qint64 m_queuedBytes;
+    int m_queuedPackets;
+    qint64 m_maxQueuedBytes;
+    int m_maxQueuedPackets;
+    OverflowPolicy m_overflowPolicy;
+    bool m_congested;
 };
 
 class QConnectionAbstractServer : public QObject
@@ -107,6 +189,8 @@ Q_SIGNALS:
     void newConnection();
 };
 
+//Writes made while a batch is open, or during one event loop iteration with
+//auto batching, are collected and passed to the connection in one write.
 class ClientIoDevice : public QObject
 {
     Q_OBJECT
@@ -116,7 +200,7 @@ public:
     explicit ClientIoDevice(QObject *parent = Q_NULLPTR);
     virtual ~ClientIoDevice();
 
-    bool read(QtRemoteObjects::QRemoteObjectPacketTypeEnum &, QString &);
+    bool read(QtRemoteObjects::QRemoteObjectPacketTypeEnum &, QString &, int &);
 
     virtual void write(const QByteArray &data);
     virtual void write(const QByteArray &data, qint64);
@@ -131,7 +215,16 @@ public:
 
     virtual bool isOpen() = 0;
     virtual QSharedPointer<QIODevice> connection() = 0;
-    inline QDataStream& stream() { return m_dataStream; }
+    //Byte order of the frames written to the connection, agreed on in the Handshake
+    QDataStream::ByteOrder byteOrder() const { return m_byteOrder; }
+    void setByteOrder(QDataStream::ByteOrder byteOrder) { m_byteOrder = byteOrder; }
+    inline QDataStream& stream() { return m_readBuffer.stream(); }
+    inline QByteArray *largeFrame() { return m_readBuffer.largeFrame(); }
+
+    //Batches nest, the outermost endBatch() sends the collected writes
+    void beginBatch();
+    void endBatch();
+    void setAutoBatch(bool enabled) { m_autoBatch = enabled; }
 
 Q_SIGNALS:
     void disconnected();
@@ -140,16 +233,24 @@ Q_SIGNALS:
 protected:
     virtual void doClose() = 0;
     inline bool isClosing() { return m_isClosing; }
-    QDataStream m_dataStream;
+    void initializeDataStream();
+
+private Q_SLOTS:
+    void flushBatch();
 
 private:
     bool m_isClosing;
     QUrl m_url;
+    QDataStream::ByteOrder m_byteOrder;
+    QByteArray m_batch;
+    int m_batchDepth;
+    bool m_autoBatch;
+    bool m_flushPosted;
 
 private:
     friend struct QtROClientFactory;
 
-    quint32 m_curReadSize;
+    PacketReadBuffer m_readBuffer;
     QSet<QString> m_remoteObjects;
 };
 
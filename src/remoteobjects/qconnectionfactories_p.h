@@ -50,6 +50,49 @@ namespace QtRemoteObjects {
 
 const int dataStreamVersion = QDataStream::Qt_5_1;
 
+//Frames of at least this size are read into a buffer of their own, which a
+//QByteArray argument of at least this size is then handed out from
+const int largeFrameSize = 256 * 1024;
+
+//Frames announcing more than this are rejected before anything is allocated
+//for them, and the connection is closed
+const qint64 maxFrameSize = 512 * 1024 * 1024;
+
+//The low bits of an object id are the slot of the source in the tables of
+//both ends, the others count how often the host reused that slot
+const int objectIdSlotBits = 20;
+const int objectIdSlotMask = (1 << objectIdSlotBits) - 1;
+const int objectIdGenerationMask = (1 << (31 - objectIdSlotBits)) - 1;
+
+//ServerIoDevice only writes to a device with less than this pending, anything
+//beyond is kept in its send queue
+const qint64 deviceWriteBufferSize = 64 * 1024;
+
+//The size and type of a frame are always big endian. This bit of the type
+//marks a frame whose other fields are little endian.
+const quint16 littleEndianPacketFlag = 0x8000;
+
+//Capabilities exchanged in the Handshake packet
+enum ConnectionCapability {
+    LittleEndianCapability = 0x1  //Both ends prefer little endian frames
+};
+
+//Byte order the frames written to a peer with the given capabilities use
+inline QDataStream::ByteOrder wireByteOrder(quint32 capabilities)
+{
+    return capabilities & LittleEndianCapability ? QDataStream::LittleEndian : QDataStream::BigEndian;
+}
+
+//Capabilities this process offers or accepts
+inline quint32 localCapabilities()
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    return LittleEndianCapability;
+#else
+    return 0;
+#endif
+}
+
 }
 
 QT_END_NAMESPACE
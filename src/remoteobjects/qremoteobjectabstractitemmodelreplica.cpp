@@ -494,19 +494,17 @@ int collectEntriesForRow(DataEntries* filteredEntries, int row, const DataEntrie
     return size;
 }
 
-void QAbstractItemModelReplicaPrivate::requestedData(QRemoteObjectPendingCallWatcher *qobject)
+void QAbstractItemModelReplicaPrivate::requestedData(const QRemoteObjectPendingReply<DataEntries> &reply, const RequestedData &request)
 {
-    RowWatcher *watcher = static_cast<RowWatcher *>(qobject);
-    Q_ASSERT(watcher);
-    Q_ASSERT(watcher->start.size() == watcher->end.size());
+    Q_ASSERT(request.start.size() == request.end.size());
 
-    qCDebug(QT_REMOTEOBJECT_MODELS) << Q_FUNC_INFO << "start=" << watcher->start << "end=" << watcher->end;
+    qCDebug(QT_REMOTEOBJECT_MODELS) << Q_FUNC_INFO << "start=" << request.start << "end=" << request.end;
 
-    IndexList parentList = watcher->start;
+    IndexList parentList = request.start;
     Q_ASSERT(!parentList.isEmpty());
     parentList.pop_back();
     auto parentItem = cacheData(parentList);
-    DataEntries entries = watcher->returnValue().value<DataEntries>();
+    DataEntries entries = reply.returnValue();
 
     const int rowCount = parentItem->rowCount;
     const int columnCount = parentItem->columnCount;
@@ -514,17 +512,17 @@ void QAbstractItemModelReplicaPrivate::requestedData(QRemoteObjectPendingCallWat
     if (rowCount < 1 || columnCount < 1)
         return;
 
-    const int startRow =  std::min(watcher->start.last().row, rowCount - 1);
-    const int endRow = std::min(watcher->end.last().row, rowCount - 1);
-    const int startColumn = std::min(watcher->start.last().column, columnCount - 1);
-    const int endColumn = std::min(watcher->end.last().column, columnCount - 1);
+    const int startRow =  std::min(request.start.last().row, rowCount - 1);
+    const int endRow = std::min(request.end.last().row, rowCount - 1);
+    const int startColumn = std::min(request.start.last().column, columnCount - 1);
+    const int endColumn = std::min(request.end.last().column, columnCount - 1);
     Q_ASSERT_X(startRow >= 0 && startRow < parentItem->rowCount, __FUNCTION__, qPrintable(QString(QLatin1String("0 <= %1 < %2")).arg(startRow).arg(parentItem->rowCount)));
     Q_ASSERT_X(endRow >= 0 && endRow < parentItem->rowCount, __FUNCTION__, qPrintable(QString(QLatin1String("0 <= %1 < %2")).arg(endRow).arg(parentItem->rowCount)));
 
     for (int i = 0; i < entries.data.size(); ++i) {
         IndexValuePair pair = entries.data[i];
         if (auto item = createCacheData(pair.index))
-            fillRow(item, pair, q, watcher->roles);
+            fillRow(item, pair, q, request.roles);
     }
 
     const QModelIndex parentIndex = toQModelIndex(parentList, q);
@@ -532,9 +530,15 @@ void QAbstractItemModelReplicaPrivate::requestedData(QRemoteObjectPendingCallWat
     const QModelIndex endIndex = q->index(endRow, endColumn, parentIndex);
     Q_ASSERT(startIndex.isValid());
     Q_ASSERT(endIndex.isValid());
-    emit q->dataChanged(startIndex, endIndex, watcher->roles);
-    m_pendingRequests.removeAll(watcher);
-    delete watcher;
+    emit q->dataChanged(startIndex, endIndex, request.roles);
+}
+
+void QAbstractItemModelReplicaPrivate::handleFinishedData()
+{
+    const QVector<QPair<QRemoteObjectPendingReply<DataEntries>, RequestedData> > finished = m_finishedData;
+    m_finishedData.clear();
+    for (const auto &data : finished)
+        requestedData(data.first, data.second);
 }
 
 void QAbstractItemModelReplicaPrivate::fetchPendingData()
@@ -613,10 +617,15 @@ void QAbstractItemModelReplicaPrivate::fetchPendingData()
         qCDebug(QT_REMOTEOBJECT_MODELS) << Q_FUNC_INFO << "FINAL start=" << it->start << "end=" << it->end << "roles=" << it->roles;
 
         QRemoteObjectPendingReply<DataEntries> reply = replicaRowRequest(it->start, it->end, it->roles);
-        RowWatcher *watcher = new RowWatcher(it->start, it->end, it->roles, reply);
         rows += 1 + it->end.first().row - it->start.first().row;
-        m_pendingRequests.push_back(watcher);
-        connect(watcher, &RowWatcher::finished, this, &QAbstractItemModelReplicaPrivate::requestedData);
+        const RequestedData request = *it;
+        //Handled from the event loop, like the watcher signals were, rather
+        //than while the node is still in the middle of the reply packet
+        reply.then(this, [this, request](const QRemoteObjectPendingReply<DataEntries> &result) {
+            if (m_finishedData.isEmpty())
+                QMetaObject::invokeMethod(this, "handleFinishedData", Qt::QueuedConnection);
+            m_finishedData.append(qMakePair(result, request));
+        });
     }
     m_requestedData.clear();
 }
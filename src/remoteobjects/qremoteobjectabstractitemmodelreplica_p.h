@@ -283,19 +283,6 @@ public:
     IndexList parentList;
 };
 
-class RowWatcher : public QRemoteObjectPendingCallWatcher
-{
-    Q_OBJECT
-public:
-    RowWatcher(IndexList _start, IndexList _end, QVector<int> _roles, const QRemoteObjectPendingReply<DataEntries> &reply)
-        : QRemoteObjectPendingCallWatcher(reply),
-          start(_start),
-          end(_end),
-          roles(_roles) {}
-    IndexList start, end;
-    QVector<int> roles;
-};
-
 class HeaderWatcher : public QRemoteObjectPendingCallWatcher
 {
     Q_OBJECT
@@ -394,10 +381,10 @@ public Q_SLOTS:
     void onRowsMoved(IndexList srcParent, int srcRow, int count, IndexList destParent, int destRow);
     void onCurrentChanged(IndexList current, IndexList previous);
     void onModelReset();
-    void requestedData(QRemoteObjectPendingCallWatcher *);
     void requestedHeaderData(QRemoteObjectPendingCallWatcher *);
     void init();
     void fetchPendingData();
+    void handleFinishedData();
     void fetchPendingHeaderData();
     void handleInitDone(QRemoteObjectPendingCallWatcher *watcher);
     void handleModelResetDone(QRemoteObjectPendingCallWatcher *watcher);
@@ -405,6 +392,8 @@ public Q_SLOTS:
     void onReplicaCurrentChanged(const QModelIndex &current, const QModelIndex &previous);
 
 public:
+    void requestedData(const QRemoteObjectPendingReply<DataEntries> &reply, const RequestedData &request);
+
     QScopedPointer<QItemSelectionModel> m_selectionModel;
     QVector<CacheEntry> m_headerData[2];
 
@@ -443,6 +432,7 @@ public:
 
     int m_lastRequested;
     QVector<RequestedData> m_requestedData;
+    QVector<QPair<QRemoteObjectPendingReply<DataEntries>, RequestedData> > m_finishedData;
     QVector<RequestedHeaderData> m_requestedHeaderData;
     QVector<QRemoteObjectPendingCallWatcher*> m_pendingRequests;
     QAbstractItemModelReplica *q;
@@ -82,6 +82,7 @@ QRemoteObjectNodePrivate::QRemoteObjectNodePrivate()
     , registry(Q_NULLPTR)
     , retryInterval(250)
     , m_lastError(QRemoteObjectNode::NoError)
+    , batchInvocations(false)
 { }
 
 QRemoteObjectNodePrivate::~QRemoteObjectNodePrivate()
@@ -234,6 +235,7 @@ bool QRemoteObjectNodePrivate::setConnection(QSharedPointer<QIODevice> device)
     }
 
     qROPrivDebug() << "Replica Connection isValid" << connection->isOpen();
+    connection->setAutoBatch(batchInvocations);
     QObject::connect(connection, SIGNAL(shouldReconnect(ClientIoDevice*)), q, SLOT(onShouldReconnect(ClientIoDevice*)));
     connection->connectToServer();
     QObject::connect(connection, SIGNAL(readyRead()), &clientRead, SLOT(map()));
@@ -258,6 +260,7 @@ bool QRemoteObjectNodePrivate::initConnection(const QUrl &address)
     }
 
     qROPrivDebug() << "Replica Connection isValid" << connection->isOpen();
+    connection->setAutoBatch(batchInvocations);
     QObject::connect(connection, SIGNAL(shouldReconnect(ClientIoDevice*)), q, SLOT(onShouldReconnect(ClientIoDevice*)));
     connection->connectToServer();
     QObject::connect(connection, SIGNAL(readyRead()), &clientRead, SLOT(map()));
@@ -265,6 +268,13 @@ bool QRemoteObjectNodePrivate::initConnection(const QUrl &address)
     return true;
 }
 
+//The connections are children of the node, and deleted with it
+QList<ClientIoDevice*> QRemoteObjectNodePrivate::connections() const
+{
+    Q_Q(const QRemoteObjectNode);
+    return q->findChildren<ClientIoDevice*>(QString(), Qt::FindDirectChildrenOnly);
+}
+
 bool QRemoteObjectNodePrivate::hasInstance(const QString &name)
 {
     if (!replicas.contains(name))
@@ -336,6 +346,10 @@ void QRemoteObjectNodePrivate::onShouldReconnect(ClientIoDevice *ioDevice)
 {
     Q_Q(QRemoteObjectNode);
 
+    replicaTables.remove(ioDevice);
+    if (packetReader)
+        packetReader->reset(ioDevice);
+
     Q_FOREACH (const QString &remoteObject, ioDevice->remoteObjects()) {
         connectedSources.remove(remoteObject);
         ioDevice->removeSource(remoteObject);
@@ -370,7 +384,8 @@ QReplicaPrivateInterface *QRemoteObjectNodePrivate::handleNewAcquire(const QMeta
     QConnectedReplicaPrivate *rp = new QConnectedReplicaPrivate(name, meta, q);
     rp->configurePrivate(instance);
     if (connectedSources.contains(name)) { //Either we have a peer connections, or existing connection via registry
-        rp->setConnection(connectedSources[name].device);
+        const SourceInfo &info = connectedSources[name];
+        rp->setConnection(info.device, info.objectId, info.typeName, info.interfaceHash);
     } else if (remoteObjectAddresses().contains(name)) { //No existing connection, but we know we can connect via registry
         initConnection(remoteObjectAddresses()[name].hostUrl); //This will try the connection, and if successful, the remoteObjects will be sent
                                               //The link to the replica will be handled then
@@ -394,154 +409,226 @@ QReplicaPrivateInterface *QRemoteObjectHostBasePrivate::handleNewAcquire(const Q
     return QRemoteObjectNodePrivate::handleNewAcquire(meta, instance, name);
 }
 
+QSharedPointer<QReplicaPrivateInterface> QRemoteObjectNodePrivate::replicaForId(ClientIoDevice *connection, int objectId) const
+{
+    //Packets arrive in order, so those for a removed source all precede the
+    //RemoveObject packet that frees its slot for another one
+    const int slot = objectId & QtRemoteObjects::objectIdSlotMask;
+    const QHash<ClientIoDevice*, ReplicaTable>::const_iterator it = replicaTables.constFind(connection);
+    if (it == replicaTables.constEnd() || objectId < 0 || slot >= it->size())
+        return QSharedPointer<QReplicaPrivateInterface>();
+    return it->at(slot).toStrongRef();
+}
+
+void QRemoteObjectNodePrivate::setReplicaForId(ClientIoDevice *connection, int objectId, const QWeakPointer<QReplicaPrivateInterface> &replica)
+{
+    if (objectId < 0)
+        return;
+    const int slot = objectId & QtRemoteObjects::objectIdSlotMask;
+    ReplicaTable &table = replicaTables[connection];
+    if (slot >= table.size())
+        table.resize(slot + 1);
+    table[slot] = replica;
+}
+
 void QRemoteObjectNodePrivate::onClientRead(QObject *obj)
 {
     using namespace QRemoteObjectPackets;
     ClientIoDevice *connection = qobject_cast<ClientIoDevice*>(obj);
-    QRemoteObjectPacketTypeEnum packetType;
     Q_ASSERT(connection);
 
+    if (packetReader) {
+        packetReader->read(connection, connection->connection().data());
+        return;
+    }
+
     do {
 
-        if (!connection->read(packetType, m_rxName))
+        if (!connection->read(m_rxPacket.type, m_rxPacket.name, m_rxPacket.objectId))
             return;
 
-        switch (packetType) {
-        case ObjectList:
-        {
-            deserializeObjectListPacket(connection->stream(), m_rxObjects);
-            qROPrivDebug() << "newObjects:" << m_rxObjects;
-            Q_FOREACH (const auto &remoteObject, m_rxObjects) {
-                qROPrivDebug() << "  connectedSources.contains(" << remoteObject << ")" << connectedSources.contains(remoteObject.name) << replicas.contains(remoteObject.name);
-                if (!connectedSources.contains(remoteObject.name)) {
-                    connectedSources[remoteObject.name] = SourceInfo{connection, remoteObject.typeName};
-                    connection->addSource(remoteObject.name);
-                    if (replicas.contains(remoteObject.name)) //We have a replica waiting on this remoteObject
+        decodePacket(connection->stream(), m_rxPacket, connection->largeFrame());
+        handlePacket(connection, m_rxPacket);
+    } while (connection->bytesAvailable()); // have bytes left over, so do another iteration
+}
+
+void QRemoteObjectNodePrivate::handleReceivedPacket(QObject *connection, QRemoteObjectPackets::ReceivedPacket &packet)
+{
+    handlePacket(static_cast<ClientIoDevice*>(connection), packet);
+}
+
+void QRemoteObjectNodePrivate::handlePacket(ClientIoDevice *connection, QRemoteObjectPackets::ReceivedPacket &packet)
+{
+    using namespace QRemoteObjectPackets;
+
+    //Lets the source know the segments of the out of band payloads read aren't needed anymore
+    Q_FOREACH (const QString &name, packet.readPayloads) {
+        serializePayloadReleasePacket(m_packet, name);
+        connection->write(m_packet.array, m_packet.size);
+    }
+
+    switch (packet.type) {
+    case Handshake:
+    {
+        const quint32 capabilities = packet.capabilities & localCapabilities();
+        qROPrivDebug() << "Handshake, accepted capabilities" << capabilities;
+        connection->setByteOrder(wireByteOrder(capabilities));
+        serializeHandshakePacket(m_packet, capabilities);
+        connection->write(m_packet.array, m_packet.size);
+        break;
+    }
+    case ObjectList:
+    {
+        qROPrivDebug() << "newObjects:" << packet.objects;
+        Q_FOREACH (const auto &remoteObject, packet.objects) {
+            qROPrivDebug() << "  connectedSources.contains(" << remoteObject << ")" << connectedSources.contains(remoteObject.name) << replicas.contains(remoteObject.name);
+            if (!connectedSources.contains(remoteObject.name)) {
+                connectedSources[remoteObject.name] = SourceInfo{connection, remoteObject.typeName, remoteObject.objectId, remoteObject.interfaceHash};
+                connection->addSource(remoteObject.name);
+                if (replicas.contains(remoteObject.name)) //We have a replica waiting on this remoteObject
+                {
+                    QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(remoteObject.name).toStrongRef());
+                    if (rep && rep->connectionToSource.isNull())
                     {
-                        QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(remoteObject.name).toStrongRef());
-                        if (rep && rep->connectionToSource.isNull())
-                        {
-                            qROPrivDebug() << "Test" << remoteObject<<replicas.keys();
-                            qROPrivDebug() << rep;
-                            rep->setConnection(connection);
-                        } else if (!rep) { //replica has been deleted, remove from list
-                            replicas.remove(remoteObject.name);
-                        }
-
-                        continue;
+                        qROPrivDebug() << "Test" << remoteObject<<replicas.keys();
+                        qROPrivDebug() << rep;
+                        rep->setConnection(connection, remoteObject.objectId, remoteObject.typeName, remoteObject.interfaceHash);
+                    } else if (!rep) { //replica has been deleted, remove from list
+                        replicas.remove(remoteObject.name);
                     }
+
+                    continue;
                 }
             }
-            break;
         }
-        case InitPacket:
+        break;
+    }
+    case InitPacket:
+    {
+        qROPrivDebug() << "InitObject-->" << packet.name << this;
+        QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(packet.name).toStrongRef());
+        if (rep)
         {
-            qROPrivDebug() << "InitObject-->" << m_rxName << this;
-            QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(m_rxName).toStrongRef());
-            //Use m_rxArgs (a QVariantList to hold the properties QVariantList)
-            deserializeInitPacket(connection->stream(), m_rxArgs);
-            if (rep)
-            {
-                rep->initialize(m_rxArgs);
-            } else { //replica has been deleted, remove from list
-                replicas.remove(m_rxName);
-            }
-            break;
+            setReplicaForId(connection, packet.objectId, rep);
+            rep->m_objectId = packet.objectId;
+            rep->m_sourceEpoch = packet.epoch;
+            rep->m_sequence = packet.sequence;
+            rep->initialize(packet.args, packet.partial ? &packet.indexes : Q_NULLPTR);
+        } else { //replica has been deleted, remove from list
+            replicas.remove(packet.name);
         }
-        case InitDynamicPacket:
+        break;
+    }
+    case InitDynamicPacket:
+    {
+        qROPrivDebug() << "InitObject-->" << packet.name << this;
+        QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(packet.name).toStrongRef());
+        if (rep)
         {
-            qROPrivDebug() << "InitObject-->" << m_rxName << this;
-            QMetaObjectBuilder builder;
-            builder.setClassName("QRemoteObjectDynamicReplica");
-            builder.setSuperClass(&QRemoteObjectReplica::staticMetaObject);
-            builder.setFlags(QMetaObjectBuilder::DynamicMetaObject);
-            deserializeInitDynamicPacket(connection->stream(), builder, m_rxArgs);
-            QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(m_rxName).toStrongRef());
-            if (rep)
-            {
-                rep->initializeMetaObject(builder, m_rxArgs);
-            } else { //replica has been deleted, remove from list
-                replicas.remove(m_rxName);
+            const QMetaObject *meta = packet.withSchema ? cacheDynamicMetaObject(rep->m_typeName, packet.name, packet.schemaHash, *packet.builder)
+                                                        : cachedDynamicMetaObject(packet.schemaHash);
+            if (!meta) {
+                qROPrivWarning() << "InitDynamicPacket without schema for unknown schema hash" << packet.name << packet.schemaHash.toHex();
+                break;
+            }
+            //A replica attaching again keeps its meta object, so it can only
+            //take the values of a source with the same schema
+            if (rep->m_metaObject && meta != rep->m_metaObject) {
+                qROPrivWarning() << "Ignoring InitDynamicPacket, the schema of the source changed" << packet.name;
+                break;
             }
-            break;
+            setReplicaForId(connection, packet.objectId, rep);
+            rep->m_objectId = packet.objectId;
+            rep->m_sourceEpoch = packet.epoch;
+            rep->m_sequence = packet.sequence;
+            rep->m_schemaHash = packet.schemaHash;
+            if (rep->m_metaObject)
+                rep->initialize(packet.args);
+            else
+                rep->initializeMetaObject(meta, packet.args);
+        } else { //replica has been deleted, remove from list
+            replicas.remove(packet.name);
         }
-        case RemoveObject:
-        {
-            qROPrivDebug() << "RemoveObject-->" << m_rxName << this;
-            connectedSources.remove(m_rxName);
-            connection->removeSource(m_rxName);
-            if (replicas.contains(m_rxName)) { //We have a replica waiting on this remoteObject
-                QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(m_rxName).toStrongRef());
-                if (rep && !rep->connectionToSource.isNull()) {
-                    rep->connectionToSource.clear();
-                    if (rep->isReplicaValid()) {
-                        //Changed from receiving to not receiving
-                        rep->emitValidChanged();
-                    }
-                } else if (!rep) {
-                    replicas.remove(m_rxName);
+        break;
+    }
+    case RemoveObject:
+    {
+        qROPrivDebug() << "RemoveObject-->" << packet.name << this;
+        if (connectedSources.contains(packet.name))
+            setReplicaForId(connection, connectedSources[packet.name].objectId, QWeakPointer<QReplicaPrivateInterface>());
+        connectedSources.remove(packet.name);
+        connection->removeSource(packet.name);
+        if (replicas.contains(packet.name)) { //We have a replica waiting on this remoteObject
+            QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicas.value(packet.name).toStrongRef());
+            if (rep && !rep->connectionToSource.isNull()) {
+                rep->connectionToSource.clear();
+                if (rep->isReplicaValid()) {
+                    //Changed from receiving to not receiving
+                    rep->emitValidChanged();
                 }
+            } else if (!rep) {
+                replicas.remove(packet.name);
             }
-            break;
         }
-        case PropertyChangePacket:
-        {
-            int propertyIndex;
-            deserializePropertyChangePacket(connection->stream(), propertyIndex, m_rxValue);
-            QSharedPointer<QRemoteObjectReplicaPrivate> rep = qSharedPointerCast<QRemoteObjectReplicaPrivate>(replicas.value(m_rxName).toStrongRef());
-            if (rep) {
-                const QMetaProperty property = rep->m_metaObject->property(propertyIndex + rep->m_metaObject->propertyOffset());
-                rep->setProperty(propertyIndex, deserializedProperty(m_rxValue, property));
-            } else { //replica has been deleted, remove from list
-                replicas.remove(m_rxName);
-            }
-            break;
+        break;
+    }
+    case PropertyChangePacket:
+    {
+        QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicaForId(connection, packet.objectId));
+        if (rep) {
+            rep->m_sequence = packet.sequence;
+            rep->applyPropertyChange(packet.index, packet.value, packet.notify);
         }
-        case InvokePacket:
-        {
-            int call, index, serialId, propertyIndex;
-            deserializeInvokePacket(connection->stream(), call, index, m_rxArgs, serialId, propertyIndex);
-            QSharedPointer<QRemoteObjectReplicaPrivate> rep = qSharedPointerCast<QRemoteObjectReplicaPrivate>(replicas.value(m_rxName).toStrongRef());
-            if (rep) {
-                static QVariant null(QMetaType::QObjectStar, (void*)0);
-                QVariant paramValue;
-                // Qt usually supports 9 arguments, so ten should be usually safe
-                QVarLengthArray<void*, 10> param(m_rxArgs.size() + 1);
-                param[0] = null.data(); //Never a return value
-                if (m_rxArgs.size()) {
-                    for (int i = 0; i < m_rxArgs.size(); i++) {
-                        param[i + 1] = const_cast<void *>(m_rxArgs[i].data());
-                    }
-                } else if (propertyIndex != -1) {
-                    param.resize(2);
-                    paramValue = rep->getProperty(propertyIndex);
-                    param[1] = paramValue.data();
-                }
-                qROPrivDebug() << "Replica Invoke-->" << m_rxName << rep->m_metaObject->method(index+rep->m_signalOffset).name() << index << rep->m_signalOffset;
-                QMetaObject::activate(rep.data(), rep->metaObject(), index+rep->m_signalOffset, param.data());
-            } else { //replica has been deleted, remove from list
-                replicas.remove(m_rxName);
-            }
-            break;
+        break;
+    }
+    case PropertyChangeBatchPacket:
+    {
+        QSharedPointer<QConnectedReplicaPrivate> rep = qSharedPointerCast<QConnectedReplicaPrivate>(replicaForId(connection, packet.objectId));
+        if (rep) {
+            rep->m_sequence = packet.sequence;
+            rep->applyPropertyChanges(packet.indexes, packet.args);
         }
-        case InvokeReplyPacket:
-        {
-            int ackedSerialId;
-            deserializeInvokeReplyPacket(connection->stream(), ackedSerialId, m_rxValue);
-            QSharedPointer<QRemoteObjectReplicaPrivate> rep = qSharedPointerCast<QRemoteObjectReplicaPrivate>(replicas.value(m_rxName).toStrongRef());
-            if (rep) {
-                qROPrivDebug() << "Received InvokeReplyPacket ack'ing serial id:" << ackedSerialId;
-                rep->notifyAboutReply(ackedSerialId, m_rxValue);
-            } else { //replica has been deleted, remove from list
-                replicas.remove(m_rxName);
+        break;
+    }
+    case InvokePacket:
+    {
+        QSharedPointer<QRemoteObjectReplicaPrivate> rep = qSharedPointerCast<QRemoteObjectReplicaPrivate>(replicaForId(connection, packet.objectId));
+        if (rep) {
+            static QVariant null(QMetaType::QObjectStar, (void*)0);
+            QVariant paramValue;
+            // Qt usually supports 9 arguments, so ten should be usually safe
+            QVarLengthArray<void*, 10> param(packet.args.size() + 1);
+            param[0] = null.data(); //Never a return value
+            if (packet.args.size()) {
+                for (int i = 0; i < packet.args.size(); i++) {
+                    param[i + 1] = const_cast<void *>(packet.args[i].data());
+                }
+            } else if (packet.propertyIndex != -1) {
+                param.resize(2);
+                paramValue = rep->getProperty(packet.propertyIndex);
+                param[1] = paramValue.data();
             }
-            break;
+            qROPrivDebug() << "Replica Invoke-->" << rep->m_objectName << rep->m_metaObject->method(packet.index+rep->m_signalOffset).name() << packet.index << rep->m_signalOffset;
+            QMetaObject::activate(rep.data(), rep->metaObject(), packet.index+rep->m_signalOffset, param.data());
         }
-        case AddObject:
-        case Invalid:
-            qROPrivWarning() << "Unexpected packet received";
+        break;
+    }
+    case InvokeReplyPacket:
+    {
+        QSharedPointer<QRemoteObjectReplicaPrivate> rep = qSharedPointerCast<QRemoteObjectReplicaPrivate>(replicaForId(connection, packet.objectId));
+        if (rep) {
+            qROPrivDebug() << "Received InvokeReplyPacket ack'ing serial id:" << packet.serialId;
+            rep->notifyAboutReply(packet.serialId, packet.value, static_cast<QRemoteObjectPendingCall::Error>(packet.error));
         }
-    } while (connection->bytesAvailable()); // have bytes left over, so do another iteration
+        break;
+    }
+    case AddObject:
+    case PayloadReleasePacket:
+    case InvokeTypedPacket:
+    case InvokeCancelPacket:
+    case Invalid:
+        qROPrivWarning() << "Unexpected packet received";
+    }
 }
 
 /*!
@@ -565,6 +652,13 @@ void QRemoteObjectNodePrivate::onClientRead(QObject *obj)
     connects to the Registry Url. It knows how to connect to every
     QRemoteObjectSource object on the network.
 
+    A Node decodes the packets it receives in its own thread. If the
+    environment variable \c QT_REMOTEOBJECT_IO_THREAD is set when the Node is
+    created, the packets are decoded in a separate thread instead, and only
+    applying property changes, emitting signals and finishing pending calls
+    is left to the thread of the Node. This keeps large packets, such as the
+    initial values of a big Source, from blocking a GUI thread.
+
     \sa QRemoteObjectHost, QRemoteObjectRegistryHost
 */
 
@@ -669,7 +763,10 @@ void QRemoteObjectNodePrivate::initialize()
     qRegisterMetaType<QRemoteObjectNode *>();
     qRegisterMetaType<QAbstractSocket::SocketError>(); //For queued qnx error()
     qRegisterMetaTypeStreamOperators<QVector<int> >();
+    qRegisterMetaTypeStreamOperators<QRemoteObjectPackets::OutOfBandPayload>();
     QObject::connect(&clientRead, SIGNAL(mapped(QObject*)), q, SLOT(onClientRead(QObject*)));
+    if (ThreadedPacketReader::isEnabled())
+        packetReader.reset(new ThreadedPacketReader(this));
 }
 
 /*!
@@ -875,6 +972,7 @@ bool QRemoteObjectHostBase::setHostUrl(const QUrl &hostAddress)
     //If we've given a name to the node, set it on the sourceIo as well
     if (!objectName().isEmpty())
         d->remoteObjectIo->setObjectName(objectName());
+    d->configureSourceIo();
     //Since we don't know whether setHostUrl or setRegistryUrl/setRegistryHost will be called first,
     //break it into two pieces.  setHostUrl connects the RemoteObjectSourceIo->[add/remove]RemoteObjectSource to QRemoteObjectReplicaNode->[add/remove]RemoteObjectSource
     //setRegistry* calls appropriately connect RemoteObjecSourcetIo->[add/remove]RemoteObjectSource to the registry when it is created
@@ -951,6 +1049,70 @@ QRemoteObjectNode::ErrorCode QRemoteObjectNode::lastError() const
     return d->m_lastError;
 }
 
+/*!
+    Sets whether the method calls and property writes of the Replicas
+    acquired by this node are batched to \a enabled.
+
+    By default every call of a Replica slot or property setter is written to
+    the connection of its \l {Source} right away. With batching enabled, the
+    packets written to a connection during one event loop iteration are
+    collected and written together once control returns to the event loop.
+    The Source handles them in the order they were made, and replies to
+    calls still come back one by one.
+
+    \sa isInvocationBatchingEnabled(), beginInvocationBatch()
+*/
+void QRemoteObjectNode::setInvocationBatchingEnabled(bool enabled)
+{
+    Q_D(QRemoteObjectNode);
+    d->batchInvocations = enabled;
+    Q_FOREACH (ClientIoDevice *connection, d->connections())
+        connection->setAutoBatch(enabled);
+}
+
+/*!
+    Returns \c true if the method calls and property writes of the Replicas
+    acquired by this node are batched.
+
+    \sa setInvocationBatchingEnabled()
+*/
+bool QRemoteObjectNode::isInvocationBatchingEnabled() const
+{
+    Q_D(const QRemoteObjectNode);
+    return d->batchInvocations;
+}
+
+/*!
+    Starts collecting the method calls and property writes of the Replicas
+    acquired by this node, until the matching endInvocationBatch(). Batches
+    can be nested, only the outermost endInvocationBatch() writes the
+    collected packets.
+
+    Nothing is sent while the batch is open, so waiting for the reply to a
+    call made in the batch only succeeds once it was ended.
+
+    \sa endInvocationBatch(), setInvocationBatchingEnabled()
+*/
+void QRemoteObjectNode::beginInvocationBatch()
+{
+    Q_D(QRemoteObjectNode);
+    Q_FOREACH (ClientIoDevice *connection, d->connections())
+        connection->beginBatch();
+}
+
+/*!
+    Ends a batch started by beginInvocationBatch(), and writes the packets it
+    collected if it is the outermost one.
+
+    \sa beginInvocationBatch()
+*/
+void QRemoteObjectNode::endInvocationBatch()
+{
+    Q_D(QRemoteObjectNode);
+    Q_FOREACH (ClientIoDevice *connection, d->connections())
+        connection->endBatch();
+}
+
 /*!
     \property QRemoteObjectNode::registryUrl
     \brief The address of the \l {QRemoteObjectRegistry} {Registry} used by this node.
@@ -1115,6 +1277,15 @@ QRemoteObjectDynamicReplica *QRemoteObjectNode::acquireDynamic(const QString &na
     registered to be remoted, and \c true if remoting is successfully enabled
     for the dynamic QObject.
 
+    The \a object may be moved to another thread than the node once remoting
+    is enabled. Its signals and property changes are then serialized in the
+    thread emitting them and handed to the thread of the node without
+    posting an event per signal. The properties of such an object are still
+    read from the thread of the node when a Replica is initialized, so they
+    have to be safe to read from there. Disable remoting before destroying
+    such an object in its own thread, the node only learns about the
+    destruction through a queued call.
+
     \sa disableRemoting()
 */
 bool QRemoteObjectHostBase::enableRemoting(QObject *object, const QString &name)
@@ -1252,6 +1423,256 @@ bool QRemoteObjectHostBase::disableRemoting(QObject *remoteObject)
     return true;
 }
 
+/*!
+    Sets whether property changes of the Sources shared by this node are
+    coalesced to \a enabled.
+
+    By default every change of a Source property is sent to the Replicas as
+    soon as its notify signal is emitted. With coalescing enabled, the changed
+    properties of a Source are collected and sent together, once per event
+    loop iteration, in a single packet. If a property changes several times
+    before the packet is sent, only the latest value is transmitted. Replicas
+    update all properties of such a packet before emitting the corresponding
+    notify signals, in the order the properties first changed.
+
+    Other signals of the Source, as well as replies to method calls, are
+    never delivered ahead of property changes that happened before them.
+
+    \sa isPropertyChangeCoalescingEnabled()
+*/
+void QRemoteObjectHostBase::setPropertyChangeCoalescingEnabled(bool enabled)
+{
+    Q_D(QRemoteObjectHostBase);
+    d->coalescePropertyChanges = enabled;
+    if (d->remoteObjectIo)
+        d->remoteObjectIo->setPropertyChangeCoalescingEnabled(enabled);
+}
+
+/*!
+    Returns \c true if property changes are coalesced by this node.
+
+    \sa setPropertyChangeCoalescingEnabled()
+*/
+bool QRemoteObjectHostBase::isPropertyChangeCoalescingEnabled() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->coalescePropertyChanges;
+}
+
+/*!
+    Sets the size, in \a bytes, from which values are passed out of band.
+
+    Normally every value sent to the Replicas is written to the connection,
+    and each Replica receives its own copy. With a threshold set, a property
+    value, signal argument or method return value whose serialized form is at
+    least \a bytes large is instead stored once in a shared memory segment,
+    and only a small handle to it is sent. The Replicas read the value
+    straight from the segment, which is removed as soon as all of them are
+    done with it.
+
+    This only applies to Source objects shared over the \c local and \c shm
+    schemes on Unix systems, and requires the Replicas to run as the same
+    user. Otherwise the setting is ignored. A threshold of 0, the default,
+    disables out of band payloads.
+
+    The segments are named \c{qtro-payload-<pid>-<n>}. If the host process
+    crashes, the segments its Replicas didn't release yet are left behind.
+    On Linux, the next host that creates a segment removes the ones of
+    processes that no longer run.
+
+    \sa outOfBandPayloadThreshold()
+*/
+void QRemoteObjectHostBase::setOutOfBandPayloadThreshold(int bytes)
+{
+    Q_D(QRemoteObjectHostBase);
+    d->payloadThreshold = qMax(bytes, 0);
+    if (d->remoteObjectIo)
+        d->remoteObjectIo->setOutOfBandPayloadThreshold(d->payloadThreshold);
+}
+
+/*!
+    Returns the size from which values are passed out of band, or 0 if
+    out of band payloads are disabled.
+
+    \sa setOutOfBandPayloadThreshold()
+*/
+int QRemoteObjectHostBase::outOfBandPayloadThreshold() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->payloadThreshold;
+}
+
+/*!
+    \enum QRemoteObjectHostBase::SendQueuePolicy
+
+    This enum describes what happens to a packet that can't replace a queued
+    property change when the send queue of a connection is full.
+
+    \value DropSignals Signals are not sent to the Replicas on that
+           connection. Other packets, such as replies to method calls, are
+           still queued, until the queue holds twice its limit, at which
+           point the connection is closed. This is the default.
+    \value CloseConnection The connection is closed.
+
+    \sa setSendQueueLimits()
+*/
+
+/*!
+    Limits the send queue of each connection of this node to \a maxBytes
+    bytes and \a maxPackets packets. A limit of 0, the default, means no
+    limit.
+
+    Packets a connection can't pass on right away, because its Replicas
+    read slower than the Sources change, are kept in a send queue. Once the
+    queue reaches either limit, a property change replaces any queued change
+    of the same property, so the Replicas only receive the latest value.
+    Any other packet is handled according to sendQueuePolicy().
+
+    The congestedConnectionsChanged() signal is emitted when a queue reaches
+    a limit, and again once it drained to half of it.
+
+    \sa setSendQueuePolicy()
+*/
+void QRemoteObjectHostBase::setSendQueueLimits(qint64 maxBytes, int maxPackets)
+{
+    Q_D(QRemoteObjectHostBase);
+    d->maxQueuedBytes = qMax<qint64>(maxBytes, 0);
+    d->maxQueuedPackets = qMax(maxPackets, 0);
+    if (d->remoteObjectIo)
+        d->remoteObjectIo->setSendQueueLimits(d->maxQueuedBytes, d->maxQueuedPackets);
+}
+
+/*!
+    Returns the number of bytes a send queue is limited to, or 0 if there is
+    no limit.
+
+    \sa setSendQueueLimits()
+*/
+qint64 QRemoteObjectHostBase::sendQueueByteLimit() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->maxQueuedBytes;
+}
+
+/*!
+    Returns the number of packets a send queue is limited to, or 0 if there
+    is no limit.
+
+    \sa setSendQueueLimits()
+*/
+int QRemoteObjectHostBase::sendQueuePacketLimit() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->maxQueuedPackets;
+}
+
+/*!
+    Sets what happens to signals sent to a connection with a full send queue
+    to \a policy.
+
+    \sa setSendQueueLimits()
+*/
+void QRemoteObjectHostBase::setSendQueuePolicy(SendQueuePolicy policy)
+{
+    Q_D(QRemoteObjectHostBase);
+    d->sendQueuePolicy = policy;
+    if (d->remoteObjectIo)
+        d->remoteObjectIo->setSendQueuePolicy(static_cast<ServerIoDevice::OverflowPolicy>(policy));
+}
+
+/*!
+    Returns what happens to signals sent to a connection with a full send
+    queue.
+
+    \sa setSendQueuePolicy()
+*/
+QRemoteObjectHostBase::SendQueuePolicy QRemoteObjectHostBase::sendQueuePolicy() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->sendQueuePolicy;
+}
+
+/*!
+    \fn void QRemoteObjectHostBase::congestedConnectionsChanged(int count)
+
+    This signal is emitted when the number of connections with a full send
+    queue changes to \a count.
+
+    \sa setSendQueueLimits()
+*/
+
+/*!
+    Sets the number of threads running the thread safe slots of the Sources
+    shared by this node to \a count. A \a count of 0, the default, uses
+    QThread::idealThreadCount() threads.
+
+    Slots are normally called in the thread of the node, one after the
+    other. A slot declared \c THREADSAFE in its .rep file, or listed in a
+    \c{Q_CLASSINFO("RemoteObject ThreadSafe", "signature")} of a dynamic
+    Source, is instead called on a pool of worker threads, so several calls
+    can run at the same time. The reply is still sent from the thread of
+    the node. A value such as \c{"compute(int):4"} limits the calls of the
+    slot running at the same time to 4, further calls wait in a queue.
+
+    Thread safe slots must not change properties of the Source or emit its
+    signals directly, and the Source must not be destroyed before remoting
+    it is disabled.
+
+    \sa workerThreadCount(), queuedInvocationCount()
+*/
+void QRemoteObjectHostBase::setWorkerThreadCount(int count)
+{
+    Q_D(QRemoteObjectHostBase);
+    d->workerThreadCount = qMax(count, 0);
+    if (d->remoteObjectIo)
+        d->remoteObjectIo->setWorkerThreadCount(d->workerThreadCount);
+}
+
+/*!
+    Returns the number of threads running thread safe slots, or 0 if
+    QThread::idealThreadCount() threads are used.
+
+    \sa setWorkerThreadCount()
+*/
+int QRemoteObjectHostBase::workerThreadCount() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->workerThreadCount;
+}
+
+/*!
+    Returns the number of calls of thread safe slots currently running or
+    waiting for a worker thread.
+
+    \sa queuedInvocationCount(), setWorkerThreadCount()
+*/
+int QRemoteObjectHostBase::runningInvocationCount() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->remoteObjectIo ? d->remoteObjectIo->runningInvocationCount() : 0;
+}
+
+/*!
+    Returns the number of calls of thread safe slots waiting for other
+    calls of the same slot to finish, because of its concurrency limit.
+
+    \sa runningInvocationCount(), setWorkerThreadCount()
+*/
+int QRemoteObjectHostBase::queuedInvocationCount() const
+{
+    Q_D(const QRemoteObjectHostBase);
+    return d->remoteObjectIo ? d->remoteObjectIo->queuedInvocationCount() : 0;
+}
+
+/*!
+    \fn void QRemoteObjectHostBase::queuedInvocationCountChanged(int count)
+
+    This signal is emitted when the number of calls of thread safe slots
+    waiting for their concurrency limit changes to \a count.
+
+    \sa queuedInvocationCount()
+*/
+
 QSharedPointer<QIODevice> QRemoteObjectHostBase::socket() const
 {
     return QSharedPointer<QIODevice>();
@@ -1279,8 +1700,26 @@ QAbstractItemModelReplica *QRemoteObjectNode::acquireModel(const QString &name)
 QRemoteObjectHostBasePrivate::QRemoteObjectHostBasePrivate()
     : QRemoteObjectNodePrivate()
     , remoteObjectIo(Q_NULLPTR)
+    , coalescePropertyChanges(false)
+    , payloadThreshold(0)
+    , maxQueuedBytes(0)
+    , maxQueuedPackets(0)
+    , sendQueuePolicy(QRemoteObjectHostBase::DropSignals)
+    , workerThreadCount(0)
 { }
 
+//Applies the settings made on the node before its sourceIo was created
+void QRemoteObjectHostBasePrivate::configureSourceIo()
+{
+    remoteObjectIo->setPropertyChangeCoalescingEnabled(coalescePropertyChanges);
+    remoteObjectIo->setOutOfBandPayloadThreshold(payloadThreshold);
+    remoteObjectIo->setSendQueueLimits(maxQueuedBytes, maxQueuedPackets);
+    remoteObjectIo->setSendQueuePolicy(static_cast<ServerIoDevice::OverflowPolicy>(sendQueuePolicy));
+    remoteObjectIo->setWorkerThreadCount(workerThreadCount);
+    QObject::connect(remoteObjectIo, SIGNAL(congestedConnectionsChanged(int)), q_ptr, SIGNAL(congestedConnectionsChanged(int)));
+    QObject::connect(remoteObjectIo, SIGNAL(queuedInvocationCountChanged(int)), q_ptr, SIGNAL(queuedInvocationCountChanged(int)));
+}
+
 QRemoteObjectHostPrivate::QRemoteObjectHostPrivate()
     : QRemoteObjectHostBasePrivate()
 { }
@@ -1335,6 +1774,7 @@ bool QRemoteObjectSocketHost::setSocket(QSharedPointer<QIODevice> device)
     //If we've given a name to the node, set it on the sourceIo as well
     if (!objectName().isEmpty())
         d->remoteObjectIo->setObjectName(objectName());
+    d->configureSourceIo();
 
     return true;
 }
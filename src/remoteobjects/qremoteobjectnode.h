@@ -119,6 +119,11 @@ public:
 
     ErrorCode lastError() const;
 
+    void setInvocationBatchingEnabled(bool enabled);
+    bool isInvocationBatchingEnabled() const;
+    void beginInvocationBatch();
+    void endInvocationBatch();
+
     void timerEvent(QTimerEvent*);
 
 Q_SIGNALS:
@@ -143,6 +148,11 @@ class Q_REMOTEOBJECTS_EXPORT QRemoteObjectHostBase : public QRemoteObjectNode
 {
     Q_OBJECT
 public:
+    enum SendQueuePolicy {
+        DropSignals,
+        CloseConnection
+    };
+
     void setName(const QString &name) Q_DECL_OVERRIDE;
 
     template <template <typename> class ApiDefinition, typename ObjectType>
@@ -155,6 +165,27 @@ public:
     bool enableRemoting(QAbstractItemModel *model, const QString &name, const QVector<int> roles, QItemSelectionModel *selectionModel = 0);
     bool disableRemoting(QObject *remoteObject);
 
+    void setPropertyChangeCoalescingEnabled(bool enabled);
+    bool isPropertyChangeCoalescingEnabled() const;
+
+    void setOutOfBandPayloadThreshold(int bytes);
+    int outOfBandPayloadThreshold() const;
+
+    void setSendQueueLimits(qint64 maxBytes, int maxPackets);
+    qint64 sendQueueByteLimit() const;
+    int sendQueuePacketLimit() const;
+    void setSendQueuePolicy(SendQueuePolicy policy);
+    SendQueuePolicy sendQueuePolicy() const;
+
+    void setWorkerThreadCount(int count);
+    int workerThreadCount() const;
+    int runningInvocationCount() const;
+    int queuedInvocationCount() const;
+
+Q_SIGNALS:
+    void congestedConnectionsChanged(int count);
+    void queuedInvocationCountChanged(int count);
+
 protected:
     virtual QUrl hostUrl() const;
     virtual bool setHostUrl(const QUrl &hostAddress);
@@ -44,6 +44,7 @@
 
 #include <QtCore/private/qobject_p.h>
 #include "qremoteobjectsourceio_p.h"
+#include "qremoteobjectpacketreader_p.h"
 #include "qremoteobjectreplica.h"
 #include "qremoteobjectnode.h"
 
@@ -64,7 +65,7 @@ QT_BEGIN_NAMESPACE
 class QRemoteObjectRegistry;
 class QRegistrySource;
 
-class QRemoteObjectNodePrivate : public QObjectPrivate
+class QRemoteObjectNodePrivate : public QObjectPrivate, public ReceivedPacketHandler
 {
 public:
     QRemoteObjectNodePrivate();
@@ -83,26 +84,37 @@ public:
     void setRegistry(QRemoteObjectRegistry *);
 
     void onClientRead(QObject *obj);
+    void handleReceivedPacket(QObject *connection, QRemoteObjectPackets::ReceivedPacket &packet) Q_DECL_OVERRIDE;
+    void handlePacket(ClientIoDevice *connection, QRemoteObjectPackets::ReceivedPacket &packet);
     void onRemoteObjectSourceAdded(const QRemoteObjectSourceLocation &entry);
     void onRemoteObjectSourceRemoved(const QRemoteObjectSourceLocation &entry);
     void onRegistryInitialized();
     void onShouldReconnect(ClientIoDevice *ioDevice);
+    QList<ClientIoDevice*> connections() const;
 
     virtual QReplicaPrivateInterface *handleNewAcquire(const QMetaObject *meta, QRemoteObjectReplica *instance, const QString &name);
     void initialize();
 
+    QSharedPointer<QReplicaPrivateInterface> replicaForId(ClientIoDevice *connection, int objectId) const;
+    void setReplicaForId(ClientIoDevice *connection, int objectId, const QWeakPointer<QReplicaPrivateInterface> &replica);
+
 public:
     struct SourceInfo
     {
         ClientIoDevice* device;
         QString typeName;
+        int objectId;
+        quint32 interfaceHash;
     };
 
+    typedef QVector<QWeakPointer<QReplicaPrivateInterface> > ReplicaTable;
+
     QAtomicInt isInitialized;
     QMutex mutex;
     QUrl registryAddress;
     QHash<QString, QWeakPointer<QReplicaPrivateInterface> > replicas;
     QMap<QString, SourceInfo> connectedSources;
+    QHash<ClientIoDevice*, ReplicaTable> replicaTables;
     QSet<ClientIoDevice*> pendingReconnect;
     QSet<QUrl> requestedUrls;
     QSignalMapper clientRead;
@@ -110,10 +122,11 @@ public:
     int retryInterval;
     QBasicTimer reconnectTimer;
     QRemoteObjectNode::ErrorCode m_lastError;
-    QString m_rxName;
-    QRemoteObjectPackets::ObjectInfoList m_rxObjects;
-    QVariantList m_rxArgs;
-    QVariant m_rxValue;
+    bool batchInvocations;
+    QRemoteObjectPackets::ReceivedPacket m_rxPacket;
+    //Decodes the packets of the connections in the IO thread, if enabled
+    QScopedPointer<ThreadedPacketReader> packetReader;
+    QRemoteObjectPackets::DataStreamPacket m_packet;
     Q_DECLARE_PUBLIC(QRemoteObjectNode);
 };
 
@@ -124,8 +137,16 @@ public:
     virtual ~QRemoteObjectHostBasePrivate() {}
     QReplicaPrivateInterface *handleNewAcquire(const QMetaObject *meta, QRemoteObjectReplica *instance, const QString &name) Q_DECL_OVERRIDE;
 
+    void configureSourceIo();
+
 public:
     QRemoteObjectSourceIoAbstract *remoteObjectIo;
+    bool coalescePropertyChanges;
+    int payloadThreshold;
+    qint64 maxQueuedBytes;
+    int maxQueuedPackets;
+    QRemoteObjectHostBase::SendQueuePolicy sendQueuePolicy;
+    int workerThreadCount;
     Q_DECLARE_PUBLIC(QRemoteObjectHostBase)
 };
 
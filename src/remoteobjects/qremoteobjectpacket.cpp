@@ -42,11 +42,30 @@
 #include "qremoteobjectpacket_p.h"
 
 #include "qremoteobjectpendingcall.h"
+#include "qremoteobjectreplica.h"
 #include "qremoteobjectsource.h"
 #include "qremoteobjectsource_p.h"
 
 #include "private/qmetaobjectbuilder_p.h"
 
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtEndian>
+
+#include <type_traits>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
 using namespace QtRemoteObjects;
@@ -73,18 +92,322 @@ QVariant deserializedProperty(const QVariant &in, const QMetaProperty &property)
     }
 }
 
-void serializeInitPacket(DataStreamPacket &ds, const QRemoteObjectSource *object)
+#ifdef Q_OS_UNIX
+//A segment outlives the process that created it. If that process crashed
+//before all Replicas released the segment, nobody else unlinks it. Segments
+//are named after the pid of their creator, so those of processes that are
+//gone can be found and removed. Only Linux lists the segments in a directory.
+static void removeStalePayloadSegments()
+{
+#ifdef Q_OS_LINUX
+    const QDir dir(QStringLiteral("/dev/shm"));
+    const QStringList names = dir.entryList(QStringList(QStringLiteral("qtro-payload-*")), QDir::Files | QDir::System);
+    Q_FOREACH (const QString &name, names) {
+        bool ok;
+        const qint64 pid = name.section(QLatin1Char('-'), 2, 2).toLongLong(&ok);
+        if (!ok || pid <= 0 || pid == QCoreApplication::applicationPid())
+            continue;
+        if (::kill(pid_t(pid), 0) < 0 && errno == ESRCH)
+            ::shm_unlink(QFile::encodeName(QLatin1Char('/') + name).constData());
+    }
+#endif
+}
+#endif
+
+//Copies data into a new shared memory segment, returns its name or an empty
+//string if the segment couldn't be created
+static QString createPayloadSegment(const char *data, qint64 size)
+{
+#ifdef Q_OS_UNIX
+    static QBasicAtomicInt staleSegmentsRemoved = Q_BASIC_ATOMIC_INITIALIZER(0);
+    if (staleSegmentsRemoved.testAndSetRelaxed(0, 1))
+        removeStalePayloadSegments();
+
+    static QBasicAtomicInt counter = Q_BASIC_ATOMIC_INITIALIZER(0);
+    const QByteArray name = "/qtro-payload-" + QByteArray::number(QCoreApplication::applicationPid())
+            + '-' + QByteArray::number(counter.fetchAndAddRelaxed(1));
+    const int fd = ::shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        qCWarning(QT_REMOTEOBJECT) << "Unable to create out of band payload" << name << qt_error_string(errno);
+        return QString();
+    }
+    void *address = MAP_FAILED;
+    if (::ftruncate(fd, size) == 0)
+        address = ::mmap(Q_NULLPTR, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        qCWarning(QT_REMOTEOBJECT) << "Unable to map out of band payload" << name << qt_error_string(errno);
+        ::shm_unlink(name.constData());
+        return QString();
+    }
+    memcpy(address, data, size);
+    ::munmap(address, size);
+    return QString::fromLatin1(name);
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return QString();
+#endif
+}
+
+//QVector and QList values of arithmetic types are encoded and decoded a block
+//of elements at a time, instead of element by element through the stream. A
+//block is copied as is when the stream uses the host byte order, and swapped
+//in a loop the compiler can vectorize otherwise. The encoding is the one of
+//QVariant's stream operators, so any peer can decode it.
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+static const QDataStream::ByteOrder hostByteOrder = QDataStream::LittleEndian;
+#else
+static const QDataStream::ByteOrder hostByteOrder = QDataStream::BigEndian;
+#endif
+
+static const int numericBlockSize = 1024;
+
+//QDataStream::DoublePrecision, the default, writes a float as a double
+template <typename T> struct WireElement { typedef T Type; };
+template <> struct WireElement<float> { typedef double Type; };
+
+template <typename T>
+static inline T byteSwapped(T value)
+{
+    typedef typename QIntegerForSizeof<T>::Unsigned Bits;
+    Bits bits;
+    memcpy(&bits, &value, sizeof(T));
+    bits = qbswap(bits);
+    memcpy(&value, &bits, sizeof(T));
+    return value;
+}
+
+template <typename T>
+static inline const T *contiguousData(const QVector<T> &values) { return values.constData(); }
+template <typename T>
+static inline const T *contiguousData(const QList<T> &) { return Q_NULLPTR; }
+
+template <typename T>
+static inline void assignElements(QVector<T> &container, QVector<T> &values) { container.swap(values); }
+template <typename T>
+static inline void assignElements(QList<T> &container, QVector<T> &values) { container = values.toList(); }
+
+template <typename Container>
+static void writeNumericArray(QDataStream &ds, const QVariant &value)
+{
+    typedef typename Container::value_type T;
+    typedef typename WireElement<T>::Type Wire;
+    const Container &values = *static_cast<const Container *>(value.constData());
+    const int count = values.size();
+    const bool swap = ds.byteOrder() != hostByteOrder;
+
+    ds << quint32(count);
+    const T *data = contiguousData(values);
+    if (data && !swap && std::is_same<T, Wire>::value) {
+        ds.writeRawData(reinterpret_cast<const char *>(data), count * int(sizeof(T)));
+        return;
+    }
+    Wire block[numericBlockSize];
+    for (int i = 0; i < count; i += numericBlockSize) {
+        const int n = qMin(count - i, numericBlockSize);
+        if (swap) {
+            for (int j = 0; j < n; ++j)
+                block[j] = byteSwapped(Wire(values.at(i + j)));
+        } else {
+            for (int j = 0; j < n; ++j)
+                block[j] = Wire(values.at(i + j));
+        }
+        ds.writeRawData(reinterpret_cast<const char *>(block), n * int(sizeof(Wire)));
+    }
+}
+
+template <typename Container>
+static void readNumericArray(QDataStream &in, QVariant &value)
+{
+    typedef typename Container::value_type T;
+    typedef typename WireElement<T>::Type Wire;
+    quint32 count;
+    in >> count;
+    //Don't allocate more elements than the frame can hold
+    if (in.status() != QDataStream::Ok || qint64(count) * qint64(sizeof(Wire)) > in.device()->bytesAvailable()) {
+        in.setStatus(QDataStream::ReadCorruptData);
+        value = QVariant();
+        return;
+    }
+    const bool swap = in.byteOrder() != hostByteOrder;
+
+    QVector<T> values(int(count));
+    T *data = values.data();
+    if (!swap && std::is_same<T, Wire>::value) {
+        in.readRawData(reinterpret_cast<char *>(data), int(count) * int(sizeof(T)));
+    } else {
+        Wire block[numericBlockSize];
+        for (int i = 0; i < int(count); i += numericBlockSize) {
+            const int n = qMin(int(count) - i, numericBlockSize);
+            in.readRawData(reinterpret_cast<char *>(block), n * int(sizeof(Wire)));
+            if (swap) {
+                for (int j = 0; j < n; ++j)
+                    data[i + j] = T(byteSwapped(block[j]));
+            } else {
+                for (int j = 0; j < n; ++j)
+                    data[i + j] = T(block[j]);
+            }
+        }
+    }
+    Container container;
+    assignElements(container, values);
+    value = QVariant::fromValue(container);
+}
+
+struct NumericArrayCodec
+{
+    int typeId;
+    const char *typeName;
+    void (*write)(QDataStream &, const QVariant &);
+    void (*read)(QDataStream &, QVariant &);
+};
+
+template <typename Container>
+static NumericArrayCodec numericArrayCodec()
+{
+    const int typeId = qMetaTypeId<Container>();
+    const NumericArrayCodec codec = { typeId, QMetaType::typeName(typeId), &writeNumericArray<Container>, &readNumericArray<Container> };
+    return codec;
+}
+
+static const NumericArrayCodec *numericArrayCodecs(int *count)
+{
+    static const NumericArrayCodec codecs[] = {
+        numericArrayCodec<QVector<short> >(), numericArrayCodec<QList<short> >(),
+        numericArrayCodec<QVector<ushort> >(), numericArrayCodec<QList<ushort> >(),
+        numericArrayCodec<QVector<int> >(), numericArrayCodec<QList<int> >(),
+        numericArrayCodec<QVector<uint> >(), numericArrayCodec<QList<uint> >(),
+        numericArrayCodec<QVector<qlonglong> >(), numericArrayCodec<QList<qlonglong> >(),
+        numericArrayCodec<QVector<qulonglong> >(), numericArrayCodec<QList<qulonglong> >(),
+        numericArrayCodec<QVector<float> >(), numericArrayCodec<QList<float> >(),
+        numericArrayCodec<QVector<double> >(), numericArrayCodec<QList<double> >()
+    };
+    *count = sizeof(codecs) / sizeof(codecs[0]);
+    return codecs;
+}
+
+static const NumericArrayCodec *findNumericArrayCodec(int typeId)
+{
+    int count;
+    const NumericArrayCodec *codecs = numericArrayCodecs(&count);
+    for (int i = 0; i < count; ++i) {
+        if (codecs[i].typeId == typeId)
+            return &codecs[i];
+    }
+    return Q_NULLPTR;
+}
+
+static const NumericArrayCodec *findNumericArrayCodec(const QByteArray &typeName)
+{
+    int count;
+    const NumericArrayCodec *codecs = numericArrayCodecs(&count);
+    for (int i = 0; i < count; ++i) {
+        if (qstrcmp(codecs[i].typeName, typeName.constData()) == 0)
+            return &codecs[i];
+    }
+    return Q_NULLPTR;
+}
+
+//Like operator<<, with the bulk path for numeric arrays
+static void writeVariant(QDataStream &ds, const QVariant &value)
+{
+    if (value.userType() >= QMetaType::User && ds.floatingPointPrecision() == QDataStream::DoublePrecision) {
+        if (const NumericArrayCodec *codec = findNumericArrayCodec(value.userType())) {
+            ds << quint32(QMetaType::User);
+            ds << qint8(value.isNull());
+            ds << codec->typeName;
+            codec->write(ds, value);
+            return;
+        }
+    }
+    ds << value;
+}
+
+//Writes value, or a handle to a segment holding the encoded value if the
+//encoding reaches the packet's payload threshold. The value is encoded only
+//once either way, and stays inline if the segment can't be created.
+static void writeValue(DataStreamPacket &ds, const QVariant &value)
+{
+    const qint64 start = ds.device()->pos();
+    writeVariant(ds, value);
+    const qint64 size = ds.device()->pos() - start;
+    if (ds.payloadThreshold <= 0 || size < ds.payloadThreshold)
+        return;
+
+    OutOfBandPayload payload;
+    payload.name = createPayloadSegment(ds.array.constData() + start, size);
+    payload.size = quint32(size);
+    payload.littleEndian = ds.byteOrder() == QDataStream::LittleEndian;
+    if (payload.name.isEmpty())
+        return;
+    ds.device()->seek(start);
+    ds << QVariant::fromValue(payload);
+    ds.payloads.append(payload.name);
+}
+
+struct FramePayload;
+static void readVariant(QDataStream &in, QVariant &value, FramePayload *payload, int index);
+
+bool readOutOfBandPayload(const OutOfBandPayload &payload, QVariant &value)
+{
+#ifdef Q_OS_UNIX
+    const int fd = ::shm_open(QFile::encodeName(payload.name).constData(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    //Mapping past the end of the segment would fault on access
+    struct stat st;
+    void *address = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size >= qint64(payload.size) && payload.size > 0)
+        address = ::mmap(Q_NULLPTR, payload.size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+        return false;
+
+    const QByteArray data = QByteArray::fromRawData(static_cast<const char *>(address), payload.size);
+    QDataStream in(data);
+    in.setVersion(dataStreamVersion);
+    in.setByteOrder(payload.littleEndian ? QDataStream::LittleEndian : QDataStream::BigEndian);
+    readVariant(in, value, Q_NULLPTR, 0);
+    const bool ok = in.status() == QDataStream::Ok;
+    ::munmap(address, payload.size);
+    return ok;
+#else
+    Q_UNUSED(payload);
+    Q_UNUSED(value);
+    return false;
+#endif
+}
+
+void releaseOutOfBandPayload(const QString &name)
+{
+#ifdef Q_OS_UNIX
+    ::shm_unlink(QFile::encodeName(name).constData());
+#else
+    Q_UNUSED(name);
+#endif
+}
+
+void serializeInitPacket(DataStreamPacket &ds, const QRemoteObjectSource *object, const QVector<int> *indexes)
 {
     const SourceApiMap *api = object->m_api;
 
     ds.setId(InitPacket);
     ds << api->name();
+    ds << object->m_objectId;
+    ds << object->m_epoch;
+    ds << object->m_sequence;
+    ds << bool(indexes);
+    if (indexes)
+        ds << *indexes;
 
     //Now copy the property data
-    const int numProperties = api->propertyCount();
+    const int numProperties = indexes ? indexes->size() : api->propertyCount();
     ds << quint32(numProperties);  //Number of properties
 
-    for (int i = 0; i < numProperties; ++i) {
+    for (int n = 0; n < numProperties; ++n) {
+        const int i = indexes ? indexes->at(n) : n;
         const int index = api->sourcePropertyIndex(i);
         if (index < 0) {
             qCWarning(QT_REMOTEOBJECT) << "QInitPacketEncoder - Found invalid property.  Index not found:" << i << "Dropping invalid packet.";
@@ -94,12 +417,75 @@ void serializeInitPacket(DataStreamPacket &ds, const QRemoteObjectSource *object
 
         const auto target = api->isAdapterProperty(i) ? object->m_adapter : object->m_object;
         const auto metaProperty = target->metaObject()->property(index);
-        ds << serializedProperty(metaProperty, target);
+        writeValue(ds, serializedProperty(metaProperty, target));
     }
     ds.finishPacket();
 }
 
-bool deserializeQVariantList(QDataStream &s, QList<QVariant> &l)
+//Position of a large QByteArray value that was left in the frame while decoding
+struct FramePayload
+{
+    FramePayload() : index(-1), position(0), size(0) {}
+    int index;
+    qint64 position;
+    int size;
+};
+
+//Like operator>>, with the bulk path for numeric arrays, except that the first
+//large QByteArray value found is only skipped and recorded in payload, see
+//takeFramePayload(). Other large values, such as a QString, are decoded into
+//their own allocation, and any further QByteArray is copied out of the frame.
+//A QString can't take over the frame's allocation, as it isn't a QByteArray.
+static void readVariant(QDataStream &in, QVariant &value, FramePayload *payload, int index)
+{
+    QIODevice *device = in.device();
+    const qint64 start = device->pos();
+    quint32 typeId;
+    in >> typeId;
+    if (typeId == QMetaType::User && in.floatingPointPrecision() == QDataStream::DoublePrecision) {
+        qint8 isNull;
+        QByteArray typeName;
+        in >> isNull >> typeName;
+        if (in.status() == QDataStream::Ok) {
+            if (const NumericArrayCodec *codec = findNumericArrayCodec(typeName)) {
+                codec->read(in, value);
+                return;
+            }
+        }
+    } else if (payload && payload->index < 0) {
+        if (typeId == QMetaType::QByteArray) {
+            qint8 isNull;
+            quint32 size;
+            in >> isNull >> size;
+            if (in.status() == QDataStream::Ok && size != 0xffffffff && size >= quint32(largeFrameSize)
+                    && device->pos() + size <= device->size()) {
+                payload->index = index;
+                payload->position = device->pos();
+                payload->size = size;
+                device->seek(payload->position + size);
+                value = QVariant();
+                return;
+            }
+        }
+    }
+    device->seek(start);
+    in >> value;
+}
+
+//Turns the frame into a QByteArray of just the payload. The payload is moved
+//to the start of the frame's own allocation, which is then truncated, so this
+//costs one memmove but no second allocation of the payload's size.
+static QByteArray takeFramePayload(QByteArray *frame, const FramePayload &payload)
+{
+    QByteArray bytes;
+    bytes.swap(*frame);
+    char *data = bytes.data();
+    memmove(data, data + payload.position, payload.size);
+    bytes.resize(payload.size);
+    return bytes;
+}
+
+bool deserializeQVariantList(QDataStream &s, QList<QVariant> &l, FramePayload *payload = Q_NULLPTR)
 {
     // note: optimized version of: QDataStream operator>>(QDataStream& s, QList<T>& l)
     quint32 c;
@@ -116,7 +502,7 @@ bool deserializeQVariantList(QDataStream &s, QList<QVariant> &l)
         if (s.atEnd())
             return false;
         QVariant t;
-        s >> t;
+        readVariant(s, t, payload, i);
         l[i] = t;
     }
     for (quint32 i = l.size(); i < c; ++i)
@@ -124,25 +510,113 @@ bool deserializeQVariantList(QDataStream &s, QList<QVariant> &l)
         if (s.atEnd())
             return false;
         QVariant t;
-        s >> t;
+        readVariant(s, t, payload, i);
         l.append(t);
     }
     return true;
 }
 
-void deserializeInitPacket(QDataStream &in, QVariantList &values)
+void deserializeInitPacket(QDataStream &in, int &objectId, QUuid &epoch, quint64 &sequence, bool &partial, QVector<int> &indexes, QVariantList &values)
 {
+    in >> objectId;
+    in >> epoch;
+    in >> sequence;
+    in >> partial;
+    if (partial)
+        in >> indexes;
     const bool success = deserializeQVariantList(in, values);
     Q_ASSERT(success);
     Q_UNUSED(success);
 }
 
-void serializeInitDynamicPacket(DataStreamPacket &ds, const QRemoteObjectSource *object)
+quint32 interfaceHash(const QMetaObject *meta)
+{
+    const int ind = meta ? meta->indexOfClassInfo(QCLASSINFO_REMOTEOBJECT_SIGNATURE) : -1;
+    if (ind < 0)
+        return 0;
+    bool ok;
+    const quint32 hash = QByteArray(meta->classInfo(ind).value()).toUInt(&ok, 16);
+    return ok ? hash : 0;
+}
+
+QByteArray schemaHash(const QRemoteObjectSource *object)
+{
+    const SourceApiMap *api = object->m_api;
+    QByteArray schema;
+    QDataStream ds(&schema, QIODevice::WriteOnly);
+    ds.setVersion(dataStreamVersion);
+
+    ds << quint32(api->signalCount());
+    ds << quint32(api->methodCount());
+    for (int i = 0; i < api->signalCount(); ++i)
+        ds << api->signalSignature(i);
+    for (int i = 0; i < api->methodCount(); ++i) {
+        ds << api->methodSignature(i);
+        ds << api->typeName(i);
+    }
+    ds << quint32(api->propertyCount());
+    for (int i = 0; i < api->propertyCount(); ++i) {
+        const auto target = api->isAdapterProperty(i) ? object->m_adapter : object->m_object;
+        const auto metaProperty = target->metaObject()->property(api->sourcePropertyIndex(i));
+        ds << metaProperty.name();
+        ds << metaProperty.typeName();
+        if (metaProperty.notifySignalIndex() == -1)
+            ds << QByteArray();
+        else
+            ds << metaProperty.notifySignal().methodSignature();
+    }
+    return QCryptographicHash::hash(schema, QCryptographicHash::Sha1);
+}
+
+void serializeInitDynamicPacket(DataStreamPacket &ds, const QRemoteObjectSource *object, InitDynamicSchema *schema, bool withSchema)
 {
     const SourceApiMap *api = object->m_api;
+    const int numProperties = api->propertyCount();
 
     ds.setId(InitDynamicPacket);
+    if (!withSchema) {
+        //The replica already has a meta object for this schema
+        ds << api->name();
+        ds << object->m_objectId;
+        ds << object->m_schemaHash;
+        ds << false;
+        ds << quint32(numProperties);
+        for (int i = 0; i < numProperties; ++i) {
+            const int index = api->sourcePropertyIndex(i);
+            if (index < 0) {
+                qCWarning(QT_REMOTEOBJECT) << "QInitDynamicPacketEncoder - Found invalid property.  Index not found:" << i << "Dropping invalid packet.";
+                ds.size = 0;
+                return;
+            }
+            const auto target = api->isAdapterProperty(i) ? object->m_adapter : object->m_object;
+            writeValue(ds, target->metaObject()->property(index).read(target));
+        }
+        ds << object->m_epoch;
+        ds << object->m_sequence;
+        ds.finishPacket();
+        return;
+    }
+
+    if (schema && !schema->header.isEmpty()) {
+        //Only the values have to be encoded again
+        ds.writeRawData(schema->header.constData(), schema->header.size());
+        for (int i = 0; i < numProperties; ++i) {
+            const auto target = api->isAdapterProperty(i) ? object->m_adapter : object->m_object;
+            const auto metaProperty = target->metaObject()->property(api->sourcePropertyIndex(i));
+            ds.writeRawData(schema->properties.at(i).constData(), schema->properties.at(i).size());
+            writeValue(ds, metaProperty.read(target));
+        }
+        ds << object->m_epoch;
+        ds << object->m_sequence;
+        ds.finishPacket();
+        return;
+    }
+
+    const qint64 headerStart = ds.device()->pos();
     ds << api->name();
+    ds << object->m_objectId;
+    ds << object->m_schemaHash;
+    ds << true;
 
     //Now copy the property data
     const int numSignals = api->signalCount();
@@ -171,9 +645,14 @@ void serializeInitDynamicPacket(DataStreamPacket &ds, const QRemoteObjectSource
         ds << api->typeName(i);
     }
 
-    const int numProperties = api->propertyCount();
     ds << quint32(numProperties);  //Number of properties
 
+    InitDynamicSchema encoded;
+    if (schema) {
+        encoded.header = ds.array.mid(headerStart, ds.device()->pos() - headerStart);
+        encoded.properties.reserve(numProperties);
+    }
+
     for (int i = 0; i < numProperties; ++i) {
         const int index = api->sourcePropertyIndex(i);
         if (index < 0) {
@@ -184,25 +663,39 @@ void serializeInitDynamicPacket(DataStreamPacket &ds, const QRemoteObjectSource
 
         const auto target = api->isAdapterProperty(i) ? object->m_adapter : object->m_object;
         const auto metaProperty = target->metaObject()->property(index);
+        const qint64 propertyStart = ds.device()->pos();
         ds << metaProperty.name();
         ds << metaProperty.typeName();
         if (metaProperty.notifySignalIndex() == -1)
             ds << QByteArray();
         else
             ds << metaProperty.notifySignal().methodSignature();
-        ds << metaProperty.read(target);
+        if (schema)
+            encoded.properties.append(ds.array.mid(propertyStart, ds.device()->pos() - propertyStart));
+        writeValue(ds, metaProperty.read(target));
     }
+    ds << object->m_epoch;
+    ds << object->m_sequence;
     ds.finishPacket();
+    if (schema)
+        *schema = encoded;
 }
 
-void deserializeInitDynamicPacket(QDataStream &in, QMetaObjectBuilder &builder, QVariantList &values)
+bool deserializeInitDynamicPacket(QDataStream &in, int &objectId, QByteArray &schemaHash, QMetaObjectBuilder &builder, QVariantList &values, QUuid &epoch, quint64 &sequence)
 {
     quint32 numSignals = 0;
     quint32 numMethods = 0;
     quint32 numProperties = 0;
+    bool withSchema = false;
 
-    in >> numSignals;
-    in >> numMethods;
+    in >> objectId;
+    in >> schemaHash;
+    in >> withSchema;
+
+    if (withSchema) {
+        in >> numSignals;
+        in >> numMethods;
+    }
 
     int curIndex = 0;
 
@@ -235,36 +728,47 @@ void deserializeInitDynamicPacket(QDataStream &in, QMetaObjectBuilder &builder,
             values.removeLast();
 
     for (quint32 i = 0; i < numProperties; ++i) {
-        QByteArray name;
-        QByteArray typeName;
-        QByteArray signalName;
-        in >> name;
-        in >> typeName;
-        in >> signalName;
-        if (signalName.isEmpty())
-            builder.addProperty(name, typeName);
-        else
-            builder.addProperty(name, typeName, builder.indexOfSignal(signalName));
+        if (withSchema) {
+            QByteArray name;
+            QByteArray typeName;
+            QByteArray signalName;
+            in >> name;
+            in >> typeName;
+            in >> signalName;
+            if (signalName.isEmpty())
+                builder.addProperty(name, typeName);
+            else
+                builder.addProperty(name, typeName, builder.indexOfSignal(signalName));
+        }
         QVariant value;
-        in >> value;
+        readVariant(in, value, Q_NULLPTR, int(i));
         if (i < initialListSize)
             values[i] = value;
         else
             values.append(value);
     }
+    in >> epoch;
+    in >> sequence;
+    return withSchema;
 }
 
-void serializeAddObjectPacket(DataStreamPacket &ds, const QString &name, bool isDynamic)
+void serializeAddObjectPacket(DataStreamPacket &ds, const QString &name, bool isDynamic, const QByteArray &schemaHash, const QUuid &epoch, quint64 sequence)
 {
     ds.setId(AddObject);
     ds << name;
     ds << isDynamic;
+    ds << schemaHash;
+    ds << epoch;
+    ds << sequence;
     ds.finishPacket();
 }
 
-void deserializeAddObjectPacket(QDataStream &ds, bool &isDynamic)
+void deserializeAddObjectPacket(QDataStream &ds, bool &isDynamic, QByteArray &schemaHash, QUuid &epoch, quint64 &sequence)
 {
     ds >> isDynamic;
+    ds >> schemaHash;
+    ds >> epoch;
+    ds >> sequence;
 }
 
 void serializeRemoveObjectPacket(DataStreamPacket &ds, const QString &name)
@@ -275,10 +779,10 @@ void serializeRemoveObjectPacket(DataStreamPacket &ds, const QString &name)
 }
 //There is no deserializeRemoveObjectPacket - no parameters other than id and name
 
-void serializeInvokePacket(DataStreamPacket &ds, const QString &name, int call, int index, const QVariantList &args, int serialId, int propertyIndex)
+void serializeInvokePacket(DataStreamPacket &ds, int objectId, int call, int index, const QVariantList &args, int serialId, int propertyIndex, int timeout)
 {
     ds.setId(InvokePacket);
-    ds << name;
+    ds << objectId;
     ds << call;
     ds << index;
 
@@ -287,52 +791,163 @@ void serializeInvokePacket(DataStreamPacket &ds, const QString &name, int call,
         if (QMetaType::typeFlags(arg.userType()).testFlag(QMetaType::IsEnumeration))
             ds << QVariant::fromValue<qint32>(arg.toInt());
         else
-            ds << arg;
+            writeValue(ds, arg);
     }
 
     ds << serialId;
     ds << propertyIndex;
+    ds << timeout;
     ds.finishPacket();
 }
 
-void deserializeInvokePacket(QDataStream& in, int &call, int &index, QVariantList &args, int &serialId, int &propertyIndex)
+void deserializeInvokePacket(QDataStream& in, int &call, int &index, QVariantList &args, int &serialId, int &propertyIndex, int &timeout, QByteArray *frame)
 {
+    FramePayload payload;
     in >> call;
     in >> index;
-    const bool success = deserializeQVariantList(in, args);
+    const bool success = deserializeQVariantList(in, args, frame ? &payload : Q_NULLPTR);
     Q_ASSERT(success);
     Q_UNUSED(success);
     in >> serialId;
     in >> propertyIndex;
+    in >> timeout;
+    if (payload.index >= 0)
+        args[payload.index] = takeFramePayload(frame, payload);
 }
 
-void serializeInvokeReplyPacket(DataStreamPacket &ds, const QString &name, int ackedSerialId, const QVariant &value)
+void serializeInvokeTypedPacketHeader(DataStreamPacket &ds, int objectId, quint32 interfaceHash, int index, int serialId, int timeout)
+{
+    ds.setId(InvokeTypedPacket);
+    ds << objectId;
+    ds << interfaceHash;
+    ds << index;
+    ds << serialId;
+    ds << timeout;
+}
+
+void deserializeInvokeTypedPacketHeader(QDataStream& in, quint32 &interfaceHash, int &index, int &serialId, int &timeout)
+{
+    in >> interfaceHash;
+    in >> index;
+    in >> serialId;
+    in >> timeout;
+}
+
+void serializeInvokeReplyPacket(DataStreamPacket &ds, int objectId, int ackedSerialId, const QVariant &value, int error)
 {
     ds.setId(InvokeReplyPacket);
-    ds << name;
+    ds << objectId;
     ds << ackedSerialId;
-    ds << value;
+    ds << error;
+    writeValue(ds, value);
     ds.finishPacket();
 }
 
-void deserializeInvokeReplyPacket(QDataStream& in, int &ackedSerialId, QVariant &value){
+void deserializeInvokeReplyPacket(QDataStream& in, int &ackedSerialId, QVariant &value, int &error){
     in >> ackedSerialId;
-    in >> value;
+    in >> error;
+    readVariant(in, value, Q_NULLPTR, 0);
 }
 
-void serializePropertyChangePacket(DataStreamPacket &ds, const QString &name, int index, const QVariant &value)
+void serializeInvokeCancelPacket(DataStreamPacket &ds, int objectId, int serialId)
+{
+    ds.setId(InvokeCancelPacket);
+    ds << objectId;
+    ds << serialId;
+    ds.finishPacket();
+}
+
+void deserializeInvokeCancelPacket(QDataStream& in, int &serialId)
+{
+    in >> serialId;
+}
+
+qint64 monotonicMSecs()
+{
+    QElapsedTimer timer;
+    timer.start();
+    return timer.msecsSinceReference();
+}
+
+qint64 deadlineFromTimeout(qint64 receivedAt, int timeout)
+{
+    if (timeout < 0)
+        return -1;
+    return (receivedAt >= 0 ? receivedAt : monotonicMSecs()) + timeout;
+}
+
+bool hasDeadlinePassed(qint64 deadline)
+{
+    return deadline >= 0 && monotonicMSecs() > deadline;
+}
+
+void serializePropertyChangePacket(DataStreamPacket &ds, int objectId, int index, const QVariant &value, quint64 sequence, bool notify)
 {
     ds.setId(PropertyChangePacket);
-    ds << name;
+    ds << objectId;
     ds << index;
-    ds << value;
+    writeValue(ds, value);
+    ds << notify;
+    ds << sequence;
     ds.finishPacket();
 }
 
-void deserializePropertyChangePacket(QDataStream& in, int &index, QVariant &value)
+void deserializePropertyChangePacket(QDataStream& in, int &index, QVariant &value, bool &notify, quint64 &sequence, QByteArray *frame)
 {
+    FramePayload payload;
     in >> index;
-    in >> value;
+    readVariant(in, value, frame ? &payload : Q_NULLPTR, 0);
+    in >> notify;
+    in >> sequence;
+    if (payload.index >= 0)
+        value = takeFramePayload(frame, payload);
+}
+
+void serializePropertyChangeBatchPacket(DataStreamPacket &ds, const QRemoteObjectSource *object, const QVector<int> &indexes)
+{
+    const SourceApiMap *api = object->m_api;
+
+    ds.setId(PropertyChangeBatchPacket);
+    ds << object->m_objectId;
+    ds << quint32(indexes.size());
+    foreach (int i, indexes) {
+        const int index = api->sourcePropertyIndex(i);
+        if (index < 0) {
+            qCWarning(QT_REMOTEOBJECT) << "PropertyChangeBatchPacket - Found invalid property.  Index not found:" << i << "Dropping invalid packet.";
+            ds.size = 0;
+            return;
+        }
+
+        const auto target = api->isAdapterProperty(i) ? object->m_adapter : object->m_object;
+        const auto metaProperty = target->metaObject()->property(index);
+        ds << i;
+        writeValue(ds, serializedProperty(metaProperty, target));
+    }
+    ds << object->m_sequence;
+    ds.finishPacket();
+}
+
+void deserializePropertyChangeBatchPacket(QDataStream &in, QVector<int> &indexes, QVariantList &values, quint64 &sequence)
+{
+    quint32 count;
+    in >> count;
+    indexes.resize(count);
+    values.clear();
+    values.reserve(count);
+    for (quint32 i = 0; i < count; ++i) {
+        QVariant value;
+        in >> indexes[i];
+        readVariant(in, value, Q_NULLPTR, int(i));
+        values.append(value);
+    }
+    in >> sequence;
+}
+
+void serializePayloadReleasePacket(DataStreamPacket &ds, const QString &name)
+{
+    ds.setId(PayloadReleasePacket);
+    ds << name;
+    ds.finishPacket();
 }
 
 void serializeObjectListPacket(DataStreamPacket &ds, const ObjectInfoList &objects)
@@ -347,6 +962,101 @@ void deserializeObjectListPacket(QDataStream &in, ObjectInfoList &objects)
     in >> objects;
 }
 
+void serializeHandshakePacket(DataStreamPacket &ds, quint32 capabilities)
+{
+    const QDataStream::ByteOrder order = ds.byteOrder();
+    ds.setByteOrder(QDataStream::BigEndian);
+    ds.setId(Handshake);
+    ds << capabilities;
+    ds.finishPacket();
+    ds.setByteOrder(order);
+}
+
+void deserializeHandshakePacket(QDataStream &in, quint32 &capabilities)
+{
+    in >> capabilities;
+}
+
+//Replaces a handle to an out of band payload by the value it refers to
+static void readPayload(QVariant &value, QStringList &readPayloads)
+{
+    if (value.userType() != qMetaTypeId<OutOfBandPayload>())
+        return;
+
+    const OutOfBandPayload payload = value.value<OutOfBandPayload>();
+    if (!readOutOfBandPayload(payload, value)) {
+        qCWarning(QT_REMOTEOBJECT) << "Unable to read out of band payload" << payload.name;
+        value = QVariant();
+    }
+    readPayloads.append(payload.name);
+}
+
+static void readPayloads(QVariantList &values, QStringList &readPayloads)
+{
+    for (int i = 0; i < values.size(); ++i)
+        readPayload(values[i], readPayloads);
+}
+
+void decodePacket(QDataStream &in, ReceivedPacket &packet, QByteArray *frame)
+{
+    packet.byteOrder = in.byteOrder();
+    packet.typedArguments.clear();
+    packet.readPayloads.clear();
+    int timeout = -1;
+
+    switch (packet.type) {
+    case Handshake:
+        deserializeHandshakePacket(in, packet.capabilities);
+        break;
+    case ObjectList:
+        deserializeObjectListPacket(in, packet.objects);
+        break;
+    case InitPacket:
+        deserializeInitPacket(in, packet.objectId, packet.epoch, packet.sequence, packet.partial, packet.indexes, packet.args);
+        readPayloads(packet.args, packet.readPayloads);
+        break;
+    case InitDynamicPacket:
+        packet.builder.reset(new QMetaObjectBuilder);
+        packet.builder->setClassName("QRemoteObjectDynamicReplica");
+        packet.builder->setSuperClass(&QRemoteObjectReplica::staticMetaObject);
+        packet.builder->setFlags(QMetaObjectBuilder::DynamicMetaObject);
+        packet.withSchema = deserializeInitDynamicPacket(in, packet.objectId, packet.schemaHash, *packet.builder, packet.args, packet.epoch, packet.sequence);
+        readPayloads(packet.args, packet.readPayloads);
+        break;
+    case AddObject:
+        deserializeAddObjectPacket(in, packet.isDynamic, packet.schemaHash, packet.epoch, packet.sequence);
+        break;
+    case InvokePacket:
+        deserializeInvokePacket(in, packet.call, packet.index, packet.args, packet.serialId, packet.propertyIndex, timeout, frame);
+        readPayloads(packet.args, packet.readPayloads);
+        packet.deadline = deadlineFromTimeout(packet.receivedAt, timeout);
+        break;
+    case InvokeTypedPacket:
+        deserializeInvokeTypedPacketHeader(in, packet.interfaceHash, packet.index, packet.serialId, timeout);
+        packet.deadline = deadlineFromTimeout(packet.receivedAt, timeout);
+        break;
+    case InvokeReplyPacket:
+        deserializeInvokeReplyPacket(in, packet.serialId, packet.value, packet.error);
+        readPayload(packet.value, packet.readPayloads);
+        break;
+    case InvokeCancelPacket:
+        deserializeInvokeCancelPacket(in, packet.serialId);
+        break;
+    case PropertyChangePacket:
+        deserializePropertyChangePacket(in, packet.index, packet.value, packet.notify, packet.sequence, frame);
+        readPayload(packet.value, packet.readPayloads);
+        break;
+    case PropertyChangeBatchPacket:
+        deserializePropertyChangeBatchPacket(in, packet.indexes, packet.args, packet.sequence);
+        readPayloads(packet.args, packet.readPayloads);
+        break;
+    case RemoveObject:
+    case PayloadReleasePacket:
+    case Invalid:
+        break;
+    }
+}
+
 } // namespace QRemoteObjectPackets
 
 QT_END_NAMESPACE
@@ -49,8 +49,12 @@
 #include <QtCore/QHash>
 #include <QtCore/QMap>
 #include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
 #include <QtCore/QUrl>
+#include <QtCore/QUuid>
 #include <QtCore/QVariant>
+#include <QtCore/QVector>
 #include <QtCore/QLoggingCategory>
 
 #include <cstdlib>
@@ -68,89 +72,238 @@ struct ObjectInfo
 {
     QString name;
     QString typeName;
+    int objectId;
+    quint32 interfaceHash; //See SourceApiMap::interfaceHash(), 0 if the source has none
 };
 
 inline QDebug operator<<(QDebug dbg, const ObjectInfo &info)
 {
-    dbg.nospace() << "ObjectInfo(" << info.name << ", " << info.typeName << ")";
+    dbg.nospace() << "ObjectInfo(" << info.name << ", " << info.typeName << ", " << info.objectId << ", " << hex << info.interfaceHash << dec << ")";
     return dbg.space();
 }
 
 inline QDataStream& operator<<(QDataStream &stream, const ObjectInfo &info)
 {
-    return stream << info.name << info.typeName;
+    return stream << info.name << info.typeName << info.objectId << info.interfaceHash;
 }
 
 inline QDataStream& operator>>(QDataStream &stream, ObjectInfo &info)
 {
-    return stream >> info.name >> info.typeName;
+    return stream >> info.name >> info.typeName >> info.objectId >> info.interfaceHash;
 }
 
 typedef QVector<ObjectInfo> ObjectInfoList;
 
+//Handle sent in place of a value that was moved to a shared memory segment,
+//see QRemoteObjectHostBase::setOutOfBandPayloadThreshold()
+struct OutOfBandPayload
+{
+    QString name;
+    quint32 size;
+    bool littleEndian; //Byte order the value was encoded in
+};
+
+inline QDataStream& operator<<(QDataStream &stream, const OutOfBandPayload &payload)
+{
+    return stream << payload.name << payload.size << payload.littleEndian;
+}
+
+inline QDataStream& operator>>(QDataStream &stream, OutOfBandPayload &payload)
+{
+    return stream >> payload.name >> payload.size >> payload.littleEndian;
+}
+
 void serializeObjectListPacket(DataStreamPacket&, const ObjectInfoList&);
 void deserializeObjectListPacket(QDataStream&, ObjectInfoList&);
 
-//Helper class for creating a QByteArray from a QRemoteObjectPacket
+//Sent by the host right after a client connects with the capabilities it
+//offers, and answered by the client with the ones it accepts, see
+//QtRemoteObjects::ConnectionCapability. Always big endian.
+void serializeHandshakePacket(DataStreamPacket&, quint32 capabilities);
+void deserializeHandshakePacket(QDataStream&, quint32 &capabilities);
+
+//Helper class for creating a QByteArray from a QRemoteObjectPacket. The
+//fields after the frame header are written in the packet's byteOrder(), see
+//QtRemoteObjects::littleEndianPacketFlag.
 class DataStreamPacket : public QDataStream
 {
 public:
     DataStreamPacket(quint16 id = QtRemoteObjects::InvokePacket)
         : QDataStream(&array, QIODevice::WriteOnly)
         , baseAddress(0)
+        , payloadThreshold(0)
     {
         this->setVersion(QtRemoteObjects::dataStreamVersion);
-        *this << quint32(0);
-        *this << id;
+        writeHeader(0, id);
     }
     void setId(quint16 id)
     {
         device()->seek(baseAddress);
-        *this << quint32(0);
-        *this << id;
+        writeHeader(0, id);
     }
 
     void finishPacket()
     {
         size = device()->pos();
         device()->seek(baseAddress);
+        const ByteOrder order = byteOrder();
+        setByteOrder(BigEndian);
         *this << quint32(size - baseAddress - sizeof(quint32));
+        setByteOrder(order);
     }
     QByteArray array;
     int baseAddress;
     int size;
+    //Values encoded to at least this many bytes are written out of band, 0 disables it
+    int payloadThreshold;
+    //Names of the segments created for the packets written since the list was last cleared
+    QStringList payloads;
 
 private:
+    void writeHeader(quint32 size, quint16 id)
+    {
+        const ByteOrder order = byteOrder();
+        if (order == LittleEndian)
+            id |= QtRemoteObjects::littleEndianPacketFlag;
+        setByteOrder(BigEndian);
+        *this << size;
+        *this << id;
+        setByteOrder(order);
+    }
+
     Q_DISABLE_COPY(DataStreamPacket)
 };
 
 QVariant serializedProperty(const QMetaProperty &property, const QObject *object);
 QVariant deserializedProperty(const QVariant &in, const QMetaProperty &property);
 
-void serializeInitPacket(DataStreamPacket&, const QRemoteObjectSource*);
-void deserializeInitPacket(QDataStream&, QVariantList&);
+//Every Init, PropertyChange and PropertyChangeBatch packet carries the epoch of
+//the source and the sequence number of its latest property change. A replica
+//presents both in AddObject when it reconnects, and the Init packet then is
+//partial, holding only the properties given in indexes, see
+//QRemoteObjectSource::addListener(). Without indexes it holds all properties.
+void serializeInitPacket(DataStreamPacket&, const QRemoteObjectSource*, const QVector<int> *indexes = Q_NULLPTR);
+void deserializeInitPacket(QDataStream&, int &objectId, QUuid &epoch, quint64 &sequence, bool &partial, QVector<int> &indexes, QVariantList&);
 
-void serializeInitDynamicPacket(DataStreamPacket&, const QRemoteObjectSource*);
-void deserializeInitDynamicPacket(QDataStream&, QMetaObjectBuilder&, QVariantList&);
+//The parts of an InitDynamicPacket that don't depend on the property values
+struct InitDynamicSchema
+{
+    QByteArray header;              //Name, id and schema hash of the object, signals, methods and property count
+    QVector<QByteArray> properties; //Name, type and notify signal of each property
+};
+
+//Hash of the signals, methods and properties a dynamic replica of the object gets
+QByteArray schemaHash(const QRemoteObjectSource*);
+
+//Hash repc wrote to the QCLASSINFO_REMOTEOBJECT_SIGNATURE of meta, 0 if it
+//has none. Sources and replicas compare it through SourceApiMap::interfaceHash().
+quint32 interfaceHash(const QMetaObject *meta);
 
-void serializeAddObjectPacket(DataStreamPacket&, const QString &name, bool isDynamic);
-void deserializeAddObjectPacket(QDataStream &ds, bool &isDynamic);
+//Fills schema if it is empty, and otherwise only encodes the values. Without
+//withSchema the packet only holds the schema hash and the values, for a
+//replica that has a meta object for that hash already.
+void serializeInitDynamicPacket(DataStreamPacket&, const QRemoteObjectSource*, InitDynamicSchema *schema = Q_NULLPTR, bool withSchema = true);
+//Returns false if the packet had no schema, and builder was left untouched
+bool deserializeInitDynamicPacket(QDataStream&, int &objectId, QByteArray &schemaHash, QMetaObjectBuilder&, QVariantList&, QUuid &epoch, quint64 &sequence);
+
+//A dynamic replica passes the schema hash it has a meta object for, if any
+void serializeAddObjectPacket(DataStreamPacket&, const QString &name, bool isDynamic, const QByteArray &schemaHash = QByteArray(), const QUuid &epoch = QUuid(), quint64 sequence = 0);
+void deserializeAddObjectPacket(QDataStream &ds, bool &isDynamic, QByteArray &schemaHash, QUuid &epoch, quint64 &sequence);
 
 void serializeRemoveObjectPacket(DataStreamPacket&, const QString &name);
 //There is no deserializeRemoveObjectPacket - no parameters other than id and name
 
-void serializeInvokePacket(DataStreamPacket&, const QString &name, int call, int index, const QVariantList &args, int serialId = -1, int propertyIndex = -1);
-void deserializeInvokePacket(QDataStream& in, int &call, int &index, QVariantList &args, int &serialId, int &propertyIndex);
+//Invoke, InvokeReply and PropertyChange packets are addressed by the object id
+//the source was registered with, rather than by name (see ObjectInfo)
+//An invoke sent with a timeout (in ms, -1 for none) is dropped by the source
+//if it would start later than that after its bytes were read from the
+//connection, its deadline (see deadlineFromTimeout()).
+void serializeInvokePacket(DataStreamPacket&, int objectId, int call, int index, const QVariantList &args, int serialId = -1, int propertyIndex = -1, int timeout = -1);
+void deserializeInvokePacket(QDataStream& in, int &call, int &index, QVariantList &args, int &serialId, int &propertyIndex, int &timeout, QByteArray *frame = Q_NULLPTR);
+
+//An InvokeTypedPacket holds the arguments of a slot written by the code repc
+//generated for the interface with the given hash, in place of a QVariantList.
+//The caller streams the arguments after the header and calls finishPacket().
+void serializeInvokeTypedPacketHeader(DataStreamPacket&, int objectId, quint32 interfaceHash, int index, int serialId = -1, int timeout = -1);
+void deserializeInvokeTypedPacketHeader(QDataStream& in, quint32 &interfaceHash, int &index, int &serialId, int &timeout);
+
+//error is a QRemoteObjectPendingCall::Error, value is only valid without one
+void serializeInvokeReplyPacket(DataStreamPacket&, int objectId, int ackedSerialId, const QVariant &value, int error = 0);
+void deserializeInvokeReplyPacket(QDataStream& in, int &ackedSerialId, QVariant &value, int &error);
+
+//Tells the source the replica no longer waits for the reply to serialId
+void serializeInvokeCancelPacket(DataStreamPacket&, int objectId, int serialId);
+void deserializeInvokeCancelPacket(QDataStream& in, int &serialId);
+
+//Deadlines are in ms of a monotonic clock, shared by the threads of a process
+qint64 monotonicMSecs();
+//Time at which timeout expires for a packet received at receivedAt, or from
+//now if that is unknown (-1). Returns -1 for no timeout.
+qint64 deadlineFromTimeout(qint64 receivedAt, int timeout);
+bool hasDeadlinePassed(qint64 deadline);
+
+void serializePropertyChangePacket(DataStreamPacket&, int objectId, int index, const QVariant &value, quint64 sequence, bool notify = false);
+void deserializePropertyChangePacket(QDataStream& in, int &index, QVariant &value, bool &notify, quint64 &sequence, QByteArray *frame = Q_NULLPTR);
 
-void serializeInvokeReplyPacket(DataStreamPacket&, const QString &name, int ackedSerialId, const QVariant &value);
-void deserializeInvokeReplyPacket(QDataStream& in, int &ackedSerialId, QVariant &value);
+//Sends the current value of each of the given properties, see QRemoteObjectSource::flushPropertyChanges()
+void serializePropertyChangeBatchPacket(DataStreamPacket&, const QRemoteObjectSource*, const QVector<int> &indexes);
+void deserializePropertyChangeBatchPacket(QDataStream& in, QVector<int> &indexes, QVariantList &values, quint64 &sequence);
 
-//TODO do we need the object name or could we go with an id in backend code, this could be a costly allocation
-void serializePropertyChangePacket(DataStreamPacket&, const QString &name, int index, const QVariant &value);
-void deserializePropertyChangePacket(QDataStream& in, int &index, QVariant &value);
+//Tells the source a replica is done with an out of band payload, the segment name is sent as the packet name
+void serializePayloadReleasePacket(DataStreamPacket&, const QString &name);
+//There is no deserializePayloadReleasePacket - no parameters other than id and name
+
+bool readOutOfBandPayload(const OutOfBandPayload &payload, QVariant &value);
+void releaseOutOfBandPayload(const QString &name);
+
+//Contents of one received packet. Only the fields used by its type are set.
+struct ReceivedPacket
+{
+    ReceivedPacket()
+        : type(QtRemoteObjects::Invalid), objectId(-1), byteOrder(QDataStream::BigEndian), capabilities(0)
+        , sequence(0), partial(false), withSchema(false), isDynamic(false), notify(false)
+        , call(0), index(-1), serialId(-1), propertyIndex(-1), interfaceHash(0), receivedAt(-1), deadline(-1), error(0)
+    {}
+
+    QtRemoteObjects::QRemoteObjectPacketTypeEnum type;
+    QString name;
+    int objectId;
+    QDataStream::ByteOrder byteOrder;
+    quint32 capabilities;
+    ObjectInfoList objects;
+    QUuid epoch;
+    quint64 sequence;
+    bool partial;
+    bool withSchema;
+    bool isDynamic;
+    bool notify;
+    QByteArray schemaHash;
+    QSharedPointer<QMetaObjectBuilder> builder;
+    int call;
+    int index;
+    int serialId;
+    int propertyIndex;
+    quint32 interfaceHash;
+    qint64 receivedAt; //Set by the reader before decodePacket(), see PacketReadBuffer::frameReceivedAt()
+    qint64 deadline;
+    int error;
+    QVector<int> indexes;
+    QVariantList args;
+    QVariant value;
+    //The arguments of an InvokeTypedPacket, when it isn't read from the connection's stream
+    QByteArray typedArguments;
+    //Out of band payloads that were read in place of their handles, and can be released
+    QStringList readPayloads;
+};
+
+//Reads the fields of a packet of the given type after its header. For an
+//InvokeTypedPacket that is only the header, the arguments are left in the stream.
+void decodePacket(QDataStream &in, ReceivedPacket &packet, QByteArray *frame = Q_NULLPTR);
 
 } // namespace QRemoteObjectPackets
 
 QT_END_NAMESPACE
 
+Q_DECLARE_METATYPE(QRemoteObjectPackets::OutOfBandPayload)
+
 #endif
@@ -0,0 +1,191 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Ford Motor Company
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtRemoteObjects module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qremoteobjectpacketreader_p.h"
+
+#include <QThread>
+
+QT_BEGIN_NAMESPACE
+
+using namespace QtRemoteObjects;
+using namespace QRemoteObjectPackets;
+
+namespace {
+
+class IoThread : public QThread
+{
+public:
+    IoThread()
+    {
+        setObjectName(QStringLiteral("QtRemoteObjects IO"));
+        start();
+    }
+
+    ~IoThread()
+    {
+        quit();
+        wait();
+    }
+};
+
+}
+
+Q_GLOBAL_STATIC(IoThread, ioThread)
+
+PacketDecoder::PacketDecoder(const QSharedPointer<DecodedPacketQueue> &queue)
+    : m_queue(queue)
+{
+}
+
+PacketDecoder::~PacketDecoder()
+{
+    qDeleteAll(m_streams);
+}
+
+void PacketDecoder::decode(int connectionId, const QByteArray &data)
+{
+    Stream *&stream = m_streams[connectionId];
+    if (!stream) {
+        stream = new Stream;
+        stream->device.setBuffer(&stream->received);
+        stream->device.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+        stream->reader.setDevice(&stream->device);
+    }
+    //The reader took all bytes of the device when it ran out of frames last time
+    if (stream->device.atEnd()) {
+        stream->received.clear();
+        stream->device.seek(0);
+    }
+    stream->received.append(data);
+
+    QVector<QPair<int, ReceivedPacket> > decoded;
+    forever {
+        ReceivedPacket packet;
+        if (!stream->reader.read(packet.type, packet.name, packet.objectId))
+            break;
+        packet.receivedAt = stream->reader.frameReceivedAt();
+        decodePacket(stream->reader.stream(), packet, stream->reader.largeFrame());
+        if (packet.type == InvokeTypedPacket)
+            packet.typedArguments = stream->reader.remainingFrame();
+        decoded.append(qMakePair(connectionId, packet));
+    }
+    if (decoded.isEmpty())
+        return;
+
+    QMutexLocker lock(&m_queue->mutex);
+    const bool wasEmpty = m_queue->packets.isEmpty();
+    m_queue->packets += decoded;
+    if (wasEmpty && m_queue->reader)
+        QMetaObject::invokeMethod(m_queue->reader, "handleDecodedPackets", Qt::QueuedConnection);
+}
+
+void PacketDecoder::reset(int connectionId)
+{
+    delete m_streams.take(connectionId);
+}
+
+ThreadedPacketReader::ThreadedPacketReader(ReceivedPacketHandler *handler, QObject *parent)
+    : QObject(parent)
+    , m_handler(handler)
+    , m_queue(new DecodedPacketQueue)
+    , m_nextConnectionId(0)
+{
+    m_queue->reader = this;
+    m_decoder = new PacketDecoder(m_queue);
+    m_decoder->moveToThread(ioThread());
+}
+
+ThreadedPacketReader::~ThreadedPacketReader()
+{
+    {
+        QMutexLocker lock(&m_queue->mutex);
+        m_queue->reader = Q_NULLPTR;
+    }
+    m_decoder->deleteLater();
+}
+
+bool ThreadedPacketReader::isEnabled()
+{
+    return qEnvironmentVariableIsSet("QT_REMOTEOBJECT_IO_THREAD");
+}
+
+void ThreadedPacketReader::read(QObject *connection, QIODevice *device)
+{
+    int id = m_connectionIds.value(connection, -1);
+    if (id < 0) {
+        id = m_nextConnectionId++;
+        m_connectionIds.insert(connection, id);
+        m_connections.insert(id, connection);
+        connect(connection, &QObject::destroyed, this, &ThreadedPacketReader::reset);
+    }
+
+    const QByteArray data = device->readAll();
+    if (!data.isEmpty())
+        QMetaObject::invokeMethod(m_decoder, "decode", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(QByteArray, data));
+}
+
+void ThreadedPacketReader::reset(QObject *connection)
+{
+    if (!m_connectionIds.contains(connection))
+        return;
+    const int id = m_connectionIds.take(connection);
+    m_connections.remove(id);
+    disconnect(connection, &QObject::destroyed, this, &ThreadedPacketReader::reset);
+    QMetaObject::invokeMethod(m_decoder, "reset", Qt::QueuedConnection, Q_ARG(int, id));
+}
+
+void ThreadedPacketReader::handleDecodedPackets()
+{
+    QVector<QPair<int, ReceivedPacket> > packets;
+    {
+        QMutexLocker lock(&m_queue->mutex);
+        packets.swap(m_queue->packets);
+    }
+
+    for (int i = 0; i < packets.size(); ++i) {
+        //A connection reset while handling the batch drops the rest of its packets
+        QObject *connection = m_connections.value(packets[i].first);
+        if (connection)
+            m_handler->handleReceivedPacket(connection, packets[i].second);
+    }
+}
+
+QT_END_NAMESPACE
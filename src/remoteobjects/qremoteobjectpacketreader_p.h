@@ -0,0 +1,137 @@
+/****************************************************************************
+**
+** Copyright (C) 2014 Ford Motor Company
+** Contact: http://www.qt-project.org/legal
+**
+** This file is part of the QtRemoteObjects module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia.  For licensing terms and
+** conditions see http://qt.digia.com/licensing.  For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights.  These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3.0 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU General Public License version 3.0 requirements will be
+** met: http://www.gnu.org/copyleft/gpl.html.
+**
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QREMOTEOBJECTPACKETREADER_P_H
+#define QREMOTEOBJECTPACKETREADER_P_H
+
+#include "qconnectionfactories.h"
+#include "qremoteobjectpacket_p.h"
+
+#include <QBuffer>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+
+QT_BEGIN_NAMESPACE
+
+class ThreadedPacketReader;
+
+//Gets the packets a ThreadedPacketReader decoded, in the thread of the reader
+class ReceivedPacketHandler
+{
+public:
+    virtual ~ReceivedPacketHandler() {}
+    virtual void handleReceivedPacket(QObject *connection, QRemoteObjectPackets::ReceivedPacket &packet) = 0;
+};
+
+//Packets decoded in the IO thread that the reader didn't take yet
+struct DecodedPacketQueue
+{
+    QMutex mutex;
+    ThreadedPacketReader *reader; //Cleared once the reader is destroyed
+    QVector<QPair<int, QRemoteObjectPackets::ReceivedPacket> > packets;
+};
+
+//Frames and decodes the bytes of the connections of a reader, lives in the IO thread
+class PacketDecoder : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(PacketDecoder)
+
+public:
+    explicit PacketDecoder(const QSharedPointer<DecodedPacketQueue> &queue);
+    ~PacketDecoder();
+
+public Q_SLOTS:
+    void decode(int connectionId, const QByteArray &data);
+    void reset(int connectionId);
+
+private:
+    struct Stream
+    {
+        QByteArray received;
+        QBuffer device;
+        PacketReadBuffer reader;
+    };
+
+    QSharedPointer<DecodedPacketQueue> m_queue;
+    QHash<int, Stream*> m_streams;
+};
+
+//Moves the framing and decoding of the packets received on a set of
+//connections to a process wide IO thread, so that a large packet doesn't
+//block the thread of the node. The thread the reader lives in only takes the
+//bytes off each connection, and gets the decoded packets back in batches,
+//in the order they were received.
+//Used by nodes and hosts created while QT_REMOTEOBJECT_IO_THREAD is set.
+class ThreadedPacketReader : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ThreadedPacketReader)
+
+public:
+    explicit ThreadedPacketReader(ReceivedPacketHandler *handler, QObject *parent = Q_NULLPTR);
+    ~ThreadedPacketReader();
+
+    static bool isEnabled();
+
+    //Hands the bytes available on device, which belongs to connection, to the IO thread
+    void read(QObject *connection, QIODevice *device);
+    //Drops anything received on connection that wasn't handled yet
+    void reset(QObject *connection);
+
+private Q_SLOTS:
+    void handleDecodedPackets();
+
+private:
+    ReceivedPacketHandler *m_handler;
+    QSharedPointer<DecodedPacketQueue> m_queue;
+    PacketDecoder *m_decoder;
+    //Connections are known to the decoder by id, so a packet of a connection
+    //that is gone can't be handed to a new one at the same address
+    QHash<QObject*, int> m_connectionIds;
+    QHash<int, QObject*> m_connections;
+    int m_nextConnectionId;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -45,6 +45,7 @@
 #include "qremoteobjectreplica_p.h"
 
 #include <QCoreApplication>
+#include <QThread>
 
 #include <private/qobject_p.h>
 
@@ -62,6 +63,82 @@ QRemoteObjectPendingCallData::~QRemoteObjectPendingCallData()
 {
 }
 
+namespace {
+
+struct PendingCallDataPool
+{
+    ~PendingCallDataPool()
+    {
+        Q_FOREACH (void *ptr, freeList)
+            ::operator delete(ptr);
+    }
+
+    QMutex mutex;
+    QVector<void*> freeList;
+};
+
+}
+
+Q_GLOBAL_STATIC(PendingCallDataPool, pendingCallDataPool)
+
+//Calls \a functor in the thread of \a receiver, the way a queued connection
+//would. The event is dropped when the receiver is destroyed first.
+template <typename Functor>
+static void postFunctor(QObject *receiver, Functor functor)
+{
+    int *types = static_cast<int *>(calloc(1, sizeof(int)));
+    void **args = static_cast<void **>(calloc(1, sizeof(void *)));
+    QtPrivate::QSlotObjectBase *slotObj = new QtPrivate::QFunctorSlotObject<Functor, 0, QtPrivate::List<>, void>(functor);
+    QCoreApplication::postEvent(receiver, new QMetaCallEvent(slotObj, Q_NULLPTR, -1, 1, types, args));
+}
+
+//Enough for the requests a model replica has in flight
+static const int maxPooledCallData = 256;
+
+void *QRemoteObjectPendingCallData::operator new(size_t size)
+{
+    Q_ASSERT(size == sizeof(QRemoteObjectPendingCallData));
+    PendingCallDataPool *pool = pendingCallDataPool();
+    if (pool) {
+        QMutexLocker locker(&pool->mutex);
+        if (!pool->freeList.isEmpty())
+            return pool->freeList.takeLast();
+    }
+    return ::operator new(size);
+}
+
+void QRemoteObjectPendingCallData::operator delete(void *ptr)
+{
+    PendingCallDataPool *pool = pendingCallDataPool();
+    if (pool) {
+        QMutexLocker locker(&pool->mutex);
+        if (pool->freeList.size() < maxPooledCallData) {
+            pool->freeList.append(ptr);
+            return;
+        }
+    }
+    ::operator delete(ptr);
+}
+
+void QRemoteObjectPendingCallData::PendingContinuation::invoke(const QRemoteObjectPendingCall &call) const
+{
+    if (!hasContext) {
+        continuation->invoke(call);
+        return;
+    }
+    if (!context)
+        return;
+
+    if (context->thread() == QThread::currentThread()) {
+        continuation->invoke(call);
+    } else {
+        const QSharedPointer<QRemoteObjectPendingCall::ContinuationBase> continuation = this->continuation;
+        postFunctor(context.data(), [continuation, call]() {
+            continuation->invoke(call);
+        });
+    }
+}
+
 void QRemoteObjectPendingCallWatcherHelper::add(QRemoteObjectPendingCallWatcher *watcher)
 {
     connect(this, SIGNAL(finished()), watcher, SLOT(_q_finished()), Qt::QueuedConnection);
@@ -133,12 +210,52 @@ bool QRemoteObjectPendingCall::waitForFinished(int timeout)
         return true; // already finished
 
     QMutexLocker locker(&d->mutex);
+    if (d->error != QRemoteObjectPendingCall::InvalidMessage)
+        return true;
+    //Cleared when the replica is destroyed, which finishes the call
     if (!d->replica)
         return false;
 
     return d->replica->waitForFinished(*this, timeout);
 }
 
+void QRemoteObjectPendingCall::addContinuation(QObject *context, ContinuationBase *continuation)
+{
+    const QRemoteObjectPendingCallData::PendingContinuation pending(context, continuation);
+    if (d) {
+        QMutexLocker locker(&d->mutex);
+        if (d->error == InvalidMessage) {
+            d->continuations.append(pending);
+            return;
+        }
+    }
+    pending.invoke(*this);
+}
+
+void QRemoteObjectPendingCall::cancel()
+{
+    if (!d)
+        return;
+
+    //The replica finishes a call before it stops tracking it, and clears
+    //d->replica under the lock for the calls it is destroyed with
+    QMutexLocker locker(&d->mutex);
+    QRemoteObjectReplicaPrivate *replica = d->replica;
+    if (!replica || d->error != InvalidMessage)
+        return;
+    const int serialId = d->serialId;
+    //The replica only sends from its own thread. Posted while holding the
+    //lock, so the replica is still alive, and its destruction drops the event.
+    if (QThread::currentThread() == replica->thread()) {
+        locker.unlock();
+        replica->cancelPendingCall(serialId);
+    } else {
+        postFunctor(replica, [replica, serialId]() { replica->cancelPendingCall(serialId); });
+        locker.unlock();
+    }
+    QRemoteObjectReplicaPrivate::finishPendingCall(*this, QVariant(), Canceled);
+}
+
 QRemoteObjectPendingCall QRemoteObjectPendingCall::fromCompletedCall(const QVariant &returnValue)
 {
     QRemoteObjectPendingCallData *data = new QRemoteObjectPendingCallData;
@@ -197,7 +314,8 @@ void QRemoteObjectPendingCallWatcher::waitForFinished()
         QRemoteObjectPendingCall::waitForFinished();
 
         // our signals were queued, so deliver them
-        QCoreApplication::sendPostedEvents(d->watcherHelper.data(), QEvent::MetaCall);
+        if (d->watcherHelper && d->watcherHelper->thread() == QThread::currentThread())
+            QCoreApplication::sendPostedEvents(d->watcherHelper.data(), QEvent::MetaCall);
         QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
     }
 }
@@ -46,6 +46,15 @@
 
 #include <QVariant>
 
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#  if __has_include(<coroutine>)
+#    include <coroutine>
+#    include <QAtomicInt>
+#    include <QSharedPointer>
+#    define QT_REMOTEOBJECTS_HAS_COROUTINES
+#  endif
+#endif
+
 QT_BEGIN_NAMESPACE
 
 class QRemoteObjectPendingCallWatcherPrivate;
@@ -56,7 +65,9 @@ class Q_REMOTEOBJECTS_EXPORT QRemoteObjectPendingCall
 public:
     enum Error {
         NoError,
-        InvalidMessage
+        InvalidMessage,
+        DeadlineExceeded,
+        Canceled
     };
 
     QRemoteObjectPendingCall();
@@ -72,16 +83,53 @@ public:
 
     bool waitForFinished(int timeout = 30000);
 
+    //Finishes the call with the Canceled error and tells the source, which
+    //skips the call if it didn't start it yet. Can be called from any thread.
+    void cancel();
+
     static QRemoteObjectPendingCall fromCompletedCall(const QVariant &returnValue);
 
+    //Calls continuation with this call once it finished, in the thread of
+    //context, unless context was destroyed by then. Without context, it is
+    //called in the thread finishing the call. Unlike a watcher, this creates
+    //no QObject, and runs without a queued call when the threads match.
+    template <typename Functor>
+    void then(QObject *context, Functor continuation)
+    {
+        addContinuation(context, new Continuation<QRemoteObjectPendingCall, Functor>(continuation));
+    }
+
 protected:
     QRemoteObjectPendingCall(QRemoteObjectPendingCallData *dd);
 
+    //Type erased continuation of then(), owned by the call data
+    class ContinuationBase
+    {
+    public:
+        virtual ~ContinuationBase() {}
+        virtual void invoke(const QRemoteObjectPendingCall &call) = 0;
+    };
+
+    template <typename Reply, typename Functor>
+    class Continuation : public ContinuationBase
+    {
+    public:
+        explicit Continuation(const Functor &functor) : m_functor(functor) {}
+        void invoke(const QRemoteObjectPendingCall &call) Q_DECL_OVERRIDE { m_functor(Reply(call)); }
+
+    private:
+        Functor m_functor;
+    };
+
+    void addContinuation(QObject *context, ContinuationBase *continuation);
+
     /// Shared data, note: might be null
     QExplicitlySharedDataPointer<QRemoteObjectPendingCallData> d;
 
 private:
+    friend class QRemoteObjectReplicaPrivate;
     friend class QConnectedReplicaPrivate;
+    friend class QRemoteObjectPendingCallData;
 };
 
 Q_DECLARE_METATYPE(QRemoteObjectPendingCall)
@@ -136,6 +184,41 @@ public:
         return qvariant_cast<Type>(QRemoteObjectPendingCall::returnValue());
     }
 
+    template <typename Functor>
+    void then(QObject *context, Functor continuation)
+    {
+        addContinuation(context, new Continuation<QRemoteObjectPendingReply, Functor>(continuation));
+    }
+
+#ifdef QT_REMOTEOBJECTS_HAS_COROUTINES
+    //Resumes the awaiting coroutine in the thread that finishes the call
+    class Awaiter
+    {
+    public:
+        explicit Awaiter(const QRemoteObjectPendingReply &reply) : m_reply(reply) {}
+
+        bool await_ready() const { return m_reply.isFinished(); }
+        //Returns false, so the coroutine isn't suspended at all, if the call
+        //finished before await_suspend() returned. It would otherwise be
+        //resumed from within the continuation, before it was suspended.
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            enum { Pending, Finished, Suspended };
+            const QSharedPointer<QAtomicInt> state(new QAtomicInt(Pending));
+            m_reply.then(Q_NULLPTR, [handle, state](const QRemoteObjectPendingReply &) {
+                if (!state->testAndSetOrdered(Pending, Finished))
+                    handle.resume();
+            });
+            return state->testAndSetOrdered(Pending, Suspended);
+        }
+        Type await_resume() const { return m_reply.returnValue(); }
+
+    private:
+        QRemoteObjectPendingReply m_reply;
+    };
+
+    Awaiter operator co_await() const { return Awaiter(*this); }
+#endif
 };
 
 QT_END_NAMESPACE
@@ -45,6 +45,10 @@
 #include "qremoteobjectpendingcall.h"
 
 #include <QMutex>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWaitCondition>
 
 QT_BEGIN_NAMESPACE
 
@@ -66,8 +70,30 @@ public:
     QRemoteObjectPendingCall::Error error;
 
     mutable QMutex mutex;
+    //Woken once the call finished, for threads waiting outside of the one of
+    //the replica. Only created by such a wait.
+    QScopedPointer<QWaitCondition> finished;
 
     QScopedPointer<QRemoteObjectPendingCallWatcherHelper> watcherHelper;
+
+    //A continuation added by QRemoteObjectPendingCall::then()
+    struct PendingContinuation
+    {
+        PendingContinuation() : hasContext(false) {}
+        PendingContinuation(QObject *context, QRemoteObjectPendingCall::ContinuationBase *continuation)
+            : hasContext(context != Q_NULLPTR), context(context), continuation(continuation) {}
+
+        void invoke(const QRemoteObjectPendingCall &call) const;
+
+        bool hasContext;
+        QPointer<QObject> context;
+        QSharedPointer<QRemoteObjectPendingCall::ContinuationBase> continuation;
+    };
+    QVector<PendingContinuation> continuations;
+
+    //The calls of a replica come and go at a high rate, so their memory is recycled
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
 };
 
 class QRemoteObjectPendingCallWatcherHelper: public QObject
@@ -53,9 +53,12 @@
 #include <QCoreApplication>
 #include <QDataStream>
 #include <QElapsedTimer>
+#include <QMutex>
 #include <QVariant>
 #include <QThread>
 #include <QTimer>
+#include <QTimerEvent>
+#include <QWaitCondition>
 
 #include <limits>
 
@@ -63,6 +66,96 @@ QT_BEGIN_NAMESPACE
 
 using namespace QRemoteObjectPackets;
 
+//Meta objects of dynamic replicas, shared by all the replicas with the same
+//schema. Replicas keep pointing to them, so they are only freed on shutdown.
+//The last schema seen for a source is keyed by its type and name, as sources
+//of the same type may still differ, e.g. when hosted by different versions.
+struct DynamicMetaObjectCache
+{
+    ~DynamicMetaObjectCache()
+    {
+        Q_FOREACH (const QMetaObject *meta, metaObjects)
+            free(const_cast<QMetaObject *>(meta));
+    }
+
+    QMutex mutex;
+    QHash<QByteArray, const QMetaObject *> metaObjects;
+    QHash<QPair<QString, QString>, QByteArray> schemaHashes;
+};
+Q_GLOBAL_STATIC(DynamicMetaObjectCache, dynamicMetaObjects)
+
+const QMetaObject *cachedDynamicMetaObject(const QByteArray &schemaHash)
+{
+    DynamicMetaObjectCache *cache = dynamicMetaObjects();
+    QMutexLocker locker(&cache->mutex);
+    return cache->metaObjects.value(schemaHash);
+}
+
+const QMetaObject *cacheDynamicMetaObject(const QString &typeName, const QString &name, const QByteArray &schemaHash,
+                                          const QMetaObjectBuilder &builder)
+{
+    DynamicMetaObjectCache *cache = dynamicMetaObjects();
+    QMutexLocker locker(&cache->mutex);
+    const QMetaObject *&meta = cache->metaObjects[schemaHash];
+    if (!meta)
+        meta = builder.toMetaObject();
+    cache->schemaHashes.insert(qMakePair(typeName, name), schemaHash);
+    return meta;
+}
+
+QByteArray knownSchemaHash(const QString &typeName, const QString &name)
+{
+    DynamicMetaObjectCache *cache = dynamicMetaObjects();
+    QMutexLocker locker(&cache->mutex);
+    return cache->schemaHashes.value(qMakePair(typeName, name));
+}
+
+QVariantList PropertySnapshots::load() const
+{
+    forever {
+        const int current = m_current.loadAcquire();
+        m_readers[current].fetchAndAddOrdered(1);
+        //The slot may have been replaced before it was pinned, and be written to already
+        if (m_current.loadAcquire() == current) {
+            const QVariantList values = m_slots[current];
+            m_readers[current].fetchAndAddRelease(-1);
+            return values;
+        }
+        m_readers[current].fetchAndAddRelease(-1);
+    }
+}
+
+//The writer waits when readers have both other slots pinned. That can only
+//last as long as copying a list takes, as a reader pinning a slot that isn't
+//the current one anymore lets go of it right away, but readers that keep
+//coming in back to back can make it spin for longer. It yields after each
+//round over the slots.
+void PropertySnapshots::publish(const QVariantList &values)
+{
+    const int current = m_current.load();
+    int next = current;
+    do {
+        next = (next + 1) % 3;
+        if (next == current)
+            QThread::yieldCurrentThread();
+    } while (next == current || m_readers[next].loadAcquire());
+
+    //Copied element by element into the list already in the slot, rather than
+    //sharing values. A shared values would be detached, so copied as a whole,
+    //by the first change the caller makes to it after every packet.
+    QVariantList &slot = m_slots[next];
+    if (slot.size() == values.size()) {
+        for (int i = 0; i < values.size(); ++i)
+            slot[i] = values.at(i);
+    } else {
+        slot.clear();
+        slot.reserve(values.size());
+        for (int i = 0; i < values.size(); ++i)
+            slot.append(values.at(i));
+    }
+    m_current.fetchAndStoreOrdered(next);
+}
+
 QRemoteObjectReplicaPrivate::QRemoteObjectReplicaPrivate(const QString &name, const QMetaObject *meta, QRemoteObjectNode *_node)
     : QObject(Q_NULLPTR), m_objectName(name), m_metaObject(meta), m_numSignals(0), m_methodOffset(0)
     , m_signalOffset(meta ? QRemoteObjectReplica::staticMetaObject.methodCount() : QRemoteObjectDynamicReplica::staticMetaObject.methodCount())
@@ -73,17 +166,17 @@ QRemoteObjectReplicaPrivate::QRemoteObjectReplicaPrivate(const QString &name, co
 
 QRemoteObjectReplicaPrivate::~QRemoteObjectReplicaPrivate()
 {
-    if (m_metaObject && qstrcmp(m_metaObject->className(), "QRemoteObjectDynamicReplica") == 0)
-        free(const_cast<QMetaObject*>(m_metaObject));
 }
 
 QConnectedReplicaPrivate::QConnectedReplicaPrivate(const QString &name, const QMetaObject *meta, QRemoteObjectNode *node)
-    : QRemoteObjectReplicaPrivate(name, meta, node), isSet(0), connectionToSource(Q_NULLPTR), m_curSerialId(0)
+    : QRemoteObjectReplicaPrivate(name, meta, node), isSet(0), connectionToSource(Q_NULLPTR), m_objectId(-1), m_sequence(0), m_typedInvoke(false), m_typedSerialId(-1), m_curSerialId(0), m_callTimeout(-1)
 {
 }
 
 QConnectedReplicaPrivate::~QConnectedReplicaPrivate()
 {
+    Q_FOREACH (const QRemoteObjectPendingCall &call, m_pendingCalls)
+        abandonPendingCall(call);
     if (!connectionToSource.isNull()) {
         qCDebug(QT_REMOTEOBJECT) << "Replica deleted: sending RemoveObject to RemoteObjectSource" << m_objectName;
         serializeRemoveObjectPacket(m_packet, m_objectName);
@@ -108,27 +201,35 @@ bool QConnectedReplicaPrivate::sendCommand()
     return true;
 }
 
-void QConnectedReplicaPrivate::initialize(const QVariantList &values)
+//With indexes, values only holds the properties that changed since the
+//replica was last attached to the source, see QRemoteObjectSource::addListener()
+void QConnectedReplicaPrivate::initialize(const QVariantList &values, const QVector<int> *indexes)
 {
-    qCDebug(QT_REMOTEOBJECT) << "initialize()" << m_propertyStorage.size();
+    qCDebug(QT_REMOTEOBJECT) << "initialize()" << propertyCount();
     const int nParam = values.size();
     QVarLengthArray<int> changedProperties(nParam);
     const int offset = m_metaObject->propertyOffset();
-    for (int i = 0; i < nParam; ++i) {
-        qCDebug(QT_REMOTEOBJECT) << "  in loop" << i << m_propertyStorage.size();
-        changedProperties[i] = -1;
-        if (m_propertyStorage[i] != values.at(i)) {
+    for (int n = 0; n < nParam; ++n) {
+        const int i = indexes ? indexes->at(n) : n;
+        qCDebug(QT_REMOTEOBJECT) << "  in loop" << i << propertyCount();
+        changedProperties[n] = -1;
+        if (i < 0 || i >= propertyCount()) {
+            qCWarning(QT_REMOTEOBJECT) << "Skipping invalid property in Init packet.  Index not found:" << i << "object:" << m_objectName;
+            continue;
+        }
+        if (getProperty(i) != values.at(n)) {
             const QMetaProperty property = m_metaObject->property(i+offset);
-            m_propertyStorage[i] = QRemoteObjectPackets::deserializedProperty(values.at(i), property);
-            changedProperties[i] = i;
+            storeProperty(i, QRemoteObjectPackets::deserializedProperty(values.at(n), property));
+            changedProperties[n] = i;
         }
-        qCDebug(QT_REMOTEOBJECT) << "SETPROPERTY" << i << m_metaObject->property(i+offset).name() << values.at(i).typeName() << values.at(i).toString();
+        qCDebug(QT_REMOTEOBJECT) << "SETPROPERTY" << i << m_metaObject->property(i+offset).name() << values.at(n).typeName() << values.at(n).toString();
     }
+    publishSnapshot();
 
     //initialized and validChanged need to be sent manually, since they are not in the derived classes
     //We should emit initialized before emitting any changed signals in case connections are made in a
     //Slot responding to initialized/validChanged.
-    if (isSet.fetchAndStoreRelease(2) > 0) {
+    if (markValid() > 0) {
         //We are already initialized, now we are valid again
         emitValidChanged();
     } else {
@@ -138,20 +239,64 @@ void QConnectedReplicaPrivate::initialize(const QVariantList &values)
     }
 
     void *args[] = {Q_NULLPTR, Q_NULLPTR};
-    for (int i = 0; i < nParam; ++i) {
-        if (changedProperties[i] < 0)
+    for (int n = 0; n < nParam; ++n) {
+        const int i = changedProperties[n];
+        if (i < 0)
             continue;
-        const int notifyIndex = m_metaObject->property(changedProperties[i]+offset).notifySignalIndex();
+        const int notifyIndex = m_metaObject->property(i+offset).notifySignalIndex();
         if (notifyIndex < 0)
             continue;
         qCDebug(QT_REMOTEOBJECT) << " Before activate" << notifyIndex << m_metaObject->property(notifyIndex).name();
-        args[1] = m_propertyStorage[i].data();
+        args[1] = propertyData(i);
         QMetaObject::activate(this, metaObject(), notifyIndex, args);
     }
 
     qCDebug(QT_REMOTEOBJECT) << "isSet = true for" << m_objectName;
 }
 
+void QConnectedReplicaPrivate::applyPropertyChange(int index, const QVariant &value, bool notify)
+{
+    if (index < 0 || index >= propertyCount()) {
+        qCWarning(QT_REMOTEOBJECT) << "Skipping invalid property change.  Index not found:" << index << "object:" << m_objectName;
+        return;
+    }
+    const QMetaProperty property = m_metaObject->property(index + m_metaObject->propertyOffset());
+    storeProperty(index, QRemoteObjectPackets::deserializedProperty(value, property));
+    publishSnapshot();
+    if (notify)
+        emitPropertyNotify(index);
+}
+
+void QConnectedReplicaPrivate::applyPropertyChanges(const QVector<int> &indexes, const QVariantList &values)
+{
+    const int offset = m_metaObject->propertyOffset();
+    for (int i = 0; i < indexes.size(); ++i) {
+        const int index = indexes.at(i);
+        if (index < 0 || index >= propertyCount()) {
+            qCWarning(QT_REMOTEOBJECT) << "Skipping invalid property change.  Index not found:" << index << "object:" << m_objectName;
+            continue;
+        }
+        const QMetaProperty property = m_metaObject->property(index + offset);
+        storeProperty(index, QRemoteObjectPackets::deserializedProperty(values.at(i), property));
+    }
+    publishSnapshot();
+
+    //Notify only once the whole batch is stored, so every slot sees the same state
+    Q_FOREACH (int index, indexes) {
+        if (index >= 0 && index < propertyCount())
+            emitPropertyNotify(index);
+    }
+}
+
+void QConnectedReplicaPrivate::emitPropertyNotify(int index)
+{
+    const int notifyIndex = m_metaObject->property(index + m_metaObject->propertyOffset()).notifySignalIndex();
+    if (notifyIndex < 0)
+        return;
+    void *args[] = {Q_NULLPTR, propertyData(index)};
+    QMetaObject::activate(this, metaObject(), notifyIndex, args);
+}
+
 void QRemoteObjectReplicaPrivate::emitValidChanged()
 {
     const static int validChangedIndex = QRemoteObjectReplica::staticMetaObject.indexOfMethod("isReplicaValidChanged()");
@@ -168,18 +313,18 @@ void QRemoteObjectReplicaPrivate::emitInitialized()
     QMetaObject::activate(this, metaObject(), initializedIndex, noArgs);
 }
 
-void QRemoteObjectReplicaPrivate::initializeMetaObject(const QMetaObjectBuilder &builder, const QVariantList &values)
+void QRemoteObjectReplicaPrivate::initializeMetaObject(const QMetaObject *meta, const QVariantList &values)
 {
     Q_ASSERT(!m_metaObject);
 
-    m_metaObject = builder.toMetaObject();
+    m_metaObject = meta;
     //rely on order of properties;
     setProperties(values);
 }
 
-void QConnectedReplicaPrivate::initializeMetaObject(const QMetaObjectBuilder &builder, const QVariantList &values)
+void QConnectedReplicaPrivate::initializeMetaObject(const QMetaObject *meta, const QVariantList &values)
 {
-    QRemoteObjectReplicaPrivate::initializeMetaObject(builder, values);
+    QRemoteObjectReplicaPrivate::initializeMetaObject(meta, values);
     foreach (QRemoteObjectReplica *obj, m_parentsNeedingConnect)
         configurePrivate(obj);
     m_parentsNeedingConnect.clear();
@@ -187,7 +332,7 @@ void QConnectedReplicaPrivate::initializeMetaObject(const QMetaObjectBuilder &bu
     //initialized and validChanged need to be sent manually, since they are not in the derived classes
     //We should emit initialized before emitting any changed signals in case connections are made in a
     //Slot responding to initialized/validChanged.
-    if (isSet.fetchAndStoreRelease(2) > 0) {
+    if (markValid() > 0) {
         //We are already initialized, now we are valid again
         emitValidChanged();
     } else {
@@ -221,12 +366,46 @@ bool QConnectedReplicaPrivate::isReplicaValid() const
     return isSet.load() == 2;
 }
 
+//Waits on condition, with mutex locked, until done() returns true or timeout
+//(in ms, -1 for none) expires
+template <typename Predicate>
+static bool waitOnCondition(QWaitCondition *condition, QMutex *mutex, int timeout, Predicate done)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timeout < 0) {
+            condition->wait(mutex);
+            continue;
+        }
+        const qint64 remaining = timeout - timer.elapsed();
+        if (remaining <= 0 || !condition->wait(mutex, remaining))
+            return done();
+    }
+    return true;
+}
+
+//Returns the previous value of isSet
+int QConnectedReplicaPrivate::markValid()
+{
+    QMutexLocker lock(&m_validMutex);
+    const int previous = isSet.fetchAndStoreRelease(2);
+    m_validCondition.wakeAll();
+    return previous;
+}
+
 bool QConnectedReplicaPrivate::waitForSource(int timeout)
 {
     if (isReplicaValid()) {
         return true;
     }
 
+    //The node handles the Init packet in its own thread, no need for an event loop here
+    if (QThread::currentThread() != thread()) {
+        QMutexLocker lock(&m_validMutex);
+        return waitOnCondition(&m_validCondition, &m_validMutex, timeout, [this]() { return isReplicaValid(); });
+    }
+
     const static int validChangedIndex = QRemoteObjectReplica::staticMetaObject.indexOfMethod("isReplicaValidChanged()");
     Q_ASSERT(validChangedIndex != -1);
 
@@ -260,7 +439,7 @@ void QConnectedReplicaPrivate::_q_send(QMetaObject::Call call, int index, const
         if (index < m_methodOffset) //index - m_methodOffset < 0 is invalid, and can't be resolved on the Source side
             qCWarning(QT_REMOTEOBJECT) << "Skipping invalid method invocation.  Index not found:" << index << "( offset =" << m_methodOffset << ") object:" << m_objectName << this->m_metaObject->method(index).name();
         else {
-            serializeInvokePacket(m_packet, m_objectName, call, index - m_methodOffset, args);
+            serializeInvokePacket(m_packet, m_objectId, call, index - m_methodOffset, args, -1, -1, m_callTimeout);
             sendCommand();
         }
     } else {
@@ -268,7 +447,7 @@ void QConnectedReplicaPrivate::_q_send(QMetaObject::Call call, int index, const
         if (index < m_propertyOffset) //index - m_propertyOffset < 0 is invalid, and can't be resolved on the Source side
             qCWarning(QT_REMOTEOBJECT) << "Skipping invalid property invocation.  Index not found:" << index << "( offset =" << m_propertyOffset << ") object:" << m_objectName << this->m_metaObject->property(index).name();
         else {
-            serializeInvokePacket(m_packet, m_objectName, call, index - m_propertyOffset, args);
+            serializeInvokePacket(m_packet, m_objectId, call, index - m_propertyOffset, args, -1, -1, m_callTimeout);
             sendCommand();
         }
     }
@@ -280,10 +459,31 @@ QRemoteObjectPendingCall QConnectedReplicaPrivate::_q_sendWithReply(QMetaObject:
 
     qCDebug(QT_REMOTEOBJECT) << "Send" << call << this->m_metaObject->method(index).name() << index << args << connectionToSource;
     int serialId = (m_curSerialId == std::numeric_limits<int>::max() ? 0 : m_curSerialId++);
-    serializeInvokePacket(m_packet, m_objectName, call, index - m_methodOffset, args, serialId);
+    serializeInvokePacket(m_packet, m_objectId, call, index - m_methodOffset, args, serialId, -1, m_callTimeout);
     return sendCommandWithReply(serialId);
 }
 
+QDataStream *QConnectedReplicaPrivate::_q_beginTypedSend(int index, bool withReply)
+{
+    if (!m_typedInvoke || index < m_methodOffset)
+        return Q_NULLPTR;
+
+    qCDebug(QT_REMOTEOBJECT) << "Send typed" << this->m_metaObject->method(index).name() << index << connectionToSource;
+    m_typedSerialId = withReply ? (m_curSerialId == std::numeric_limits<int>::max() ? 0 : m_curSerialId++) : -1;
+    serializeInvokeTypedPacketHeader(m_packet, m_objectId, QRemoteObjectPackets::interfaceHash(m_metaObject), index - m_methodOffset, m_typedSerialId, m_callTimeout);
+    return &m_packet;
+}
+
+QRemoteObjectPendingCall QConnectedReplicaPrivate::_q_endTypedSend()
+{
+    m_packet.finishPacket();
+    if (m_typedSerialId < 0) {
+        sendCommand();
+        return QRemoteObjectPendingCall();
+    }
+    return sendCommandWithReply(m_typedSerialId);
+}
+
 QRemoteObjectPendingCall QConnectedReplicaPrivate::sendCommandWithReply(int serialId)
 {
     bool success = sendCommand();
@@ -292,29 +492,178 @@ QRemoteObjectPendingCall QConnectedReplicaPrivate::sendCommandWithReply(int seri
     }
 
     qCDebug(QT_REMOTEOBJECT) << "Sent InvokePacket with serial id:" << serialId;
-    QRemoteObjectPendingCall pendingCall(new QRemoteObjectPendingCallData(serialId, this));
+    QRemoteObjectPendingCall pendingCall = createPendingCall(serialId);
     Q_ASSERT(!m_pendingCalls.contains(serialId));
     m_pendingCalls[serialId] = pendingCall;
+    if (m_callTimeout >= 0) {
+        const qint64 now = monotonicMSecs();
+        m_callTimeouts.add(serialId, now + m_callTimeout, now);
+        if (!m_callTimeoutTimer.isActive())
+            m_callTimeoutTimer.start(PendingCallTimeouts::tickMSecs, Qt::PreciseTimer, this);
+    }
     return pendingCall;
 }
 
-void QConnectedReplicaPrivate::notifyAboutReply(int ackedSerialId, const QVariant &value)
+void QConnectedReplicaPrivate::notifyAboutReply(int ackedSerialId, const QVariant &value, QRemoteObjectPendingCall::Error error)
+{
+    //The call may have timed out here already
+    QHash<int, QRemoteObjectPendingCall>::iterator it = m_pendingCalls.find(ackedSerialId);
+    if (it == m_pendingCalls.end()) {
+        qCDebug(QT_REMOTEOBJECT) << "Dropping reply to expired call with serial id:" << ackedSerialId;
+        return;
+    }
+    const QRemoteObjectPendingCall call = *it;
+    m_pendingCalls.erase(it);
+    if (m_callTimeoutTimer.isActive()) {
+        m_callTimeouts.remove(ackedSerialId);
+        if (m_callTimeouts.isEmpty())
+            m_callTimeoutTimer.stop();
+    }
+    finishPendingCall(call, value, error);
+}
+
+void QConnectedReplicaPrivate::cancelPendingCall(int serialId)
+{
+    //Unless the reply arrived or the call timed out in the meantime
+    const QRemoteObjectPendingCall call = m_pendingCalls.take(serialId);
+    if (!call.d)
+        return;
+    if (m_callTimeoutTimer.isActive()) {
+        m_callTimeouts.remove(serialId);
+        if (m_callTimeouts.isEmpty())
+            m_callTimeoutTimer.stop();
+    }
+    qCDebug(QT_REMOTEOBJECT) << "Cancel call with serial id:" << serialId;
+    serializeInvokeCancelPacket(m_packet, m_objectId, serialId);
+    sendCommand();
+    //A call is finished before it is no longer tracked, see
+    //QRemoteObjectPendingCall::cancel(). Last, as a continuation may delete the
+    //replica.
+    finishPendingCall(call, QVariant(), QRemoteObjectPendingCall::Canceled);
+}
+
+void QConnectedReplicaPrivate::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_callTimeoutTimer.timerId()) {
+        QRemoteObjectReplicaPrivate::timerEvent(event);
+        return;
+    }
+
+    Q_FOREACH (int serialId, m_callTimeouts.takeExpired(monotonicMSecs())) {
+        const QRemoteObjectPendingCall call = m_pendingCalls.take(serialId);
+        if (call.d) { //Not answered yet
+            qCDebug(QT_REMOTEOBJECT) << "Call with serial id" << serialId << "exceeded its deadline";
+            finishPendingCall(call, QVariant(), QRemoteObjectPendingCall::DeadlineExceeded);
+        }
+    }
+    if (m_callTimeouts.isEmpty())
+        m_callTimeoutTimer.stop();
+}
+
+void PendingCallTimeouts::add(int serialId, qint64 deadline, qint64 now)
+{
+    if (isEmpty())
+        m_nextTick = now / tickMSecs;
+    //A deadline in a tick already looked at expires with the next one
+    const qint64 tick = qMax(deadline / tickMSecs, m_nextTick);
+    const int slot = int(tick % slotCount);
+    Entry entry = { serialId, deadline };
+    m_slots[slot].append(entry);
+    m_slotOfCall.insert(serialId, slot);
+}
+
+void PendingCallTimeouts::remove(int serialId)
+{
+    QHash<int, int>::iterator it = m_slotOfCall.find(serialId);
+    if (it == m_slotOfCall.end())
+        return;
+    QVector<Entry> &slot = m_slots[it.value()];
+    m_slotOfCall.erase(it);
+    for (int i = 0; i < slot.size(); ++i) {
+        if (slot.at(i).serialId == serialId) {
+            slot.remove(i);
+            return;
+        }
+    }
+}
+
+QVector<int> PendingCallTimeouts::takeExpired(qint64 now)
+{
+    QVector<int> expired;
+    const qint64 lastTick = now / tickMSecs;
+    //One turn of the wheel visits every slot
+    for (qint64 tick = qMax(m_nextTick, lastTick - slotCount + 1); tick <= lastTick && !isEmpty(); ++tick) {
+        QVector<Entry> &slot = m_slots[tick % slotCount];
+        for (int i = 0; i < slot.size(); ) {
+            if (slot.at(i).deadline <= now) {
+                expired.append(slot.at(i).serialId);
+                m_slotOfCall.remove(slot.at(i).serialId);
+                slot.remove(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+    m_nextTick = lastTick + 1;
+    return expired;
+}
+
+QRemoteObjectPendingCall QRemoteObjectReplicaPrivate::createPendingCall(int serialId)
+{
+    return QRemoteObjectPendingCall(new QRemoteObjectPendingCallData(serialId, this));
+}
+
+void QRemoteObjectReplicaPrivate::finishPendingCall(const QRemoteObjectPendingCall &call, const QVariant &returnValue,
+                                                     QRemoteObjectPendingCall::Error error)
 {
-    QRemoteObjectPendingCall call = m_pendingCalls.take(ackedSerialId);
+    QVector<QRemoteObjectPendingCallData::PendingContinuation> continuations;
+    {
+        QMutexLocker mutex(&call.d->mutex);
+
+        //A canceled call can still be answered by the source
+        if (call.d->error != QRemoteObjectPendingCall::InvalidMessage)
+            return;
+        call.d->error = error;
+        call.d->returnValue = returnValue;
+
+        if (call.d->finished)
+            call.d->finished->wakeAll();
 
-    QMutexLocker mutex(&call.d->mutex);
+        // notify watchers if needed
+        if (call.d->watcherHelper)
+            call.d->watcherHelper->emitSignals();
 
-    // clear error flag
-    call.d->error = QRemoteObjectPendingCall::NoError;
-    call.d->returnValue = value;
+        continuations.swap(call.d->continuations);
+    }
+
+    //Without the lock, as continuations read the call
+    Q_FOREACH (const QRemoteObjectPendingCallData::PendingContinuation &continuation, continuations)
+        continuation.invoke(call);
+}
 
-    // notify watchers if needed
-    if (call.d->watcherHelper)
-        call.d->watcherHelper->emitSignals();
+//For a call the replica is destroyed with. The call no longer refers to the
+//replica, so it can't be canceled or waited for through it from any thread, and
+//is finished as canceled, which wakes whoever waits for it.
+void QRemoteObjectReplicaPrivate::abandonPendingCall(const QRemoteObjectPendingCall &call)
+{
+    {
+        QMutexLocker locker(&call.d->mutex);
+        call.d->replica = Q_NULLPTR;
+    }
+    finishPendingCall(call, QVariant(), QRemoteObjectPendingCall::Canceled);
 }
 
-bool QConnectedReplicaPrivate::waitForFinished(const QRemoteObjectPendingCall& call, int timeout)
+bool QRemoteObjectReplicaPrivate::waitForFinished(const QRemoteObjectPendingCall& call, int timeout)
 {
+    //The node finishes the call in its own thread, no need for an event loop here
+    if (QThread::currentThread() != thread()) {
+        QRemoteObjectPendingCallData *d = call.d.data();
+        if (!d->finished)
+            d->finished.reset(new QWaitCondition);
+        return waitOnCondition(d->finished.data(), &d->mutex, timeout,
+                               [d]() { return d->error != QRemoteObjectPendingCall::InvalidMessage; });
+    }
+
     if (!call.d->watcherHelper)
         call.d->watcherHelper.reset(new QRemoteObjectPendingCallWatcherHelper);
 
@@ -334,7 +683,9 @@ bool QConnectedReplicaPrivate::waitForFinished(const QRemoteObjectPendingCall& c
 
 const QVariant QConnectedReplicaPrivate::getProperty(int i) const
 {
-    Q_ASSERT_X(i >= 0 && i < m_propertyStorage.size(), __FUNCTION__, qPrintable(QString(QLatin1String("0 <= %1 < %2")).arg(i).arg(m_propertyStorage.size())));
+    Q_ASSERT_X(i >= 0 && i < propertyCount(), __FUNCTION__, qPrintable(QString(QLatin1String("0 <= %1 < %2")).arg(i).arg(propertyCount())));
+    if (m_storage)
+        return m_storage->property(i);
     return m_propertyStorage[i];
 }
 
@@ -343,18 +694,45 @@ void QConnectedReplicaPrivate::setProperties(const QVariantList &properties)
     Q_ASSERT(m_propertyStorage.isEmpty());
     m_propertyStorage.reserve(properties.length());
     m_propertyStorage = properties;
+    publishSnapshot();
 }
 
 void QConnectedReplicaPrivate::setProperty(int i, const QVariant &prop)
 {
-    m_propertyStorage[i] = prop;
+    storeProperty(i, prop);
+    publishSnapshot();
 }
 
-void QConnectedReplicaPrivate::setConnection(ClientIoDevice *conn)
+void QConnectedReplicaPrivate::setStorage(QRemoteObjectReplicaStorage *storage)
+{
+    m_storage.reset(storage);
+    m_snapshotValues.clear();
+    if (m_storage) {
+        for (int i = 0; i < m_storage->propertyCount(); ++i)
+            m_snapshotValues.append(m_storage->property(i));
+    }
+    publishSnapshot();
+}
+
+void QConnectedReplicaPrivate::storeProperty(int index, const QVariant &value)
+{
+    if (m_storage) {
+        m_storage->setProperty(index, value);
+        m_snapshotValues[index] = value;
+    } else {
+        m_propertyStorage[index] = value;
+    }
+}
+
+void QConnectedReplicaPrivate::setConnection(ClientIoDevice *conn, int objectId, const QString &typeName, quint32 sourceInterfaceHash)
 {
     if (connectionToSource.isNull()) {
         connectionToSource = conn;
-        qCDebug(QT_REMOTEOBJECT) << "setConnection started" << conn << m_objectName;
+        m_objectId = objectId;
+        m_typeName = typeName;
+        m_packet.setByteOrder(conn->byteOrder());
+        m_typedInvoke = sourceInterfaceHash && sourceInterfaceHash == QRemoteObjectPackets::interfaceHash(m_metaObject);
+        qCDebug(QT_REMOTEOBJECT) << "setConnection started" << conn << m_objectName << objectId;
     }
     requestRemoteObjectSource();
 }
@@ -368,7 +746,13 @@ void QConnectedReplicaPrivate::setDisconnected()
 
 void QConnectedReplicaPrivate::requestRemoteObjectSource()
 {
-    serializeAddObjectPacket(m_packet, m_objectName, needsDynamicInitialization());
+    //After a reconnect, the source only sends what changed since m_sequence.
+    //A dynamic replica passes the hash of the schema it has a meta object
+    //for, so a source with the same schema can leave out the signatures, or
+    //resume it like any other replica.
+    const bool dynamic = needsDynamicInitialization() || !m_schemaHash.isEmpty();
+    const QByteArray schemaHash = !dynamic ? QByteArray() : m_metaObject ? m_schemaHash : knownSchemaHash(m_typeName, m_objectName);
+    serializeAddObjectPacket(m_packet, m_objectName, dynamic, schemaHash, m_sourceEpoch, m_sequence);
     sendCommand();
 }
 
@@ -515,6 +899,34 @@ QRemoteObjectPendingCall QRemoteObjectReplica::sendWithReply(QMetaObject::Call c
     return d_ptr->_q_sendWithReply(call, index, args);
 }
 
+/*!
+    \internal
+
+    Starts a call of the slot with the given \a index whose arguments are
+    streamed directly, by the code repc generated for the interface, rather
+    than wrapped in QVariants. Returns \c Q_NULLPTR if the source wasn't
+    generated from the same interface, or is in the same process, in which
+    case the call has to be made with send() or sendWithReply() instead.
+
+    The arguments are written to the returned stream, and the call is sent
+    by endTypedSend(). If \a withReply is \c true, endTypedSend() returns
+    the pending reply.
+*/
+QDataStream *QRemoteObjectReplica::beginTypedSend(int index, bool withReply)
+{
+    Q_ASSERT(index != -1);
+
+    return d_ptr->_q_beginTypedSend(index, withReply);
+}
+
+/*!
+    \internal
+*/
+QRemoteObjectPendingCall QRemoteObjectReplica::endTypedSend()
+{
+    return d_ptr->_q_endTypedSend();
+}
+
 /*!
     \internal
 */
@@ -523,6 +935,32 @@ const QVariant QRemoteObjectReplica::propAsVariant(int i) const
     return d_ptr->getProperty(i);
 }
 
+/*!
+    \internal
+
+    Makes \a storage, which repc generates for each Replica class, hold the
+    property values of the Replica in place of a QVariantList. The Replica
+    takes ownership of \a storage. It is ignored when the Replica reads the
+    properties from a Source in the same process.
+
+    \sa propertyStorage()
+*/
+void QRemoteObjectReplica::setPropertyStorage(QRemoteObjectReplicaStorage *storage)
+{
+    d_ptr->setStorage(storage);
+}
+
+/*!
+    \internal
+
+    Returns the storage set by setPropertyStorage(), or \c Q_NULLPTR if the
+    properties have to be read with propAsVariant().
+*/
+const QRemoteObjectReplicaStorage *QRemoteObjectReplica::propertyStorage() const
+{
+    return d_ptr->storage();
+}
+
 /*!
     \internal
 */
@@ -557,6 +995,59 @@ bool QRemoteObjectReplica::isInitialized() const
     return d_ptr->isInitialized();
 }
 
+/*!
+    Returns the values of the properties of this Replica, in the order its
+    class declares them. That is, the first value belongs to the property
+    metaObject()->property(metaObject()->propertyOffset()).
+
+    Unlike the property getters, this function can be called from any thread.
+    The values all come from the same Init or property change packet, and are
+    never locked against the thread of the \l {QRemoteObjectNode} {Node}
+    updating them. This lets a worker thread follow the state of the
+    \l {Source} without queued connections.
+
+    The list is empty for a Replica of a Source held by the same Node, whose
+    properties are read from the Source object itself.
+
+    \sa isInitialized()
+*/
+QVariantList QRemoteObjectReplica::propertySnapshot() const
+{
+    return d_ptr->propertySnapshot();
+}
+
+/*!
+    Sets the time in milliseconds the \l {Source} has to answer the method
+    calls of this Replica to \a msecs. The default of -1 lets calls wait for
+    their reply forever.
+
+    The timeout is sent along with each call. A Source that gets to a call
+    only after its timeout has passed, for instance because it is busy with
+    the calls before it, does not invoke it anymore. A call that is still
+    waiting for its reply when the timeout passes finishes with the
+    QRemoteObjectPendingCall::DeadlineExceeded error, and a reply that
+    arrives later is dropped.
+
+    The timeout applies to the calls made after setting it.
+
+    \sa callTimeout()
+*/
+void QRemoteObjectReplica::setCallTimeout(int msecs)
+{
+    d_ptr->setCallTimeout(msecs < 0 ? -1 : msecs);
+}
+
+/*!
+    Returns the time in milliseconds the \l {Source} has to answer the method
+    calls of this Replica, or -1 if calls wait for their reply forever.
+
+    \sa setCallTimeout()
+*/
+int QRemoteObjectReplica::callTimeout() const
+{
+    return d_ptr->callTimeout();
+}
+
 QRemoteObjectNode *QRemoteObjectReplica::node() const
 {
     return d_ptr->node();
@@ -595,6 +1086,13 @@ bool QRemoteObjectReplica::isReplicaValid() const
 
     If \a timeout is -1, this function will not time out.
 
+    Called from the thread of the \l {QRemoteObjectNode} {Node}, this function
+    runs a local event loop, so that the Node can receive the \l {Source}.
+    Called from any other thread, it blocks that thread without processing
+    its events until the Node, which keeps running in its own thread, has
+    initialized the Replica. The same applies to
+    QRemoteObjectPendingCall::waitForFinished().
+
     \sa isInitialized(), initialized()
 */
 bool QRemoteObjectReplica::waitForSource(int timeout)
@@ -609,6 +1107,10 @@ QInProcessReplicaPrivate::QInProcessReplicaPrivate(const QString &name, const QM
 
 QInProcessReplicaPrivate::~QInProcessReplicaPrivate()
 {
+    for (QHash<QFutureWatcherBase *, QRemoteObjectPendingCall>::const_iterator it = m_futureCalls.cbegin(); it != m_futureCalls.cend(); ++it) {
+        it.key()->deleteLater();
+        abandonPendingCall(it.value());
+    }
 }
 
 const QVariant QInProcessReplicaPrivate::getProperty(int i) const
@@ -640,11 +1142,11 @@ void QInProcessReplicaPrivate::_q_send(QMetaObject::Call call, int index, const
 
     const SourceApiMap *api = connectionToSource->m_api;
     if (call == QMetaObject::InvokeMetaMethod) {
-        const int resolvedIndex = api->sourceMethodIndex(index - m_methodOffset);
-        if (resolvedIndex < 0)
+        const QRemoteObjectSource::MethodDescriptor *method = connectionToSource->method(index - m_methodOffset);
+        if (!method)
             qCWarning(QT_REMOTEOBJECT) << "Skipping invalid invocation.  Index not found:" << index - m_methodOffset;
         else
-            connectionToSource->invoke(call, api->isAdapterMethod(index - m_methodOffset), resolvedIndex, args);
+            connectionToSource->invoke(call, method->forAdapter, method->index, args);
     } else {
         const int resolvedIndex = connectionToSource->m_api->sourcePropertyIndex(index - m_propertyOffset);
         if (resolvedIndex < 0)
@@ -659,19 +1161,28 @@ QRemoteObjectPendingCall QInProcessReplicaPrivate::_q_sendWithReply(QMetaObject:
     Q_ASSERT(call == QMetaObject::InvokeMetaMethod);
 
     const int ReplicaIndex = index - m_methodOffset;
-    int typeId = QVariant::nameToType(connectionToSource->m_api->typeName(ReplicaIndex).constData());
-    if (!QMetaType(typeId).sizeOf())
-        typeId = QVariant::Invalid;
-    QVariant returnValue(typeId, Q_NULLPTR);
-
-    const int resolvedIndex = connectionToSource->m_api->sourceMethodIndex(ReplicaIndex);
-    if (resolvedIndex < 0) {
+    const QRemoteObjectSource::MethodDescriptor *method = connectionToSource->method(ReplicaIndex);
+    if (!method) {
         qCWarning(QT_REMOTEOBJECT) << "Skipping invalid invocation.  Index not found:" << ReplicaIndex;
         return QRemoteObjectPendingCall();
     }
 
-    connectionToSource->invoke(call, connectionToSource->m_api->isAdapterMethod(ReplicaIndex), resolvedIndex, args, &returnValue);
-    return QRemoteObjectPendingCall::fromCompletedCall(returnValue);
+    QVariant returnValue(method->returnType, Q_NULLPTR);
+    connectionToSource->invoke(call, method->forAdapter, method->index, args, &returnValue);
+    if (!method->watchFuture)
+        return QRemoteObjectPendingCall::fromCompletedCall(returnValue);
+
+    //Like a remote source, reply with the result of the future once it finished
+    const QRemoteObjectPendingCall pendingCall = createPendingCall(-1);
+    QFutureWatcherBase *watcher = connectionToSource->watchFuture(method, returnValue);
+    const QtRemoteObjects::FutureResultReader futureResult = method->futureResult;
+    m_futureCalls.insert(watcher, pendingCall);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, pendingCall, watcher, futureResult]() {
+        watcher->deleteLater();
+        m_futureCalls.remove(watcher);
+        finishPendingCall(pendingCall, futureResult(watcher));
+    });
+    return pendingCall;
 }
 
 QStubReplicaPrivate::QStubReplicaPrivate() {}
@@ -680,6 +1191,8 @@ QStubReplicaPrivate::~QStubReplicaPrivate() {}
 
 const QVariant QStubReplicaPrivate::getProperty(int i) const
 {
+    if (m_storage)
+        return m_storage->property(i);
     Q_ASSERT_X(i >= 0 && i < m_propertyStorage.size(), __FUNCTION__, qPrintable(QString(QLatin1String("0 <= %1 < %2")).arg(i).arg(m_propertyStorage.size())));
     return m_propertyStorage[i];
 }
@@ -693,7 +1206,10 @@ void QStubReplicaPrivate::setProperties(const QVariantList &properties)
 
 void QStubReplicaPrivate::setProperty(int i, const QVariant &prop)
 {
-    m_propertyStorage[i] = prop;
+    if (m_storage)
+        m_storage->setProperty(i, prop);
+    else
+        m_propertyStorage[i] = prop;
 }
 
 void QStubReplicaPrivate::_q_send(QMetaObject::Call call, int index, const QVariantList &args)
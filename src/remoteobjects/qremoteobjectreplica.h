@@ -53,6 +53,24 @@ class QRemoteObjectReplicaPrivate;
 class QReplicaPrivateInterface;
 class QRemoteObjectNode;
 
+//Typed members holding the property values of a Replica, generated by repc
+//next to each Replica class. The Node writes property changes into them, so
+//the getters of the Replica don't need to convert QVariants.
+class QRemoteObjectReplicaStorage
+{
+protected:
+    QRemoteObjectReplicaStorage() {}
+public:
+    virtual ~QRemoteObjectReplicaStorage() {}
+    virtual int propertyCount() const = 0;
+    virtual QVariant property(int index) const = 0;
+    virtual void setProperty(int index, const QVariant &value) = 0;
+    //Address of the member holding the property, passed on to its notify signal
+    virtual void *propertyData(int index) = 0;
+private:
+    Q_DISABLE_COPY(QRemoteObjectReplicaStorage)
+};
+
 class Q_REMOTEOBJECTS_EXPORT QRemoteObjectReplica : public QObject
 {
     Q_OBJECT
@@ -65,6 +83,9 @@ public:
     bool isReplicaValid() const;
     bool waitForSource(int timeout = 30000);
     bool isInitialized() const;
+    QVariantList propertySnapshot() const;
+    void setCallTimeout(int msecs);
+    int callTimeout() const;
     QRemoteObjectNode *node() const;
     void setNode(QRemoteObjectNode *node);
 
@@ -79,11 +100,15 @@ protected:
     virtual void initialize();
     void send(QMetaObject::Call call, int index, const QVariantList &args);
     QRemoteObjectPendingCall sendWithReply(QMetaObject::Call call, int index, const QVariantList &args);
+    QDataStream *beginTypedSend(int index, bool withReply = false);
+    QRemoteObjectPendingCall endTypedSend();
 
 protected:
     void setProperty(int i, const QVariant &);
     void setProperties(const QVariantList &);
     const QVariant propAsVariant(int i) const;
+    void setPropertyStorage(QRemoteObjectReplicaStorage *storage);
+    const QRemoteObjectReplicaStorage *propertyStorage() const;
     void initializeNode(QRemoteObjectNode *node, const QString &name = QString());
     QSharedPointer<QReplicaPrivateInterface> d_ptr;
 private:
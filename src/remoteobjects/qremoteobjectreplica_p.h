@@ -48,13 +48,20 @@
 
 #include "qremoteobjectpacket_p.h"
 
+#include <QAtomicInt>
+#include <QBasicTimer>
+#include <QMutex>
 #include <QPointer>
+#include <QScopedPointer>
+#include <QUuid>
+#include <QWaitCondition>
 #include <QVector>
 #include <QDataStream>
 #include <qcompilerdetection.h>
 
 QT_BEGIN_NAMESPACE
 
+class QFutureWatcherBase;
 class QRemoteObjectReplica;
 class QRemoteObjectSource;
 class ClientIoDevice;
@@ -66,6 +73,61 @@ class QInvokeReplyPacket;
 class QRemoteObjectPacket;
 }
 
+//Process wide cache of the meta objects of dynamic replicas, keyed by schema hash
+const QMetaObject *cachedDynamicMetaObject(const QByteArray &schemaHash);
+const QMetaObject *cacheDynamicMetaObject(const QString &typeName, const QString &name, const QByteArray &schemaHash,
+                                          const QMetaObjectBuilder &builder);
+QByteArray knownSchemaHash(const QString &typeName, const QString &name);
+
+//Property values published by the thread of the node, and read by any thread
+//without locking. A new list is stored in one of three slots before it is
+//made the current one. A reader pins the current slot while it copies the
+//list, so a slot is only written to once no reader has it pinned anymore.
+class PropertySnapshots
+{
+public:
+    PropertySnapshots() : m_current(0) {}
+
+    QVariantList load() const;
+    void publish(const QVariantList &values);
+
+private:
+    QVariantList m_slots[3];
+    mutable QAtomicInt m_readers[3];
+    QAtomicInt m_current;
+    Q_DISABLE_COPY(PropertySnapshots)
+};
+
+//Times out the pending calls of a replica. A call is put in the slot of the
+//tick its deadline falls in, so a tick only looks at the calls of one slot.
+//Calls more than a turn of the wheel away stay in their slot until then.
+class PendingCallTimeouts
+{
+public:
+    PendingCallTimeouts() : m_nextTick(0) {}
+
+    void add(int serialId, qint64 deadline, qint64 now);
+    //For a call answered before its deadline
+    void remove(int serialId);
+    //Returns the calls whose deadline passed at now
+    QVector<int> takeExpired(qint64 now);
+    bool isEmpty() const { return m_slotOfCall.isEmpty(); }
+
+    static const int tickMSecs = 20;
+
+private:
+    struct Entry
+    {
+        int serialId;
+        qint64 deadline;
+    };
+    static const int slotCount = 256;
+    QVector<Entry> m_slots[slotCount];
+    qint64 m_nextTick; //The first tick takeExpired() looks at
+    QHash<int, int> m_slotOfCall;
+    Q_DISABLE_COPY(PendingCallTimeouts)
+};
+
 class QReplicaPrivateInterface
 {
 public:
@@ -77,9 +139,20 @@ public:
     virtual bool isReplicaValid() const = 0;
     virtual bool waitForSource(int) = 0;
     virtual QRemoteObjectNode *node() const = 0;
+    //Takes ownership of storage, which replaces the QVariant based one
+    virtual void setStorage(QRemoteObjectReplicaStorage *storage) = 0;
+    virtual const QRemoteObjectReplicaStorage *storage() const = 0;
+    //Safe to call from any thread, see QRemoteObjectReplica::propertySnapshot()
+    virtual QVariantList propertySnapshot() const { return QVariantList(); }
+    //See QRemoteObjectReplica::setCallTimeout()
+    virtual void setCallTimeout(int) {}
+    virtual int callTimeout() const { return -1; }
 
     virtual void _q_send(QMetaObject::Call call, int index, const QVariantList &args) = 0;
     virtual QRemoteObjectPendingCall _q_sendWithReply(QMetaObject::Call call, int index, const QVariantList &args) = 0;
+    //See QRemoteObjectReplica::beginTypedSend()
+    virtual QDataStream *_q_beginTypedSend(int, bool) { return Q_NULLPTR; }
+    virtual QRemoteObjectPendingCall _q_endTypedSend() { return QRemoteObjectPendingCall(); }
 };
 
 class QStubReplicaPrivate : public QReplicaPrivateInterface
@@ -95,10 +168,13 @@ public:
     bool isReplicaValid() const Q_DECL_OVERRIDE { return false; }
     bool waitForSource(int) Q_DECL_OVERRIDE { return false; }
     QRemoteObjectNode *node() const Q_DECL_OVERRIDE { return Q_NULLPTR; }
+    void setStorage(QRemoteObjectReplicaStorage *storage) Q_DECL_OVERRIDE { m_storage.reset(storage); }
+    const QRemoteObjectReplicaStorage *storage() const Q_DECL_OVERRIDE { return m_storage.data(); }
 
     void _q_send(QMetaObject::Call call, int index, const QVariantList &args) Q_DECL_OVERRIDE;
     QRemoteObjectPendingCall _q_sendWithReply(QMetaObject::Call call, int index, const QVariantList &args) Q_DECL_OVERRIDE;
     QVariantList m_propertyStorage;
+    QScopedPointer<QRemoteObjectReplicaStorage> m_storage;
 };
 
 class QRemoteObjectReplicaPrivate : public QObject, public QReplicaPrivateInterface
@@ -116,8 +192,13 @@ public:
     virtual bool isInitialized() const Q_DECL_OVERRIDE { return true; }
     virtual bool isReplicaValid() const Q_DECL_OVERRIDE { return true; }
     virtual bool waitForSource(int) Q_DECL_OVERRIDE { return true; }
-    virtual bool waitForFinished(const QRemoteObjectPendingCall &, int) { return true; }
-    virtual void notifyAboutReply(int, const QVariant &) {}
+    virtual bool waitForFinished(const QRemoteObjectPendingCall &call, int timeout);
+    virtual void notifyAboutReply(int, const QVariant &, QRemoteObjectPendingCall::Error) {}
+    virtual void cancelPendingCall(int) {}
+    QRemoteObjectPendingCall createPendingCall(int serialId);
+    static void finishPendingCall(const QRemoteObjectPendingCall &call, const QVariant &returnValue,
+                                  QRemoteObjectPendingCall::Error error = QRemoteObjectPendingCall::NoError);
+    static void abandonPendingCall(const QRemoteObjectPendingCall &call);
     virtual void configurePrivate(QRemoteObjectReplica *);
     void emitValidChanged();
     void emitInitialized();
@@ -127,7 +208,7 @@ public:
     virtual QRemoteObjectPendingCall _q_sendWithReply(QMetaObject::Call call, int index, const QVariantList &args) Q_DECL_OVERRIDE = 0;
 
     //Dynamic replica functions
-    virtual void initializeMetaObject(const QMetaObjectBuilder &builder, const QVariantList &values);
+    virtual void initializeMetaObject(const QMetaObject *meta, const QVariantList &values);
 
     QString m_objectName;
     const QMetaObject *m_metaObject;
@@ -152,29 +233,67 @@ public:
     bool isInitialized() const Q_DECL_OVERRIDE;
     bool isReplicaValid() const Q_DECL_OVERRIDE;
     bool waitForSource(int timeout) Q_DECL_OVERRIDE;
-    void initialize(const QVariantList &values);
+    int markValid();
+    void setStorage(QRemoteObjectReplicaStorage *storage) Q_DECL_OVERRIDE;
+    const QRemoteObjectReplicaStorage *storage() const Q_DECL_OVERRIDE { return m_storage.data(); }
+    QVariantList propertySnapshot() const Q_DECL_OVERRIDE { return m_snapshots.load(); }
+    void publishSnapshot() { m_snapshots.publish(m_storage ? m_snapshotValues : m_propertyStorage); }
+    int propertyCount() const { return m_storage ? m_storage->propertyCount() : m_propertyStorage.size(); }
+    void storeProperty(int index, const QVariant &value);
+    void *propertyData(int index) { return m_storage ? m_storage->propertyData(index) : m_propertyStorage[index].data(); }
+    void initialize(const QVariantList &values, const QVector<int> *indexes = Q_NULLPTR);
+    void applyPropertyChange(int index, const QVariant &value, bool notify);
+    void applyPropertyChanges(const QVector<int> &indexes, const QVariantList &values);
+    void emitPropertyNotify(int index);
     void configurePrivate(QRemoteObjectReplica *) Q_DECL_OVERRIDE;
     void requestRemoteObjectSource();
     bool sendCommand();
     QRemoteObjectPendingCall sendCommandWithReply(int serialId);
-    bool waitForFinished(const QRemoteObjectPendingCall &call, int timeout) Q_DECL_OVERRIDE;
-    void notifyAboutReply(int ackedSerialId, const QVariant &value) Q_DECL_OVERRIDE;
-    void setConnection(ClientIoDevice *conn);
+    void notifyAboutReply(int ackedSerialId, const QVariant &value, QRemoteObjectPendingCall::Error error) Q_DECL_OVERRIDE;
+    void cancelPendingCall(int serialId) Q_DECL_OVERRIDE;
+    void setCallTimeout(int timeout) Q_DECL_OVERRIDE { m_callTimeout = timeout; }
+    int callTimeout() const Q_DECL_OVERRIDE { return m_callTimeout; }
+    void setConnection(ClientIoDevice *conn, int objectId, const QString &typeName, quint32 interfaceHash);
     void setDisconnected();
 
     void _q_send(QMetaObject::Call call, int index, const QVariantList &args) Q_DECL_OVERRIDE;
     QRemoteObjectPendingCall _q_sendWithReply(QMetaObject::Call call, int index, const QVariantList& args) Q_DECL_OVERRIDE;
+    QDataStream *_q_beginTypedSend(int index, bool withReply) Q_DECL_OVERRIDE;
+    QRemoteObjectPendingCall _q_endTypedSend() Q_DECL_OVERRIDE;
 
-    void initializeMetaObject(const QMetaObjectBuilder&, const QVariantList&) Q_DECL_OVERRIDE;
+    void initializeMetaObject(const QMetaObject*, const QVariantList&) Q_DECL_OVERRIDE;
     QAtomicInt isSet;
+    //Wakes the threads other than ours blocked in waitForSource()
+    QMutex m_validMutex;
+    QWaitCondition m_validCondition;
     QVector<QRemoteObjectReplica *> m_parentsNeedingConnect;
     QVariantList m_propertyStorage;
+    QScopedPointer<QRemoteObjectReplicaStorage> m_storage;
+    //The values held by m_storage, for the snapshots
+    QVariantList m_snapshotValues;
+    PropertySnapshots m_snapshots;
     QPointer<ClientIoDevice> connectionToSource;
+    int m_objectId;
+    QString m_typeName;
+    //Epoch of the source and sequence number of its latest property change applied here
+    QUuid m_sourceEpoch;
+    quint64 m_sequence;
+    //For a dynamic replica, the hash of the schema its meta object was built from
+    QByteArray m_schemaHash;
+    //Whether the source was generated from the same interface, see QCLASSINFO_REMOTEOBJECT_SIGNATURE
+    bool m_typedInvoke;
+    int m_typedSerialId;
 
     // pending call data
     int m_curSerialId;
     QHash<int, QRemoteObjectPendingCall> m_pendingCalls;
+    int m_callTimeout;
+    PendingCallTimeouts m_callTimeouts;
+    QBasicTimer m_callTimeoutTimer;
     QRemoteObjectPackets::DataStreamPacket m_packet;
+
+protected:
+    void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE;
 };
 
 class QInProcessReplicaPrivate : public QRemoteObjectReplicaPrivate
@@ -187,11 +306,16 @@ public:
     void setProperties(const QVariantList &) Q_DECL_OVERRIDE;
     void setProperty(int i, const QVariant &) Q_DECL_OVERRIDE;
     bool isShortCircuit() const Q_DECL_OVERRIDE { return true; }
+    //The properties are read from the source itself
+    void setStorage(QRemoteObjectReplicaStorage *storage) Q_DECL_OVERRIDE { delete storage; }
+    const QRemoteObjectReplicaStorage *storage() const Q_DECL_OVERRIDE { return Q_NULLPTR; }
 
     void _q_send(QMetaObject::Call call, int index, const QVariantList &args) Q_DECL_OVERRIDE;
     QRemoteObjectPendingCall _q_sendWithReply(QMetaObject::Call call, int index, const QVariantList& args) Q_DECL_OVERRIDE;
 
     QPointer<QRemoteObjectSource> connectionToSource;
+    //The calls to slots returning a future, until it finished
+    QHash<QFutureWatcherBase *, QRemoteObjectPendingCall> m_futureCalls;
 };
 
 QT_END_NAMESPACE
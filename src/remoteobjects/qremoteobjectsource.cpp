@@ -46,6 +46,10 @@
 #include "qremoteobjectsourceio_p.h"
 
 #include <QMetaProperty>
+#include <QMutex>
+#include <QThread>
+#include <QTimerEvent>
+#include <QtEndian>
 #include <QVarLengthArray>
 
 #include <algorithm>
@@ -55,22 +59,87 @@ QT_BEGIN_NAMESPACE
 
 using namespace QRemoteObjectPackets;
 
+//Future types slots may return, keyed by normalized type name
+struct FutureTypeRegistry
+{
+    QMutex mutex;
+    QHash<QByteArray, QPair<QtRemoteObjects::FutureWatcherFactory, QtRemoteObjects::FutureResultReader> > types;
+};
+Q_GLOBAL_STATIC(FutureTypeRegistry, futureTypes)
+
+/*!
+    \internal
+    Lets slots return the future type \a typeName. The remoting layer calls
+    \a watchFuture to wait for the future without blocking and \a futureResult
+    to get the value sent back to the replica. The generated source classes
+    register the futures used in their .rep file.
+*/
+void QtRemoteObjects::registerFutureType(const char *typeName, FutureWatcherFactory watchFuture,
+                                         FutureResultReader futureResult)
+{
+    FutureTypeRegistry *registry = futureTypes();
+    QMutexLocker locker(&registry->mutex);
+    registry->types.insert(QMetaObject::normalizedType(typeName), qMakePair(watchFuture, futureResult));
+}
+
+//Returns the methods listed in the QCLASSINFO_REMOTEOBJECT_THREADSAFE class
+//infos of meta, as "signature" or "signature:maxConcurrency"
+static QHash<QByteArray, int> threadSafeMethods(const QMetaObject *meta)
+{
+    QHash<QByteArray, int> methods;
+    for (int i = 0; i < meta->classInfoCount(); ++i) {
+        const QMetaClassInfo info = meta->classInfo(i);
+        if (qstrcmp(info.name(), QCLASSINFO_REMOTEOBJECT_THREADSAFE) != 0)
+            continue;
+        const QByteArray value(info.value());
+        const int colon = value.lastIndexOf(':');
+        const bool hasLimit = colon > value.lastIndexOf(')');
+        const QByteArray signature = QMetaObject::normalizedSignature(hasLimit ? value.left(colon).constData() : value.constData());
+        methods.insert(signature, hasLimit ? qMax(value.mid(colon + 1).trimmed().toInt(), 0) : 0);
+    }
+    return methods;
+}
+
 const int QRemoteObjectSource::qobjectPropertyOffset = QObject::staticMetaObject.propertyCount();
 const int QRemoteObjectSource::qobjectMethodOffset = QObject::staticMetaObject.methodCount();
 
 QRemoteObjectSource::QRemoteObjectSource(QObject *obj, const SourceApiMap *api,
                                          QObject *adapter, QRemoteObjectSourceIoAbstract *sourceIo)
-    : QObject(obj),
+    : QObject(Q_NULLPTR),
       m_object(obj),
       m_adapter(adapter),
       m_api(api),
-      m_sourceIo(sourceIo)
+      m_sourceIo(sourceIo),
+      m_objectId(-1),
+      m_cacheInitPackets(true),
+      m_epoch(QUuid::createUuid()),
+      m_sequence(0),
+      m_propertySequences(api->propertyCount(), 0),
+      m_isRegistry(api->name() == QLatin1String("Registry")),
+      m_objectDestroyed(0),
+      m_workersStarted(0)
 {
+    m_packet.setByteOrder(sourceIo->byteOrder());
+    m_foreignByteOrder.store(sourceIo->byteOrder());
     if (!obj) {
         qCWarning(QT_REMOTEOBJECT) << "QRemoteObjectSourcePrivate: Cannot replicate a NULL object" << m_api->name();
         return;
     }
 
+    //Not a child of obj, which may live in or be moved to another thread, as
+    //the timers and watchers of the source belong to the thread of the source IO
+    if (thread() != sourceIo->thread())
+        moveToThread(sourceIo->thread());
+    //Direct, so the source stops using obj as soon as it is destroyed, even in
+    //another thread. The source itself is still deleted in its own thread.
+    connect(obj, &QObject::destroyed, this, [this]() {
+        m_objectDestroyed.storeRelease(1);
+        if (QThread::currentThread() == thread())
+            delete this;
+        else
+            deleteLater();
+    }, Qt::DirectConnection);
+
     const QMetaObject *meta = obj->metaObject();
     for (int idx = 0; idx < m_api->signalCount(); ++idx) {
         const int sourceIndex = m_api->sourceSignalIndex(idx);
@@ -81,6 +150,12 @@ QRemoteObjectSource::QRemoteObjectSource(QObject *obj, const SourceApiMap *api,
         //
         //We know no one will inherit from this class, so no need to worry about indices from
         //derived classes.
+        //Resolved up front, as signals may be emitted in other threads than ours
+        QVector<int> parameterTypes;
+        for (int i = 0; i < m_api->signalParameterCount(idx); ++i)
+            parameterTypes << m_api->signalParameterType(idx, i);
+        m_signalParameterTypes << parameterTypes;
+
         const auto target = m_api->isAdapterSignal(idx) ? adapter : obj;
         if (!QMetaObject::connect(target, sourceIndex, this, QRemoteObjectSource::qobjectMethodOffset+idx, Qt::DirectConnection, 0)) {
             qCWarning(QT_REMOTEOBJECT) << "QRemoteObjectSourcePrivate: QMetaObject::connect returned false. Unable to connect.";
@@ -90,6 +165,46 @@ QRemoteObjectSource::QRemoteObjectSource(QObject *obj, const SourceApiMap *api,
         qCDebug(QT_REMOTEOBJECT) << "Connection made" << idx << meta->method(sourceIndex).name();
     }
 
+    //A cached Init packet is only dropped when a property notifies a change,
+    //so it can't be used if a property may change without telling
+    for (int idx = 0; idx < m_api->propertyCount(); ++idx) {
+        const auto target = m_api->isAdapterProperty(idx) ? adapter : obj;
+        const QMetaProperty mp = target->metaObject()->property(m_api->sourcePropertyIndex(idx));
+        if (!mp.hasNotifySignal() && !mp.isConstant()) {
+            m_cacheInitPackets = false;
+            break;
+        }
+    }
+    const QHash<QByteArray, int> objectThreadSafeMethods = threadSafeMethods(obj->metaObject());
+    const QHash<QByteArray, int> adapterThreadSafeMethods = adapter ? threadSafeMethods(adapter->metaObject()) : QHash<QByteArray, int>();
+    m_methods.reserve(m_api->methodCount());
+    for (int idx = 0; idx < m_api->methodCount(); ++idx) {
+        MethodDescriptor method;
+        method.index = m_api->sourceMethodIndex(idx);
+        method.forAdapter = m_api->isAdapterMethod(idx);
+        method.returnType = QMetaType::type(m_api->typeName(idx).constData());
+        if (!QMetaType(method.returnType).sizeOf())
+            method.returnType = QVariant::Invalid;
+        const QMetaMethod mm = (method.forAdapter ? adapter : obj)->metaObject()->method(method.index);
+        {
+            FutureTypeRegistry *registry = futureTypes();
+            QMutexLocker locker(&registry->mutex);
+            const auto future = registry->types.value(QMetaObject::normalizedType(mm.typeName()));
+            method.watchFuture = future.first;
+            method.futureResult = future.second;
+        }
+        if (method.returnType != QMetaType::type(mm.typeName())) //The API doesn't return the future itself
+            method.watchFuture = Q_NULLPTR;
+        const QHash<QByteArray, int> &threadSafe = method.forAdapter ? adapterThreadSafeMethods : objectThreadSafeMethods;
+        method.threadSafe = !m_isRegistry && threadSafe.contains(mm.methodSignature());
+        method.maxConcurrency = threadSafe.value(mm.methodSignature());
+        method.parameterTypes.reserve(mm.parameterCount());
+        for (int i = 0; i < mm.parameterCount(); ++i)
+            method.parameterTypes << mm.parameterType(i);
+        m_methods << method;
+    }
+    m_schemaHash = schemaHash(this);
+
     m_sourceIo->registerSource(this);
 }
 
@@ -105,19 +220,20 @@ QRemoteObjectSource::~QRemoteObjectSource()
 QVariantList* QRemoteObjectSource::marshalArgs(int index, void **a)
 {
     QVariantList &list = m_marshalledArgs;
-    const int N = m_api->signalParameterCount(index);
+    const QVector<int> &types = m_signalParameterTypes.at(index);
+    const int N = types.size();
     if (list.size() < N)
         list.reserve(N);
     const int minFill = std::min(list.size(), N);
     for (int i = 0; i < minFill; ++i) {
-        const int type = m_api->signalParameterType(index, i);
+        const int type = types.at(i);
         if (type == QMetaType::QVariant)
             list[i] = *reinterpret_cast<QVariant *>(a[i + 1]);
         else
             list[i] = QVariant(type, a[i + 1]);
     }
     for (int i = list.size(); i < N; ++i) {
-        const int type = m_api->signalParameterType(index, i);
+        const int type = types.at(i);
         if (type == QMetaType::QVariant)
             list << *reinterpret_cast<QVariant *>(a[i + 1]);
         else
@@ -158,26 +274,111 @@ bool QRemoteObjectSource::invoke(QMetaObject::Call c, bool forAdapter, int index
             param[i] = const_cast<void*>(args.at(i).data());
         }
     }
+    if (isObjectDestroyed())
+        return false;
+
     int r = -1;
     if (forAdapter)
         r = m_adapter->qt_metacall(c, index, param.data());
     else
-        r = parent()->qt_metacall(c, index, param.data());
+        r = m_object->qt_metacall(c, index, param.data());
     return r == -1 && status == -1;
 }
 
+//Calls method index of the API with the arguments of an InvokeTypedPacket. The
+//repc generated API reads them directly, otherwise they are loaded one by one
+//with the stream operators of the parameter types.
+bool QRemoteObjectSource::invokeTyped(int index, QDataStream &in, QVariant *returnValue)
+{
+    const MethodDescriptor *method = this->method(index);
+    Q_ASSERT(method);
+    if (!method->forAdapter && m_api->invokeTyped(m_object, index, in, returnValue))
+        return true;
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    QVariantList args;
+    if (!readArguments(index, in, args))
+        return false;
+    return invoke(QMetaObject::InvokeMetaMethod, method->forAdapter, method->index, args, returnValue);
+}
+
+//Loads the arguments of method index of the API from an InvokeTypedPacket,
+//with the stream operators of the parameter types
+bool QRemoteObjectSource::readArguments(int index, QDataStream &in, QVariantList &args)
+{
+    const MethodDescriptor *method = this->method(index);
+    Q_ASSERT(method);
+    args.reserve(method->parameterTypes.size());
+    for (int i = 0; i < method->parameterTypes.size(); ++i) {
+        QVariant arg(method->parameterTypes.at(i), Q_NULLPTR);
+        if (!QMetaType::load(in, arg.userType(), arg.data()) || in.status() != QDataStream::Ok) {
+            qCWarning(QT_REMOTEOBJECT) << "Unable to read argument" << i << "of" << m_api->methodSignature(index);
+            return false;
+        }
+        args << arg;
+    }
+    return true;
+}
+
+QFutureWatcherBase *QRemoteObjectSource::watchFuture(const MethodDescriptor *method, const QVariant &returnValue)
+{
+    Q_ASSERT(method->watchFuture);
+    QFutureWatcherBase *watcher = method->watchFuture(returnValue.constData());
+    watcher->setParent(this);
+    return watcher;
+}
+
 void QRemoteObjectSource::handleMetaCall(int index, QMetaObject::Call call, void **a)
 {
-    if (listeners.empty())
+    if (QThread::currentThread() != m_sourceIo->thread()) {
+        handleForeignMetaCall(index, a);
         return;
+    }
 
     int propertyIndex = m_api->propertyIndexFromSignal(index);
+    if (propertyIndex >= 0) {
+        m_initPacket.clear();
+        m_initDynamicPacket.clear();
+        m_initDynamicValuesPacket.clear();
+        m_propertySequences[m_api->propertyRawIndexFromSignal(index)] = ++m_sequence;
+    }
+
+    if (listeners.empty())
+        return;
+
+    if (propertyIndex >= 0 && m_sourceIo->isPropertyChangeCoalescingEnabled()) {
+        //A batch only holds values, the replica emits the notify signals from
+        //them. Other notify signals are sent as they are.
+        const QObject *target = m_api->isAdapterProperty(index) ? m_adapter : m_object;
+        if (notifiesValueOnly(index, target->metaObject()->property(propertyIndex))) {
+            //Only remember which property changed, the value is read when the batch
+            //is sent, so the latest value wins
+            const int rawIndex = m_api->propertyRawIndexFromSignal(index);
+            if (!m_dirtyProperties.contains(rawIndex))
+                m_dirtyProperties.append(rawIndex);
+            if (!m_flushTimer.isActive())
+                m_flushTimer.start(0, this);
+            return;
+        }
+    }
+
+    //Anything else has to reach the replicas after the changes queued so far
+    flushPropertyChanges();
+
     if (propertyIndex >= 0) {
         const int rawIndex = m_api->propertyRawIndexFromSignal(index);
         const auto target = m_api->isAdapterProperty(index) ? m_adapter : m_object;
         const QMetaProperty mp = target->metaObject()->property(propertyIndex);
         qCDebug(QT_REMOTEOBJECT) << "Sending Invoke Property" << (m_api->isAdapterSignal(index) ? "via adapter" : "") << rawIndex << propertyIndex << mp.name() << mp.read(target);
-        serializePropertyChangePacket(m_packet, m_api->name(), rawIndex, serializedProperty(mp, target));
+        if (notifiesValueOnly(index, mp)) {
+            serializePropertyChangePacket(m_packet, m_objectId, rawIndex, serializedProperty(mp, target), m_sequence, true);
+            Q_FOREACH (ServerIoDevice *io, listeners)
+                io->write(m_packet.array, m_packet.size);
+            m_sourceIo->trackPayloads(m_packet, listeners);
+            return;
+        }
+        serializePropertyChangePacket(m_packet, m_objectId, rawIndex, serializedProperty(mp, target), m_sequence);
         m_packet.baseAddress = m_packet.size;
         propertyIndex = rawIndex;
     }
@@ -185,29 +386,178 @@ void QRemoteObjectSource::handleMetaCall(int index, QMetaObject::Call call, void
     qCDebug(QT_REMOTEOBJECT) << "# Listeners" << listeners.length();
     qCDebug(QT_REMOTEOBJECT) << "Invoke args:" << m_object << call << index << marshalArgs(index, a);
 
-    serializeInvokePacket(m_packet, m_api->name(), call, index, *marshalArgs(index, a), -1, propertyIndex);
+    serializeInvokePacket(m_packet, m_objectId, call, index, *marshalArgs(index, a), -1, propertyIndex);
     m_packet.baseAddress = 0;
 
     Q_FOREACH (ServerIoDevice *io, listeners)
         io->write(m_packet.array, m_packet.size);
+    m_sourceIo->trackPayloads(m_packet, listeners);
 }
 
-void QRemoteObjectSource::addListener(ServerIoDevice *io, bool dynamic)
+//If the notify signal index of property mp carries nothing but the new value,
+//the replica can emit it from the stored property and no InvokePacket is needed
+bool QRemoteObjectSource::notifiesValueOnly(int index, const QMetaProperty &mp) const
 {
+    const int parameterCount = m_api->signalParameterCount(index);
+    return parameterCount == 0 || (parameterCount == 1 && mp.userType() != QMetaType::QVariant
+                                   && m_api->signalParameterType(index, 0) == mp.userType());
+}
+
+//Called for the signals of an object living in another thread than the
+//sourceIo. The packet is serialized here, in the thread of the object, and
+//queued to the sourceIo, which gives it a sequence number and writes it.
+//Property changes aren't coalesced and values are never sent out of band.
+void QRemoteObjectSource::handleForeignMetaCall(int index, void **a)
+{
+    const int propertyIndex = m_api->propertyIndexFromSignal(index);
+    const bool hasListeners = m_listenerCount.load();
+    if (propertyIndex < 0 && !hasListeners)
+        return;
+
+    QueuedSourcePacket *packet = new QueuedSourcePacket;
+    packet->objectId = m_objectId;
+    packet->rawPropertyIndex = propertyIndex >= 0 ? m_api->propertyRawIndexFromSignal(index) : -1;
+    packet->sequenceOffset = -1;
+    packet->byteOrder = QDataStream::ByteOrder(m_foreignByteOrder.load());
+    if (hasListeners) {
+        DataStreamPacket ds;
+        ds.setByteOrder(packet->byteOrder);
+        int invokePropertyIndex = -1;
+        bool needsInvoke = true;
+        if (propertyIndex >= 0) {
+            const auto target = m_api->isAdapterProperty(index) ? m_adapter : m_object;
+            const QMetaProperty mp = target->metaObject()->property(propertyIndex);
+            const int parameterCount = m_signalParameterTypes.at(index).size();
+            needsInvoke = !(parameterCount == 0 || (parameterCount == 1 && mp.userType() != QMetaType::QVariant
+                                                    && m_signalParameterTypes.at(index).at(0) == mp.userType()));
+            serializePropertyChangePacket(ds, m_objectId, packet->rawPropertyIndex, serializedProperty(mp, target), 0, !needsInvoke);
+            packet->sequenceOffset = ds.size - int(sizeof(quint64));
+            ds.baseAddress = ds.size;
+            invokePropertyIndex = packet->rawPropertyIndex;
+        }
+        if (needsInvoke) {
+            QVariantList args;
+            const QVector<int> &types = m_signalParameterTypes.at(index);
+            for (int i = 0; i < types.size(); ++i)
+                args << (types.at(i) == QMetaType::QVariant ? *reinterpret_cast<QVariant *>(a[i + 1]) : QVariant(types.at(i), a[i + 1]));
+            serializeInvokePacket(ds, m_objectId, QMetaObject::InvokeMetaMethod, index, args, -1, invokePropertyIndex);
+        }
+        ds.array.truncate(ds.size);
+        packet->data = ds.array;
+    }
+    m_sourceIo->queuePacket(packet);
+}
+
+//Does what handleMetaCall() does with a packet of handleForeignMetaCall()
+void QRemoteObjectSource::sendQueuedPacket(QueuedSourcePacket *packet)
+{
+    if (packet->rawPropertyIndex >= 0) {
+        m_initPacket.clear();
+        m_initDynamicPacket.clear();
+        m_initDynamicValuesPacket.clear();
+        m_propertySequences[packet->rawPropertyIndex] = ++m_sequence;
+        if (packet->sequenceOffset >= 0) {
+            uchar *sequence = reinterpret_cast<uchar *>(packet->data.data() + packet->sequenceOffset);
+            if (packet->byteOrder == QDataStream::LittleEndian)
+                qToLittleEndian<quint64>(m_sequence, sequence);
+            else
+                qToBigEndian<quint64>(m_sequence, sequence);
+        }
+    }
+
+    if (listeners.isEmpty() || packet->data.isEmpty())
+        return;
+
+    flushPropertyChanges();
+    Q_FOREACH (ServerIoDevice *io, listeners)
+        io->write(packet->data, packet->data.size());
+}
+
+void QRemoteObjectSource::flushPropertyChanges()
+{
+    if (m_dirtyProperties.isEmpty())
+        return;
+
+    m_flushTimer.stop();
+    if (!listeners.isEmpty() && !isObjectDestroyed()) {
+        qCDebug(QT_REMOTEOBJECT) << "Sending PropertyChangeBatch" << m_api->name() << m_dirtyProperties;
+        serializePropertyChangeBatchPacket(m_packet, this, m_dirtyProperties);
+        Q_FOREACH (ServerIoDevice *io, listeners)
+            io->write(m_packet.array, m_packet.size);
+        m_sourceIo->trackPayloads(m_packet, listeners);
+    }
+    m_dirtyProperties.clear();
+}
+
+void QRemoteObjectSource::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() == m_flushTimer.timerId())
+        flushPropertyChanges();
+    else
+        QObject::timerEvent(event);
+}
+
+//The cached Init packets were encoded in the previous byte order
+void QRemoteObjectSource::setByteOrder(QDataStream::ByteOrder byteOrder)
+{
+    m_packet.setByteOrder(byteOrder);
+    m_foreignByteOrder.store(byteOrder);
+    m_initPacket.clear();
+    m_initDynamicPacket.clear();
+    m_initDynamicValuesPacket.clear();
+    m_initDynamicSchema = InitDynamicSchema();
+}
+
+void QRemoteObjectSource::addListener(ServerIoDevice *io, bool dynamic, const QByteArray &schemaHash, const QUuid &epoch, quint64 sequence)
+{
+    //The Init packet carries the current values, don't follow it with a batch of stale changes
+    flushPropertyChanges();
     listeners.append(io);
+    m_listenerCount.store(listeners.size());
+
+    //A replica that was attached to us before only needs what changed since.
+    //A dynamic one gets the same Init packet, once it has a meta object for
+    //our schema.
+    const bool knowsSchema = !dynamic || schemaHash == m_schemaHash;
+    if (knowsSchema && !epoch.isNull() && epoch == m_epoch && sequence <= m_sequence) {
+        QVector<int> changed;
+        for (int i = 0; i < m_propertySequences.size(); ++i) {
+            if (m_propertySequences.at(i) > sequence)
+                changed.append(i);
+        }
+        qCDebug(QT_REMOTEOBJECT) << "Resuming" << m_api->name() << "from" << sequence << "changed properties" << changed;
+        serializeInitPacket(m_packet, this, &changed);
+        io->write(m_packet.array, m_packet.size);
+        m_sourceIo->trackPayloads(m_packet, QVector<ServerIoDevice*>() << io);
+        return;
+    }
+
+    //A dynamic replica with a meta object for our schema only needs the values
+    const bool withSchema = schemaHash.isEmpty() || schemaHash != m_schemaHash;
+    QByteArray &initPacket = !dynamic ? m_initPacket : withSchema ? m_initDynamicPacket : m_initDynamicValuesPacket;
+    if (!initPacket.isEmpty()) {
+        io->write(initPacket);
+        return;
+    }
 
     if (dynamic) {
-        serializeInitDynamicPacket(m_packet, this);
+        serializeInitDynamicPacket(m_packet, this, &m_initDynamicSchema, withSchema);
         io->write(m_packet.array, m_packet.size);
     } else {
         serializeInitPacket(m_packet, this);
         io->write(m_packet.array, m_packet.size);
     }
+    //Values passed out of band are released by the replicas that got them,
+    //so such a packet can't be handed to later ones
+    if (m_cacheInitPackets && m_packet.size > 0 && m_packet.payloads.isEmpty())
+        initPacket = QByteArray(m_packet.array.constData(), m_packet.size);
+    m_sourceIo->trackPayloads(m_packet, QVector<ServerIoDevice*>() << io);
 }
 
 int QRemoteObjectSource::removeListener(ServerIoDevice *io, bool shouldSendRemove)
 {
     listeners.removeAll(io);
+    m_listenerCount.store(listeners.size());
     if (shouldSendRemove)
     {
         serializeRemoveObjectPacket(m_packet, m_api->name());
@@ -281,6 +631,11 @@ const QByteArray DynamicApiMap::signature(int objectIndex) const
     return m_cachedMetamethod.methodSignature();
 }
 
+quint32 DynamicApiMap::interfaceHash() const
+{
+    return QRemoteObjectPackets::interfaceHash(m_metaObject);
+}
+
 QMetaMethod::MethodType DynamicApiMap::methodType(int index) const
 {
     const int objectIndex = m_methods.at(index);
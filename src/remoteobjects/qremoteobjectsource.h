@@ -45,6 +45,7 @@
 #include <QtCore/QScopedPointer>
 #include <QtRemoteObjects/qtremoteobjectglobal.h>
 #include <QtCore/QMetaMethod>
+#include <QtCore/QFutureWatcher>
 
 QT_BEGIN_NAMESPACE
 
@@ -123,6 +124,49 @@ static inline int qtro_method_index(Func1, Func2, const char *methodName, int *c
     return ObjectType::staticMetaObject.indexOfMethod(methodName);
 }
 
+//Used by QtRemoteObjects::registerFutureType() to wait for a QFuture<T> returned by a slot
+template <typename T>
+QFutureWatcherBase *qtro_watch_future(const void *future)
+{
+    QFutureWatcher<T> *watcher = new QFutureWatcher<T>;
+    watcher->setFuture(*static_cast<const QFuture<T> *>(future));
+    return watcher;
+}
+
+template <typename T>
+QVariant qtro_future_result(const QFutureWatcherBase *watcher)
+{
+    const QFuture<T> future = static_cast<const QFutureWatcher<T> *>(watcher)->future();
+    if (future.isCanceled() || !future.resultCount())
+        return QVariant();
+    return QVariant::fromValue(future.result());
+}
+
+template <>
+inline QVariant qtro_future_result<void>(const QFutureWatcherBase *)
+{
+    return QVariant();
+}
+
+namespace QtRemoteObjects {
+
+typedef QFutureWatcherBase *(*FutureWatcherFactory)(const void *future);
+typedef QVariant (*FutureResultReader)(const QFutureWatcherBase *watcher);
+
+Q_REMOTEOBJECTS_EXPORT void registerFutureType(const char *typeName, FutureWatcherFactory watchFuture,
+                                               FutureResultReader futureResult);
+
+//Source slots returning QFuture<T> reply to the replica once the future has
+//finished, instead of when the slot returns
+template <typename T>
+void registerFutureType(const char *typeName)
+{
+    qRegisterMetaType<QFuture<T> >(typeName);
+    registerFutureType(typeName, &qtro_watch_future<T>, &qtro_future_result<T>);
+}
+
+}
+
 class SourceApiMap
 {
 protected:
@@ -151,6 +195,12 @@ public:
     virtual bool isAdapterSignal(int) const { return false; }
     virtual bool isAdapterMethod(int) const { return false; }
     virtual bool isAdapterProperty(int) const { return false; }
+    //Hash repc computed for the interface, see QCLASSINFO_REMOTEOBJECT_SIGNATURE.
+    //Replicas generated from the same interface send typed Invoke packets.
+    virtual quint32 interfaceHash() const { return 0; }
+    //Reads the arguments of method index straight from in and calls it on
+    //object, returns false if the arguments have to be decoded generically
+    virtual bool invokeTyped(QObject *, int, QDataStream &, QVariant *) const { return false; }
 };
 
 QT_END_NAMESPACE
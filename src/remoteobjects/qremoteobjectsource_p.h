@@ -42,10 +42,17 @@
 #ifndef QREMOTEOBJECTSOURCE_P_H
 #define QREMOTEOBJECTSOURCE_P_H
 
+#include <QAtomicInt>
+#include <QBasicTimer>
 #include <QObject>
+#include <QQueue>
+#include <QRunnable>
 #include <QMetaObject>
 #include <QMetaProperty>
+#include <QMutex>
+#include <QUuid>
 #include <QVector>
+#include <QWaitCondition>
 #include "qremoteobjectsource.h"
 #include "qremoteobjectpacket_p.h"
 
@@ -54,6 +61,7 @@ QT_BEGIN_NAMESPACE
 class QRemoteObjectSourceIo;
 class QRemoteObjectSourceIoAbstract;
 class ServerIoDevice;
+struct QueuedSourcePacket;
 
 class QRemoteObjectSource : public QObject
 {
@@ -65,20 +73,93 @@ public:
 
     int qt_metacall(QMetaObject::Call call, int methodId, void **a);
     QVector<ServerIoDevice*> listeners;
+    //Size of listeners and byte order of m_packet, for signals emitted in other threads
+    QAtomicInt m_listenerCount;
+    QAtomicInt m_foreignByteOrder;
     QObject *m_object, *m_adapter;
     const SourceApiMap * const m_api;
     QRemoteObjectSourceIoAbstract *m_sourceIo;
+    int m_objectId;
     QRemoteObjectPackets::DataStreamPacket m_packet;
     QVariantList m_marshalledArgs;
+    QVector<int> m_dirtyProperties;
+    QBasicTimer m_flushTimer;
+    //Init packets are shared by the replicas joining between two property changes
+    QByteArray m_initPacket;
+    QByteArray m_initDynamicPacket;
+    QByteArray m_initDynamicValuesPacket;
+    QRemoteObjectPackets::InitDynamicSchema m_initDynamicSchema;
+    bool m_cacheInitPackets;
+    //Dynamic replicas pass it back when they already know our signals, methods and properties
+    QByteArray m_schemaHash;
+    //Identifies this source to replicas resuming after a reconnect, see addListener()
+    QUuid m_epoch;
+    //Sequence number of the latest property change, and of the latest change of each property
+    quint64 m_sequence;
+    QVector<quint64> m_propertySequences;
+    //Everything needed to call a method of the API, resolved once by the constructor
+    struct MethodDescriptor
+    {
+        int index; //In the meta object of the object or of the adapter
+        bool forAdapter;
+        int returnType; //QVariant::Invalid if nothing is returned
+        QVector<int> parameterTypes;
+        //Set if the method returns a future registered with QtRemoteObjects::registerFutureType()
+        QtRemoteObjects::FutureWatcherFactory watchFuture;
+        QtRemoteObjects::FutureResultReader futureResult;
+        //Set for the methods listed in QCLASSINFO_REMOTEOBJECT_THREADSAFE, which run on the worker pool
+        bool threadSafe;
+        int maxConcurrency; //0 if only the size of the pool limits it
+    };
+    QVector<MethodDescriptor> m_methods;
+    QVector<QVector<int> > m_signalParameterTypes;
+    //Invocations of a thread safe method running on the worker pool, and those
+    //waiting for one of them to finish because of its maxConcurrency
+    struct WorkerQueue
+    {
+        WorkerQueue() : running(0) {}
+        int running;
+        QQueue<QRunnable *> queued;
+    };
+    QHash<int, WorkerQueue> m_workerQueues;
+    //Invocations handed to the worker pool and not done with the source yet,
+    //which unregistering the source waits for
+    QMutex m_workerMutex;
+    QWaitCondition m_workerDone;
+    int m_workersStarted;
+    bool m_isRegistry;
+    //Set in the thread destroying the object, until the source is deleted in ours
+    QAtomicInt m_objectDestroyed;
+    bool isObjectDestroyed() const { return m_objectDestroyed.loadAcquire(); }
     bool hasAdapter() const { return m_adapter; }
+    //Returns Q_NULLPTR if index isn't a method of the API
+    const MethodDescriptor *method(int index) const
+    {
+        if (index < 0 || index >= m_methods.size() || m_methods.at(index).index < 0)
+            return Q_NULLPTR;
+        return &m_methods.at(index);
+    }
 
     QVariantList* marshalArgs(int index, void **a);
     void handleMetaCall(int index, QMetaObject::Call call, void **a);
-    void addListener(ServerIoDevice *io, bool dynamic = false);
+    void handleForeignMetaCall(int index, void **a);
+    bool notifiesValueOnly(int index, const QMetaProperty &mp) const;
+    void sendQueuedPacket(QueuedSourcePacket *packet);
+    void flushPropertyChanges();
+    void setByteOrder(QDataStream::ByteOrder byteOrder);
+    void addListener(ServerIoDevice *io, bool dynamic = false, const QByteArray &schemaHash = QByteArray(),
+                     const QUuid &epoch = QUuid(), quint64 sequence = 0);
     int removeListener(ServerIoDevice *io, bool shouldSendRemove = false);
     bool invoke(QMetaObject::Call c, bool forAdapter, int index, const QVariantList& args, QVariant* returnValue = Q_NULLPTR);
+    bool invokeTyped(int index, QDataStream &in, QVariant *returnValue);
+    bool readArguments(int index, QDataStream &in, QVariantList &args);
+    //Watches the future returnValue holds, the watcher is deleted along with the source
+    QFutureWatcherBase *watchFuture(const MethodDescriptor *method, const QVariant &returnValue);
     static const int qobjectPropertyOffset;
     static const int qobjectMethodOffset;
+
+protected:
+    void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE;
 };
 
 class DynamicApiMap : public SourceApiMap
@@ -130,6 +211,7 @@ public:
         return -1;
     }
     bool isDynamic() const Q_DECL_OVERRIDE { return true; }
+    quint32 interfaceHash() const Q_DECL_OVERRIDE;
 private:
     int parameterCount(int objectIndex) const;
     int parameterType(int objectIndex, int paramIndex) const;
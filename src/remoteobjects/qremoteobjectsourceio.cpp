@@ -49,7 +49,10 @@
 #include "qconnection_tcpip_backend_p.h"
 #include "qconnection_local_backend_p.h"
 
+#include <QFutureWatcher>
+#include <QPointer>
 #include <QStringList>
+#include <QThread>
 
 QT_BEGIN_NAMESPACE
 
@@ -58,8 +61,18 @@ using namespace QtRemoteObjects;
 
 QRemoteObjectSourceIoAbstract::QRemoteObjectSourceIoAbstract(QObject *parent)
     : QObject(parent)
+    , m_coalescePropertyChanges(false)
+    , m_payloadThreshold(0)
+    , m_maxQueuedBytes(0)
+    , m_maxQueuedPackets(0)
+    , m_overflowPolicy(ServerIoDevice::DropSignals)
+    , m_byteOrder(wireByteOrder(localCapabilities()))
+    , m_runningInvocations(0)
+    , m_queuedInvocations(0)
 {
-
+    m_packet.setByteOrder(m_byteOrder);
+    if (ThreadedPacketReader::isEnabled())
+        m_packetReader.reset(new ThreadedPacketReader(this));
 }
 
 QRemoteObjectSourceIo::QRemoteObjectSourceIo(const QUrl &address, QObject *parent)
@@ -85,6 +98,8 @@ QRemoteObjectSourceIo::QRemoteObjectSourceIo(const QUrl &address, QObject *paren
 QRemoteObjectSourceIoAbstract::~QRemoteObjectSourceIoAbstract()
 {
     qDeleteAll(m_remoteObjects.values());
+    Q_FOREACH (const QString &name, m_payloadReaders.keys())
+        releaseOutOfBandPayload(name);
 }
 
 QUrl QRemoteObjectSourceIoAbstract::serverAddress() const
@@ -115,8 +130,8 @@ bool QRemoteObjectSourceIoAbstract::enableRemoting(QObject *object, const Source
         return false;
     }
 
-    new QRemoteObjectSource(object, api, adapter, this);
-    serializeObjectListPacket(m_packet, {QRemoteObjectPackets::ObjectInfo{api->name(), api->typeName()}});
+    QRemoteObjectSource *pp = new QRemoteObjectSource(object, api, adapter, this);
+    serializeObjectListPacket(m_packet, {QRemoteObjectPackets::ObjectInfo{api->name(), api->typeName(), pp->m_objectId, api->interfaceHash()}});
     foreach (ServerIoDevice *conn, connections())
         conn->write(m_packet.array, m_packet.size);
     if (const int count = connections().size())
@@ -134,96 +149,504 @@ bool QRemoteObjectSourceIoAbstract::disableRemoting(QObject *object)
     return true;
 }
 
+void QRemoteObjectSourceIoAbstract::setPropertyChangeCoalescingEnabled(bool enabled)
+{
+    m_coalescePropertyChanges = enabled;
+    if (!enabled) {
+        Q_FOREACH (QRemoteObjectSource *pp, m_remoteObjects)
+            pp->flushPropertyChanges();
+    }
+}
+
+void QRemoteObjectSourceIoAbstract::setOutOfBandPayloadThreshold(int threshold)
+{
+    m_payloadThreshold = supportsOutOfBandPayloads() ? qMax(threshold, 0) : 0;
+    m_packet.payloadThreshold = m_payloadThreshold;
+    Q_FOREACH (QRemoteObjectSource *pp, m_remoteObjects)
+        pp->m_packet.payloadThreshold = m_payloadThreshold;
+}
+
+//Takes over the segments created while writing packet to readers. A segment
+//is removed once every reader released it, or right away if nobody got it.
+void QRemoteObjectSourceIoAbstract::trackPayloads(QRemoteObjectPackets::DataStreamPacket &packet, const QVector<ServerIoDevice*> &readers)
+{
+    if (packet.payloads.isEmpty())
+        return;
+
+    Q_FOREACH (const QString &name, packet.payloads) {
+        if (readers.isEmpty() || packet.size == 0) {
+            releaseOutOfBandPayload(name);
+            continue;
+        }
+        QSet<ServerIoDevice*> &pending = m_payloadReaders[name];
+        Q_FOREACH (ServerIoDevice *reader, readers)
+            pending.insert(reader);
+    }
+    packet.payloads.clear();
+}
+
+void QRemoteObjectSourceIoAbstract::releasePayload(ServerIoDevice *reader, const QString &name)
+{
+    auto it = m_payloadReaders.find(name);
+    if (it == m_payloadReaders.end()) {
+        qROWarning(this) << "Release of unknown out of band payload" << name;
+        return;
+    }
+    it->remove(reader);
+    if (it->isEmpty()) {
+        releaseOutOfBandPayload(name);
+        m_payloadReaders.erase(it);
+    }
+}
+
+void QRemoteObjectSourceIoAbstract::releasePayloads(ServerIoDevice *reader)
+{
+    auto it = m_payloadReaders.begin();
+    while (it != m_payloadReaders.end()) {
+        it->remove(reader);
+        if (it->isEmpty()) {
+            releaseOutOfBandPayload(it.key());
+            it = m_payloadReaders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void QRemoteObjectSourceIoAbstract::setSendQueueLimits(qint64 maxBytes, int maxPackets)
+{
+    m_maxQueuedBytes = maxBytes;
+    m_maxQueuedPackets = maxPackets;
+    Q_FOREACH (ServerIoDevice *conn, connections())
+        conn->setSendQueueLimits(maxBytes, maxPackets);
+}
+
+void QRemoteObjectSourceIoAbstract::setSendQueuePolicy(ServerIoDevice::OverflowPolicy policy)
+{
+    m_overflowPolicy = policy;
+    Q_FOREACH (ServerIoDevice *conn, connections())
+        conn->setOverflowPolicy(policy);
+}
+
+//Applies the send queue settings to a new connection, and offers it our capabilities
+void QRemoteObjectSourceIoAbstract::configureConnection(ServerIoDevice *connection)
+{
+    connection->setSendQueueLimits(m_maxQueuedBytes, m_maxQueuedPackets);
+    connection->setOverflowPolicy(m_overflowPolicy);
+    connect(connection, &ServerIoDevice::congestionChanged, this, &QRemoteObjectSourceIoAbstract::onCongestionChanged);
+    serializeHandshakePacket(m_packet, localCapabilities());
+    connection->write(m_packet.array, m_packet.size);
+}
+
+//Packets are shared between connections, so they are only little endian
+//while no connection asked for big endian ones. Connections that haven't
+//answered the Handshake yet decode either.
+void QRemoteObjectSourceIoAbstract::updateByteOrder()
+{
+    const QDataStream::ByteOrder order = m_bigEndianConnections.isEmpty() ? wireByteOrder(localCapabilities())
+                                                                          : QDataStream::BigEndian;
+    if (order == m_byteOrder)
+        return;
+    qRODebug(this) << "Switching to" << (order == QDataStream::LittleEndian ? "little" : "big") << "endian packets";
+    m_byteOrder = order;
+    m_packet.setByteOrder(order);
+    Q_FOREACH (QRemoteObjectSource *pp, m_remoteObjects)
+        pp->setByteOrder(order);
+}
+
+//Forgets everything that was kept for a connection that went away
+void QRemoteObjectSourceIoAbstract::connectionClosed(ServerIoDevice *connection)
+{
+    if (m_packetReader)
+        m_packetReader->reset(connection);
+    releasePayloads(connection);
+    if (m_congestedConnections.remove(connection))
+        emit congestedConnectionsChanged(m_congestedConnections.size());
+    if (m_bigEndianConnections.remove(connection))
+        updateByteOrder();
+    //Nobody waits for the replies anymore
+    Q_FOREACH (const QPointer<QFutureWatcherBase> &watcher, m_cancelableCalls.take(connection)) {
+        if (watcher)
+            watcher->cancel();
+    }
+}
+
+void QRemoteObjectSourceIoAbstract::onCongestionChanged(bool congested)
+{
+    ServerIoDevice *connection = qobject_cast<ServerIoDevice*>(sender());
+    if (congested) {
+        qROWarning(this) << "Send queue of a connection is full, the replicas on it don't keep up";
+        m_congestedConnections.insert(connection);
+    } else {
+        qRODebug(this) << "Send queue of a connection drained";
+        m_congestedConnections.remove(connection);
+    }
+    emit congestedConnectionsChanged(m_congestedConnections.size());
+}
+
+void QRemoteObjectSourceIoAbstract::sendInvokeReply(QRemoteObjectSource *pp, ServerIoDevice *connection, int serialId, const QVariant &returnValue,
+                                                    QRemoteObjectPendingCall::Error error)
+{
+    //Property changes made by the call have to arrive before the reply
+    pp->flushPropertyChanges();
+    serializeInvokeReplyPacket(m_packet, pp->m_objectId, serialId, returnValue, error);
+    connection->write(m_packet.array, m_packet.size);
+    trackPayloads(m_packet, QVector<ServerIoDevice*>() << connection);
+}
+
+//Sends the reply to an invoke if one is wanted. When the method returned a
+//future, the reply is sent once it finishes and other packets are handled
+//in the meantime.
+void QRemoteObjectSourceIoAbstract::handleInvokeResult(QRemoteObjectSource *pp, int index, ServerIoDevice *connection, int serialId, const QVariant &returnValue)
+{
+    const QRemoteObjectSource::MethodDescriptor *method = pp->method(index);
+    if (!method->watchFuture) {
+        if (serialId >= 0)
+            sendInvokeReply(pp, connection, serialId, returnValue);
+        return;
+    }
+
+    QFutureWatcherBase *watcher = pp->watchFuture(method, returnValue);
+    QPointer<ServerIoDevice> replyTo(connection);
+    const QtRemoteObjects::FutureResultReader futureResult = method->futureResult;
+    trackCall(connection, pp->m_objectId, serialId, watcher);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, pp, watcher, replyTo, serialId, futureResult]() {
+        watcher->deleteLater();
+        if (serialId < 0 || !replyTo || !untrackCall(replyTo, pp->m_objectId, serialId))
+            return;
+        qRODebug(this) << "Deferred reply ready for" << pp->m_api->name() << "serialId" << serialId;
+        sendInvokeReply(pp, replyTo, serialId, futureResult(watcher));
+    });
+}
+
+//Calls a thread safe method of a source on the worker pool
+class WorkerInvocation : public QRunnable
+{
+public:
+    WorkerInvocation(QRemoteObjectSource *source, const QRemoteObjectSource::MethodDescriptor &method, const QVariantList &args, qint64 deadline)
+        : m_source(source)
+        , m_method(method)
+        , m_args(args)
+        , m_deadline(deadline)
+    {
+        m_result.reportStarted();
+    }
+
+    QFuture<QVariant> future() { return m_result.future(); }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        //The call may have expired or been canceled while it was queued
+        if (m_result.isCanceled() || hasDeadlinePassed(m_deadline)) {
+            m_result.reportCanceled();
+            m_result.reportFinished();
+        } else {
+            QVariant returnValue(m_method.returnType, Q_NULLPTR);
+            m_source->invoke(QMetaObject::InvokeMetaMethod, m_method.forAdapter, m_method.index, m_args, &returnValue);
+            m_result.reportFinished(&returnValue);
+        }
+        //The last use of the source, which may be deleted once this returns
+        QMutexLocker locker(&m_source->m_workerMutex);
+        if (--m_source->m_workersStarted == 0)
+            m_source->m_workerDone.wakeAll();
+    }
+
+    //Hands the invocation to pool, the source isn't deleted before it ran
+    static void start(QThreadPool *pool, QRunnable *invocation)
+    {
+        QRemoteObjectSource *source = static_cast<WorkerInvocation *>(invocation)->m_source;
+        {
+            QMutexLocker locker(&source->m_workerMutex);
+            ++source->m_workersStarted;
+        }
+        pool->start(invocation);
+    }
+
+private:
+    QRemoteObjectSource *m_source;
+    const QRemoteObjectSource::MethodDescriptor m_method;
+    const QVariantList m_args;
+    const qint64 m_deadline;
+    QFutureInterface<QVariant> m_result;
+};
+
+//Runs method index on the worker pool, or queues it while maxConcurrency
+//invocations of the method are running. The result is handled here, in the
+//thread of the connection, once the invocation finished.
+void QRemoteObjectSourceIoAbstract::invokeOnWorkerPool(QRemoteObjectSource *pp, int index, ServerIoDevice *connection, int serialId, const QVariantList &args,
+                                                       qint64 deadline)
+{
+    const QRemoteObjectSource::MethodDescriptor *method = pp->method(index);
+    WorkerInvocation *invocation = new WorkerInvocation(pp, *method, args, deadline);
+    QFutureWatcher<QVariant> *watcher = new QFutureWatcher<QVariant>(pp);
+    QPointer<ServerIoDevice> replyTo(connection);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, pp, index, watcher, replyTo, serialId]() {
+        watcher->deleteLater();
+        finishInvocation(pp, index);
+        if (!replyTo || !untrackCall(replyTo, pp->m_objectId, serialId))
+            return;
+        if (watcher->isCanceled()) {
+            qRODebug(this) << "Dropped expired call of" << pp->m_api->name() << "serialId" << serialId;
+            if (serialId >= 0)
+                sendInvokeReply(pp, replyTo, serialId, QVariant(), QRemoteObjectPendingCall::DeadlineExceeded);
+            return;
+        }
+        handleInvokeResult(pp, index, replyTo, serialId, watcher->result());
+    });
+    watcher->setFuture(invocation->future());
+    trackCall(connection, pp->m_objectId, serialId, watcher);
+
+    QRemoteObjectSource::WorkerQueue &queue = pp->m_workerQueues[index];
+    if (method->maxConcurrency > 0 && queue.running >= method->maxConcurrency) {
+        queue.queued.enqueue(invocation);
+        emit queuedInvocationCountChanged(++m_queuedInvocations);
+        return;
+    }
+    ++queue.running;
+    ++m_runningInvocations;
+    WorkerInvocation::start(&m_workerPool, invocation);
+}
+
+//Lets the replica cancel the call while watcher waits for its result
+void QRemoteObjectSourceIoAbstract::trackCall(ServerIoDevice *connection, int objectId, int serialId, QFutureWatcherBase *watcher)
+{
+    if (serialId >= 0)
+        m_cancelableCalls[connection].insert(qMakePair(objectId, serialId), watcher);
+}
+
+//Returns false if the call was canceled in the meantime
+bool QRemoteObjectSourceIoAbstract::untrackCall(ServerIoDevice *connection, int objectId, int serialId)
+{
+    if (serialId < 0)
+        return true;
+    QHash<ServerIoDevice*, CancelableCalls>::iterator it = m_cancelableCalls.find(connection);
+    if (it == m_cancelableCalls.end() || !it->remove(qMakePair(objectId, serialId)))
+        return false;
+    if (it->isEmpty())
+        m_cancelableCalls.erase(it);
+    return true;
+}
+
+//Cancels the future the result of the call is waited for with. This skips
+//an invocation still queued for the worker pool, and a source that returned
+//a future can stop its work once it sees the future canceled.
+void QRemoteObjectSourceIoAbstract::cancelCall(ServerIoDevice *connection, int objectId, int serialId)
+{
+    QHash<ServerIoDevice*, CancelableCalls>::iterator it = m_cancelableCalls.find(connection);
+    if (it == m_cancelableCalls.end())
+        return;
+    const QPointer<QFutureWatcherBase> watcher = it->take(qMakePair(objectId, serialId));
+    if (it->isEmpty())
+        m_cancelableCalls.erase(it);
+    if (watcher) {
+        qRODebug(this) << "Canceled call with serialId" << serialId;
+        watcher->cancel();
+    }
+}
+
+//Called when an invocation of method index finished, starts the next one waiting
+void QRemoteObjectSourceIoAbstract::finishInvocation(QRemoteObjectSource *pp, int index)
+{
+    QRemoteObjectSource::WorkerQueue &queue = pp->m_workerQueues[index];
+    if (queue.queued.isEmpty()) {
+        --queue.running;
+        --m_runningInvocations;
+        return;
+    }
+    WorkerInvocation::start(&m_workerPool, queue.queued.dequeue());
+    emit queuedInvocationCountChanged(--m_queuedInvocations);
+}
+
+void QRemoteObjectSourceIoAbstract::queuePacket(QueuedSourcePacket *packet)
+{
+    if (m_queuedPackets.push(packet))
+        QMetaObject::invokeMethod(this, "drainQueuedPackets", Qt::QueuedConnection);
+}
+
+void QRemoteObjectSourceIoAbstract::drainQueuedPackets()
+{
+    QueuedSourcePacket *packets = m_queuedPackets.takeAll();
+    for (QueuedSourcePacket *packet = packets; packet; packet = packet->next) {
+        //Packets of a removed source are dropped, see sourceForId()
+        QRemoteObjectSource *pp = sourceForId(packet->objectId);
+        if (pp)
+            pp->sendQueuedPacket(packet);
+    }
+    QueuedSourcePacketList::deleteAll(packets);
+}
+
+void QRemoteObjectSourceIoAbstract::setWorkerThreadCount(int count)
+{
+    m_workerPool.setMaxThreadCount(count > 0 ? count : QThread::idealThreadCount());
+}
+
 void QRemoteObjectSourceIoAbstract::onReadData(ServerIoDevice *connection)
 {
-    QRemoteObjectPacketTypeEnum packetType;
+    using namespace QRemoteObjectPackets;
+
+    if (m_packetReader) {
+        m_packetReader->read(connection, connection->connection().data());
+        return;
+    }
 
     do {
 
-        if (!connection->read(packetType, m_rxName))
+        if (!connection->read(m_rxPacket.type, m_rxPacket.name, m_rxPacket.objectId))
             return;
 
-        using namespace QRemoteObjectPackets;
+        m_rxPacket.receivedAt = connection->frameReceivedAt();
+        decodePacket(connection->stream(), m_rxPacket, connection->largeFrame());
+        handlePacket(connection, m_rxPacket, connection->stream());
+    } while (connection->bytesAvailable()); // have bytes left over, so do another iteration
+}
 
-        switch (packetType) {
-        case AddObject:
-        {
-            bool isDynamic;
-            deserializeAddObjectPacket(connection->stream(), isDynamic);
-            qRODebug(this) << "AddObject" << m_rxName << isDynamic;
-            if (m_remoteObjects.contains(m_rxName)) {
-                QRemoteObjectSource *pp = m_remoteObjects[m_rxName];
-                pp->addListener(connection, isDynamic);
-            } else {
-                qROWarning(this) << "Request to attach to non-existent RemoteObjectSource:" << m_rxName;
-            }
+void QRemoteObjectSourceIoAbstract::handleReceivedPacket(QObject *connection, QRemoteObjectPackets::ReceivedPacket &packet)
+{
+    QDataStream in(packet.typedArguments);
+    in.setVersion(dataStreamVersion);
+    in.setByteOrder(packet.byteOrder);
+    handlePacket(static_cast<ServerIoDevice*>(connection), packet, in);
+}
+
+//For an InvokeTypedPacket, in holds the arguments
+void QRemoteObjectSourceIoAbstract::handlePacket(ServerIoDevice *connection, QRemoteObjectPackets::ReceivedPacket &packet, QDataStream &in)
+{
+    using namespace QRemoteObjectPackets;
+
+    switch (packet.type) {
+    case AddObject:
+    {
+        qRODebug(this) << "AddObject" << packet.name << packet.isDynamic;
+        if (QRemoteObjectSource *pp = sourceForName(packet.name)) {
+            pp->addListener(connection, packet.isDynamic, packet.schemaHash, packet.epoch, packet.sequence);
+        } else {
+            qROWarning(this) << "Request to attach to non-existent RemoteObjectSource:" << packet.name;
+        }
+        break;
+    }
+    case RemoveObject:
+    {
+        qRODebug(this) << "RemoveObject" << packet.name;
+        if (QRemoteObjectSource *pp = sourceForName(packet.name)) {
+            const int count = pp->removeListener(connection);
+            Q_UNUSED(count);
+            //TODO - possible to have a timer that closes connections if not reopened within a timeout?
+        } else {
+            qROWarning(this) << "Request to detach from non-existent RemoteObjectSource:" << packet.name;
+        }
+        qRODebug(this) << "RemoveObject finished" << packet.name;
+        break;
+    }
+    case InvokePacket:
+    {
+        QRemoteObjectSource *pp = sourceForId(packet.objectId);
+        if (!pp) {
+            qROWarning(this) << "Invoke packet received for unknown object id" << packet.objectId;
             break;
         }
-        case RemoveObject:
-        {
-            qRODebug(this) << "RemoveObject" << m_rxName;
-            if (m_remoteObjects.contains(m_rxName)) {
-                QRemoteObjectSource *pp = m_remoteObjects[m_rxName];
-                const int count = pp->removeListener(connection);
-                Q_UNUSED(count);
-                //TODO - possible to have a timer that closes connections if not reopened within a timeout?
-            } else {
-                qROWarning(this) << "Request to detach from non-existent RemoteObjectSource:" << m_rxName;
-            }
-            qRODebug(this) << "RemoveObject finished" << m_rxName;
+        if (hasDeadlinePassed(packet.deadline)) {
+            qRODebug(this) << "Dropped expired invoke packet for" << pp->m_api->name() << "serialId" << packet.serialId;
+            if (packet.serialId >= 0)
+                sendInvokeReply(pp, connection, packet.serialId, QVariant(), QRemoteObjectPendingCall::DeadlineExceeded);
             break;
         }
-        case InvokePacket:
-        {
-            int call, index, serialId, propertyId;
-            deserializeInvokePacket(connection->stream(), call, index, m_rxArgs, serialId, propertyId);
-            if (m_rxName == QStringLiteral("Registry") && !m_registryMapping.contains(connection)) {
-                const QRemoteObjectSourceLocation loc = m_rxArgs.first().value<QRemoteObjectSourceLocation>();
-                m_registryMapping[connection] = loc.second.hostUrl;
+        if (pp->m_isRegistry && !m_registryMapping.contains(connection)) {
+            const QRemoteObjectSourceLocation loc = packet.args.first().value<QRemoteObjectSourceLocation>();
+            m_registryMapping[connection] = loc.second.hostUrl;
+        }
+        if (packet.call == QMetaObject::InvokeMetaMethod) {
+            const QRemoteObjectSource::MethodDescriptor *method = pp->method(packet.index);
+            if (!method) { //Invalid index
+                qROWarning(this) << "Invalid method invoke packet received.  Index =" << packet.index <<"which is out of bounds for type"<<pp->m_api->name();
+                //TODO - consider moving this to packet validation?
+                break;
+            }
+            if (packet.args.size() < method->parameterTypes.size()) {
+                qROWarning(this) << "Invalid method invoke packet received.  Expected" << method->parameterTypes.size()
+                                 << "arguments for" << pp->m_api->methodSignature(packet.index) << "but got" << packet.args.size();
+                break;
+            }
+            if (method->forAdapter)
+                qRODebug(this) << "Adapter (method) Invoke-->" << pp->m_api->name() << pp->m_adapter->metaObject()->method(method->index).name();
+            else
+                qRODebug(this) << "Source (method) Invoke-->" << pp->m_api->name() << pp->m_object->metaObject()->method(method->index).name();
+            if (method->threadSafe) {
+                invokeOnWorkerPool(pp, packet.index, connection, packet.serialId, packet.args, packet.deadline);
+                break;
             }
-            if (m_remoteObjects.contains(m_rxName)) {
-                QRemoteObjectSource *pp = m_remoteObjects[m_rxName];
-                if (call == QMetaObject::InvokeMetaMethod) {
-                    const int resolvedIndex = pp->m_api->sourceMethodIndex(index);
-                    if (resolvedIndex < 0) { //Invalid index
-                        qROWarning(this) << "Invalid method invoke packet received.  Index =" << index <<"which is out of bounds for type"<<m_rxName;
-                        //TODO - consider moving this to packet validation?
-                        break;
-                    }
-                    if (pp->m_api->isAdapterMethod(index))
-                        qRODebug(this) << "Adapter (method) Invoke-->" << m_rxName << pp->m_adapter->metaObject()->method(resolvedIndex).name();
-                    else
-                        qRODebug(this) << "Source (method) Invoke-->" << m_rxName << pp->m_object->metaObject()->method(resolvedIndex).name();
-                    int typeId = QMetaType::type(pp->m_api->typeName(index).constData());
-                    if (!QMetaType(typeId).sizeOf())
-                        typeId = QVariant::Invalid;
-                    QVariant returnValue(typeId, Q_NULLPTR);
-                    pp->invoke(QMetaObject::InvokeMetaMethod, pp->m_api->isAdapterMethod(index), resolvedIndex, m_rxArgs, &returnValue);
-                    // send reply if wanted
-                    if (serialId >= 0) {
-                        serializeInvokeReplyPacket(m_packet, m_rxName, serialId, returnValue);
-                        connection->write(m_packet.array, m_packet.size);
-                    }
-                } else {
-                    const int resolvedIndex = pp->m_api->sourcePropertyIndex(index);
-                    if (resolvedIndex < 0) {
-                        qROWarning(this) << "Invalid property invoke packet received.  Index =" << index <<"which is out of bounds for type"<<m_rxName;
-                        //TODO - consider moving this to packet validation?
-                        break;
-                    }
-                    if (pp->m_api->isAdapterProperty(index))
-                        qRODebug(this) << "Adapter (write property) Invoke-->" << m_rxName << pp->m_adapter->metaObject()->property(resolvedIndex).name();
-                    else
-                        qRODebug(this) << "Source (write property) Invoke-->" << m_rxName << pp->m_object->metaObject()->property(resolvedIndex).name();
-                    pp->invoke(QMetaObject::WriteProperty, pp->m_api->isAdapterProperty(index), resolvedIndex, m_rxArgs);
-                }
+            QVariant returnValue(method->returnType, Q_NULLPTR);
+            pp->invoke(QMetaObject::InvokeMetaMethod, method->forAdapter, method->index, packet.args, &returnValue);
+            handleInvokeResult(pp, packet.index, connection, packet.serialId, returnValue);
+        } else {
+            const int resolvedIndex = pp->m_api->sourcePropertyIndex(packet.index);
+            if (resolvedIndex < 0) {
+                qROWarning(this) << "Invalid property invoke packet received.  Index =" << packet.index <<"which is out of bounds for type"<<pp->m_api->name();
+                //TODO - consider moving this to packet validation?
+                break;
             }
+            if (pp->m_api->isAdapterProperty(packet.index))
+                qRODebug(this) << "Adapter (write property) Invoke-->" << pp->m_api->name() << pp->m_adapter->metaObject()->property(resolvedIndex).name();
+            else
+                qRODebug(this) << "Source (write property) Invoke-->" << pp->m_api->name() << pp->m_object->metaObject()->property(resolvedIndex).name();
+            pp->invoke(QMetaObject::WriteProperty, pp->m_api->isAdapterProperty(packet.index), resolvedIndex, packet.args);
+        }
+        break;
+    }
+    case InvokeTypedPacket:
+    {
+        QRemoteObjectSource *pp = sourceForId(packet.objectId);
+        if (!pp) {
+            qROWarning(this) << "Typed invoke packet received for unknown object id" << packet.objectId;
             break;
         }
-        default:
-            qRODebug(this) << "OnReadReady invalid type" << packetType;
+        if (packet.interfaceHash != pp->m_api->interfaceHash()) {
+            qROWarning(this) << "Typed invoke packet received for a different interface of" << pp->m_api->name();
+            break;
         }
-    } while (connection->bytesAvailable()); // have bytes left over, so do another iteration
+        if (hasDeadlinePassed(packet.deadline)) {
+            qRODebug(this) << "Dropped expired typed invoke packet for" << pp->m_api->name() << "serialId" << packet.serialId;
+            if (packet.serialId >= 0)
+                sendInvokeReply(pp, connection, packet.serialId, QVariant(), QRemoteObjectPendingCall::DeadlineExceeded);
+            break;
+        }
+        const QRemoteObjectSource::MethodDescriptor *method = pp->method(packet.index);
+        if (!method) {
+            qROWarning(this) << "Invalid typed invoke packet received.  Index =" << packet.index <<"which is out of bounds for type"<<pp->m_api->name();
+            break;
+        }
+        qRODebug(this) << "Source (typed method) Invoke-->" << pp->m_api->name() << pp->m_api->methodSignature(packet.index);
+        if (method->threadSafe) {
+            QVariantList args;
+            if (pp->readArguments(packet.index, in, args))
+                invokeOnWorkerPool(pp, packet.index, connection, packet.serialId, args, packet.deadline);
+            break;
+        }
+        QVariant returnValue(method->returnType, Q_NULLPTR);
+        if (!pp->invokeTyped(packet.index, in, &returnValue))
+            break;
+        handleInvokeResult(pp, packet.index, connection, packet.serialId, returnValue);
+        break;
+    }
+    case InvokeCancelPacket:
+        //An invocation that already finished, or was run synchronously, isn't tracked
+        cancelCall(connection, packet.objectId, packet.serialId);
+        break;
+    case PayloadReleasePacket:
+        releasePayload(connection, packet.name);
+        break;
+    case Handshake:
+    {
+        qRODebug(this) << "Handshake, accepted capabilities" << packet.capabilities;
+        if (wireByteOrder(packet.capabilities & localCapabilities()) == QDataStream::BigEndian)
+            m_bigEndianConnections.insert(connection);
+        else
+            m_bigEndianConnections.remove(connection);
+        updateByteOrder();
+        break;
+    }
+    default:
+        qRODebug(this) << "OnReadReady invalid type" << packet.type;
+    }
 }
 
 void QRemoteObjectSourceIoAbstract::registerSource(QRemoteObjectSource *pp)
@@ -233,6 +656,17 @@ void QRemoteObjectSourceIoAbstract::registerSource(QRemoteObjectSource *pp)
     const auto type = pp->m_api->typeName();
     m_objectToSourceMap[pp->m_object] = pp;
     m_remoteObjects[name] = pp;
+    //The slot of a removed source is reused, with the next generation in the
+    //id, so the table only grows with the number of sources at the same time
+    if (!m_freeObjectIds.isEmpty()) {
+        pp->m_objectId = m_freeObjectIds.takeLast();
+        m_sourceTable[pp->m_objectId & QtRemoteObjects::objectIdSlotMask] = pp;
+    } else {
+        Q_ASSERT(m_sourceTable.size() <= QtRemoteObjects::objectIdSlotMask);
+        pp->m_objectId = m_sourceTable.size();
+        m_sourceTable.append(pp);
+    }
+    pp->m_packet.payloadThreshold = m_payloadThreshold;
     qRODebug(this) << "Registering" << name;
     notifyObjectAdded(name,type);
 }
@@ -242,11 +676,72 @@ void QRemoteObjectSourceIoAbstract::unregisterSource(QRemoteObjectSource *pp)
     Q_ASSERT(pp);
     const QString name = pp->m_api->name();
     const auto type = pp->m_api->typeName();
-    m_objectToSourceMap.remove(pp->m_object);
+    //Invocations of pp still running on the worker pool use it, wait for them,
+    //but not for those of other sources
+    if (!pp->m_workerQueues.isEmpty()) {
+        const int queued = m_queuedInvocations;
+        Q_FOREACH (const QRemoteObjectSource::WorkerQueue &queue, pp->m_workerQueues) {
+            m_runningInvocations -= queue.running;
+            m_queuedInvocations -= queue.queued.size();
+            qDeleteAll(queue.queued);
+        }
+        pp->m_workerQueues.clear();
+        {
+            QMutexLocker locker(&pp->m_workerMutex);
+            while (pp->m_workersStarted > 0)
+                pp->m_workerDone.wait(&pp->m_workerMutex);
+        }
+        if (queued != m_queuedInvocations)
+            emit queuedInvocationCountChanged(m_queuedInvocations);
+    }
+    //The watchers of its calls are gone with pp
+    QHash<ServerIoDevice*, CancelableCalls>::iterator it = m_cancelableCalls.begin();
+    while (it != m_cancelableCalls.end()) {
+        CancelableCalls::iterator call = it->begin();
+        while (call != it->end()) {
+            if (call.key().first == pp->m_objectId)
+                call = it->erase(call);
+            else
+                ++call;
+        }
+        if (it->isEmpty())
+            it = m_cancelableCalls.erase(it);
+        else
+            ++it;
+    }
+    //Unless another source was created for an object at the same address,
+    //before the source of a destroyed object in another thread was deleted
+    if (m_objectToSourceMap.value(pp->m_object) == pp)
+        m_objectToSourceMap.remove(pp->m_object);
     m_remoteObjects.remove(name);
+    const int slot = pp->m_objectId & QtRemoteObjects::objectIdSlotMask;
+    if (pp->m_objectId >= 0 && slot < m_sourceTable.size() && m_sourceTable.at(slot) == pp) {
+        const int generation = ((pp->m_objectId >> QtRemoteObjects::objectIdSlotBits) + 1) & QtRemoteObjects::objectIdGenerationMask;
+        m_sourceTable[slot] = Q_NULLPTR;
+        m_freeObjectIds.append(slot | (generation << QtRemoteObjects::objectIdSlotBits));
+    }
     notifyObjectRemoved(name,type);
 }
 
+//Returns Q_NULLPTR for the id of a removed source, even once its slot is
+//reused, so a packet still in flight for it can't reach the newer source
+QRemoteObjectSource *QRemoteObjectSourceIoAbstract::sourceForId(int objectId) const
+{
+    const int slot = objectId & QtRemoteObjects::objectIdSlotMask;
+    if (objectId < 0 || slot >= m_sourceTable.size())
+        return Q_NULLPTR;
+    QRemoteObjectSource *pp = m_sourceTable.at(slot);
+    return pp && pp->m_objectId == objectId && !pp->isObjectDestroyed() ? pp : Q_NULLPTR;
+}
+
+//Like sourceForId(), skips a source whose object was destroyed in another
+//thread and which is only waiting to be deleted in ours
+QRemoteObjectSource *QRemoteObjectSourceIoAbstract::sourceForName(const QString &name) const
+{
+    QRemoteObjectSource *pp = m_remoteObjects.value(name);
+    return pp && !pp->isObjectDestroyed() ? pp : Q_NULLPTR;
+}
+
 QMap<QString, QRemoteObjectSource *> QRemoteObjectSourceIoAbstract::remoteObjects() const
 {
     return m_remoteObjects;
@@ -293,6 +788,7 @@ void QRemoteObjectSourceIo::onServerDisconnect(QObject *conn)
 
     Q_FOREACH (QRemoteObjectSource *pp, m_remoteObjects)
         pp->removeListener(connection);
+    connectionClosed(connection);
 
     const QUrl location = m_registryMapping.value(connection);
     emit serverRemoved(location);
@@ -315,6 +811,7 @@ void QRemoteObjectSourceIo::handleConnection()
 
     ServerIoDevice *conn = m_server->nextPendingConnection();
     m_connections.insert(conn);
+    configureConnection(conn);
     connect(conn, SIGNAL(disconnected()), &m_serverDelete, SLOT(map()));
     m_serverDelete.setMapping(conn, conn);
     connect(conn, SIGNAL(readyRead()), &m_serverRead, SLOT(map()));
@@ -322,7 +819,9 @@ void QRemoteObjectSourceIo::handleConnection()
 
     QRemoteObjectPackets::ObjectInfoList infos;
     foreach (auto remoteObject, m_remoteObjects) {
-        infos << QRemoteObjectPackets::ObjectInfo{remoteObject->m_api->name(), remoteObject->m_api->typeName()};
+        if (remoteObject->isObjectDestroyed())
+            continue;
+        infos << QRemoteObjectPackets::ObjectInfo{remoteObject->m_api->name(), remoteObject->m_api->typeName(), remoteObject->m_objectId, remoteObject->m_api->interfaceHash()};
     }
     serializeObjectListPacket(m_packet, infos);
     conn->write(m_packet.array, m_packet.size);
@@ -334,6 +833,15 @@ QUrl QRemoteObjectSourceIo::serverAddress() const
     return m_server->address();
 }
 
+//Out of band payloads are only readable by processes on the same host
+bool QRemoteObjectSourceIo::supportsOutOfBandPayloads() const
+{
+    if (m_server.isNull())
+        return false;
+    const QString scheme = serverAddress().scheme();
+    return scheme == QRemoteObjectStringLiterals::local() || scheme == QRemoteObjectStringLiterals::shm();
+}
+
 QT_END_NAMESPACE
 
 QRemoteObjectSourceSocketIo::QRemoteObjectSourceSocketIo(QSharedPointer<QIODevice> device, QObject *parent)
@@ -351,6 +859,7 @@ void QRemoteObjectSourceSocketIo::setSocket(QSharedPointer<QIODevice> device)
     {
         disconnect(m_connection,&ServerIoDevice::disconnected,this,&QRemoteObjectSourceSocketIo::onConnectionDisconnect);
         disconnect(m_connection,&ServerIoDevice::readyRead,this,&QRemoteObjectSourceSocketIo::onConnectionRead);
+        connectionClosed(m_connection);
         m_connection->deleteLater();
     }
 
@@ -371,10 +880,13 @@ void QRemoteObjectSourceSocketIo::setSocket(QSharedPointer<QIODevice> device)
 
     connect(m_connection,&ServerIoDevice::disconnected,this,&QRemoteObjectSourceSocketIo::onConnectionDisconnect);
     connect(m_connection,&ServerIoDevice::readyRead,this,&QRemoteObjectSourceSocketIo::onConnectionRead);
+    configureConnection(m_connection);
 
     QRemoteObjectPackets::ObjectInfoList infos;
     foreach (auto remoteObject, m_remoteObjects) {
-        infos << QRemoteObjectPackets::ObjectInfo{remoteObject->m_api->name(), remoteObject->m_api->typeName()};
+        if (remoteObject->isObjectDestroyed())
+            continue;
+        infos << QRemoteObjectPackets::ObjectInfo{remoteObject->m_api->name(), remoteObject->m_api->typeName(), remoteObject->m_objectId, remoteObject->m_api->interfaceHash()};
     }
     serializeObjectListPacket(m_packet, infos);
     m_connection->write(m_packet.array, m_packet.size);
@@ -396,6 +908,7 @@ void QRemoteObjectSourceSocketIo::onConnectionDisconnect()
 {
     Q_FOREACH (QRemoteObjectSource *pp, m_remoteObjects)
         pp->removeListener(m_connection);
+    connectionClosed(m_connection);
 
     m_connection->close();
     disconnect(m_connection,&ServerIoDevice::disconnected,this,&QRemoteObjectSourceSocketIo::onConnectionDisconnect);
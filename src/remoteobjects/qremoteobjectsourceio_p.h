@@ -45,17 +45,82 @@
 #include "qconnectionfactories.h"
 #include "qtremoteobjectglobal.h"
 #include "qremoteobjectpacket_p.h"
+#include "qremoteobjectpacketreader_p.h"
+#include "qremoteobjectpendingcall.h"
 
+#include <QAtomicPointer>
+#include <QFutureWatcher>
 #include <QIODevice>
+#include <QPointer>
 #include <QScopedPointer>
 #include <QSignalMapper>
+#include <QThreadPool>
 
 QT_BEGIN_NAMESPACE
 
 class QRemoteObjectSource;
 class SourceApiMap;
 
-class QRemoteObjectSourceIoAbstract : public QObject
+//A packet serialized in the thread of a source object living outside the
+//thread of its sourceIo, see QRemoteObjectSource::handleForeignMetaCall()
+struct QueuedSourcePacket
+{
+    QueuedSourcePacket *next;
+    int objectId;
+    int rawPropertyIndex; //-1 unless the packet is a property change
+    int sequenceOffset; //Where the sequence number is written once it is known, or -1
+    QDataStream::ByteOrder byteOrder;
+    QByteArray data; //Empty if there were no listeners
+};
+
+//Lock-free queue with many producers and a single consumer. Producers push
+//onto a stack, the consumer takes the whole stack at once and reverses it.
+class QueuedSourcePacketList
+{
+public:
+    QueuedSourcePacketList() : m_head(Q_NULLPTR) {}
+    ~QueuedSourcePacketList() { deleteAll(takeAll()); }
+
+    //Returns true if the list was empty, so the consumer has to be woken up
+    bool push(QueuedSourcePacket *packet)
+    {
+        QueuedSourcePacket *head;
+        do {
+            head = m_head.loadAcquire();
+            packet->next = head;
+        } while (!m_head.testAndSetRelease(head, packet));
+        return !head;
+    }
+
+    //Takes the packets pushed so far, oldest first
+    QueuedSourcePacket *takeAll()
+    {
+        QueuedSourcePacket *packet = m_head.fetchAndStoreAcquire(Q_NULLPTR);
+        QueuedSourcePacket *reversed = Q_NULLPTR;
+        while (packet) {
+            QueuedSourcePacket *next = packet->next;
+            packet->next = reversed;
+            reversed = packet;
+            packet = next;
+        }
+        return reversed;
+    }
+
+    static void deleteAll(QueuedSourcePacket *packet)
+    {
+        while (packet) {
+            QueuedSourcePacket *next = packet->next;
+            delete packet;
+            packet = next;
+        }
+    }
+
+private:
+    QAtomicPointer<QueuedSourcePacket> m_head;
+    Q_DISABLE_COPY(QueuedSourcePacketList)
+};
+
+class QRemoteObjectSourceIoAbstract : public QObject, public ReceivedPacketHandler
 {
     Q_OBJECT
 
@@ -70,26 +135,99 @@ public:
     bool enableRemoting(QObject *object, const SourceApiMap *api, QObject *adapter = Q_NULLPTR);
     bool disableRemoting(QObject *object);
 
+    void setPropertyChangeCoalescingEnabled(bool enabled);
+    bool isPropertyChangeCoalescingEnabled() const { return m_coalescePropertyChanges; }
+
+    void setOutOfBandPayloadThreshold(int threshold);
+    int outOfBandPayloadThreshold() const { return m_payloadThreshold; }
+    virtual bool supportsOutOfBandPayloads() const { return false; }
+    void trackPayloads(QRemoteObjectPackets::DataStreamPacket &packet, const QVector<ServerIoDevice*> &readers);
+    void releasePayload(ServerIoDevice *reader, const QString &name);
+    void releasePayloads(ServerIoDevice *reader);
+
+    void setSendQueueLimits(qint64 maxBytes, int maxPackets);
+    void setSendQueuePolicy(ServerIoDevice::OverflowPolicy policy);
+
+    //Byte order of the packets written to all connections
+    QDataStream::ByteOrder byteOrder() const { return m_byteOrder; }
+
+    //Thread safe methods, see QCLASSINFO_REMOTEOBJECT_THREADSAFE, run on the worker pool
+    void setWorkerThreadCount(int count);
+    int workerThreadCount() const { return m_workerPool.maxThreadCount(); }
+    int runningInvocationCount() const { return m_runningInvocations; }
+    int queuedInvocationCount() const { return m_queuedInvocations; }
+
+    //Called from the thread of a source object, the packet is written once
+    //this thread gets to it, along with the others queued in the meantime
+    void queuePacket(QueuedSourcePacket *packet);
+
     virtual QSet<ServerIoDevice*> connections() = 0;
 
+    void handleReceivedPacket(QObject *connection, QRemoteObjectPackets::ReceivedPacket &packet) Q_DECL_OVERRIDE;
+
 public Q_SLOTS:
     void onReadData(ServerIoDevice *connection);
 
 Q_SIGNALS:
+    void congestedConnectionsChanged(int count);
+    void queuedInvocationCountChanged(int count);
+
+private Q_SLOTS:
+    void onCongestionChanged(bool congested);
+    void drainQueuedPackets();
 
 public:
     void registerSource(QRemoteObjectSource *pp);
     void unregisterSource(QRemoteObjectSource *pp);
+    QRemoteObjectSource *sourceForId(int objectId) const;
+    QRemoteObjectSource *sourceForName(const QString &name) const;
 
     QMap<QString, QRemoteObjectSource *> remoteObjects() const;
 
 protected:
     QMap<QString, QRemoteObjectSource*> m_remoteObjects;
     QHash<QObject *, QRemoteObjectSource*> m_objectToSourceMap;
+    QVector<QRemoteObjectSource*> m_sourceTable;
+    //The ids the next sources get for the free slots of m_sourceTable
+    QVector<int> m_freeObjectIds;
     QHash<ServerIoDevice*, QUrl> m_registryMapping;
     QRemoteObjectPackets::DataStreamPacket m_packet;
-    QString m_rxName;
-    QVariantList m_rxArgs;
+    QRemoteObjectPackets::ReceivedPacket m_rxPacket;
+    //Decodes the packets of the connections in the IO thread, if enabled
+    QScopedPointer<ThreadedPacketReader> m_packetReader;
+    bool m_coalescePropertyChanges;
+    int m_payloadThreshold;
+    //Connections that haven't released an out of band payload yet, by segment name
+    QHash<QString, QSet<ServerIoDevice*> > m_payloadReaders;
+    qint64 m_maxQueuedBytes;
+    int m_maxQueuedPackets;
+    ServerIoDevice::OverflowPolicy m_overflowPolicy;
+    QSet<ServerIoDevice*> m_congestedConnections;
+    //Connections that didn't accept little endian packets in their Handshake
+    QSet<ServerIoDevice*> m_bigEndianConnections;
+    QDataStream::ByteOrder m_byteOrder;
+    QThreadPool m_workerPool;
+    int m_runningInvocations;
+    int m_queuedInvocations;
+    QueuedSourcePacketList m_queuedPackets;
+    //Watchers of the invocations a replica can still cancel, by connection
+    //and (object id, serial id)
+    typedef QHash<QPair<int, int>, QPointer<QFutureWatcherBase> > CancelableCalls;
+    QHash<ServerIoDevice*, CancelableCalls> m_cancelableCalls;
+
+    void configureConnection(ServerIoDevice *connection);
+    void updateByteOrder();
+    void connectionClosed(ServerIoDevice *connection);
+    void handlePacket(ServerIoDevice *connection, QRemoteObjectPackets::ReceivedPacket &packet, QDataStream &in);
+    void sendInvokeReply(QRemoteObjectSource *pp, ServerIoDevice *connection, int serialId, const QVariant &returnValue,
+                         QRemoteObjectPendingCall::Error error = QRemoteObjectPendingCall::NoError);
+    void handleInvokeResult(QRemoteObjectSource *pp, int index, ServerIoDevice *connection, int serialId, const QVariant &returnValue);
+    void invokeOnWorkerPool(QRemoteObjectSource *pp, int index, ServerIoDevice *connection, int serialId, const QVariantList &args,
+                            qint64 deadline);
+    void finishInvocation(QRemoteObjectSource *pp, int index);
+    void trackCall(ServerIoDevice *connection, int objectId, int serialId, QFutureWatcherBase *watcher);
+    bool untrackCall(ServerIoDevice *connection, int objectId, int serialId);
+    void cancelCall(ServerIoDevice *connection, int objectId, int serialId);
 
     virtual void notifyObjectAdded(const QString name, const QString type);
     virtual void notifyObjectRemoved(const QString name, const QString type);
@@ -104,6 +242,7 @@ public:
 
     QUrl serverAddress() const Q_DECL_OVERRIDE;
     bool serverIsNull() const Q_DECL_OVERRIDE;
+    bool supportsOutOfBandPayloads() const Q_DECL_OVERRIDE;
 
     void registerSource(QRemoteObjectSource *pp);
     void unregisterSource(QRemoteObjectSource *pp);
@@ -110,6 +110,8 @@ Q_DECLARE_METATYPE(QIntHash)
 #endif
 
 #define QCLASSINFO_REMOTEOBJECT_TYPE "RemoteObject Type"
+#define QCLASSINFO_REMOTEOBJECT_SIGNATURE "RemoteObject Signature"
+#define QCLASSINFO_REMOTEOBJECT_THREADSAFE "RemoteObject ThreadSafe"
 
 class QDataStream;
 
@@ -120,6 +122,7 @@ namespace QRemoteObjectStringLiterals {
 
 inline QString local() { return QStringLiteral("local"); }
 inline QString tcp() { return QStringLiteral("tcp"); }
+inline QString shm() { return QStringLiteral("shm"); }
 
 }
 
@@ -161,7 +164,12 @@ enum QRemoteObjectPacketTypeEnum
     InvokePacket,
     InvokeReplyPacket,
     PropertyChangePacket,
-    ObjectList
+    ObjectList,
+    PropertyChangeBatchPacket,
+    PayloadReleasePacket,
+    Handshake,
+    InvokeTypedPacket,
+    InvokeCancelPacket
 };
 
 }
@@ -42,6 +42,7 @@ PRIVATE_HEADERS += \
     $$PWD/qremoteobjectregistrysource_p.h \
     $$PWD/qremoteobjectnode_p.h \
     $$PWD/qremoteobjectpacket_p.h \
+    $$PWD/qremoteobjectpacketreader_p.h \
     $$PWD/qremoteobjectpendingcall_p.h \
     $$PWD/qremoteobjectreplica_p.h \
     $$PWD/qremoteobjectabstractitemmodelreplica_p.h \
@@ -59,11 +60,23 @@ SOURCES += \
     $$PWD/qremoteobjectreplica.cpp \
     $$PWD/qremoteobjectnode.cpp \
     $$PWD/qremoteobjectpacket.cpp \
+    $$PWD/qremoteobjectpacketreader.cpp \
     $$PWD/qremoteobjectpendingcall.cpp \
     $$PWD/qtremoteobjectglobal.cpp \
     $$PWD/qremoteobjectabstractitemmodelreplica.cpp \
     $$PWD/qremoteobjectabstractitemmodeladapter.cpp
 
+linux {
+    SOURCES += \
+        qconnection_shm_backend.cpp \
+
+    PRIVATE_HEADERS += \
+        qconnection_shm_backend_p.h \
+
+    # shm_open() lives in librt with older glibc versions
+    LIBS_PRIVATE += -lrt
+}
+
 qnx {
     SOURCES += \
         qconnection_qnx_backend.cpp \
@@ -50,7 +50,7 @@
 %token prop "[prop][ \\t]*PROP[ \\t]*\\((?<args>[^\\)]+)\\);?[ \\t]*"
 %token use_enum "[use_enum]USE_ENUM[ \\t]*\\((?<name>[^\\)]*)\\);?[ \\t]*"
 %token signal "[signal][ \\t]*SIGNAL[ \\t]*\\([ \\t]*(?<name>\\S+)[ \\t]*\\((?<args>[^\\)]*)\\)[ \\t]*\\);?[ \\t]*"
-%token slot "[slot][ \\t]*SLOT[ \\t]*\\((?<type>[^\\(]*)\\((?<args>[^\\)]*)\\)[ \\t]*\\);?[ \\t]*"
+%token slot "[slot][ \\t]*SLOT[ \\t]*\\((?<type>[^\\(]*)\\((?<args>[^\\)]*)\\)[ \\t]*(?:(?<modifier>THREADSAFE)(?:[ \\t]+(?<limit>\\d+))?[ \\t]*)?\\);?[ \\t]*"
 %token start "[start]\\{[ \\t]*"
 %token stop "[stop]\\};?[ \\t]*"
 %token comma "[comma],"
@@ -132,6 +132,9 @@ struct ASTFunction
     QString returnType;
     QString name;
     QVector<ASTDeclaration> params;
+    //Set for slots declared THREADSAFE, which sources may run on a worker thread
+    bool threadSafe;
+    int maxConcurrency; //0 if only the size of the worker pool limits it
 };
 Q_DECLARE_TYPEINFO(ASTFunction, Q_MOVABLE_TYPE);
 
@@ -311,7 +314,7 @@ QString ASTDeclaration::asString(bool withName) const
 }
 
 ASTFunction::ASTFunction(const QString &name, const QString &returnType)
-    : returnType(returnType), name(name)
+    : returnType(returnType), name(name), threadSafe(false), maxConcurrency(0)
 {
 }
 
@@ -738,6 +741,8 @@ Slot: slot;
         ASTFunction slot;
         slot.returnType = returnTypeAndName.mid(0, startOfFunctionName-1);
         slot.name = returnTypeAndName.mid(startOfFunctionName);
+        slot.threadSafe = !captured().value(QLatin1String("modifier")).isEmpty();
+        slot.maxConcurrency = captured().value(QLatin1String("limit")).toInt();
 
         RepParser::TypeParser parseType;
         parseType.parseArguments(argString);
@@ -16,6 +16,11 @@ OTHER_FILES = ../repfiles/localdatacenter.rep \
 REPC_SOURCE += $$OTHER_FILES
 REPC_REPLICA += $$OTHER_FILES
 
+#Only used by the benchmarks of slot invocations
+REPC_SOURCE += calculator.rep
+REPC_REPLICA += calculator.rep
+OTHER_FILES += calculator.rep
+
 
 SOURCES += tst_benchmarkstest.cpp
 DEFINES += SRCDIR=\\\"$$PWD/\\\"
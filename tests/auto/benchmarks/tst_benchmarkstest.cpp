@@ -43,11 +43,15 @@
 #include <QDataStream>
 #include <QLocalSocket>
 #include <QLocalServer>
+#include <QtEndian>
 #include <QtTest>
 #include <QtRemoteObjects/QAbstractItemModelReplica>
+#include <QtRemoteObjects/QRemoteObjectDynamicReplica>
 #include <QtRemoteObjects/QRemoteObjectNode>
 #include "rep_localdatacenter_replica.h"
 #include "rep_localdatacenter_source.h"
+#include "rep_calculator_replica.h"
+#include "rep_calculator_source.h"
 
 class BenchmarksModel : public QAbstractListModel
 {
@@ -84,6 +88,87 @@ QHash<int, QByteArray> BenchmarksModel::roleNames() const
     return roleNames;
 }
 
+class BenchmarksCalculator : public CalculatorSimpleSource
+{
+public:
+    int add(int value) override { return base() + value; }
+};
+
+// Forwards one client connection to a host and counts the packets
+// the host sends to that client
+class PacketCounter
+{
+public:
+    PacketCounter(const QString &name, const QString &hostName)
+        : packets(0), m_client(Q_NULLPTR), m_hostName(hostName)
+    {
+        QLocalServer::removeServer(name);
+        m_server.listen(name);
+        QObject::connect(&m_server, &QLocalServer::newConnection, [this]() {
+            m_client = m_server.nextPendingConnection();
+            m_host.connectToServer(m_hostName);
+            m_host.waitForConnected();
+            QObject::connect(m_client, &QLocalSocket::readyRead, [this]() {
+                m_host.write(m_client->readAll());
+            });
+            QObject::connect(&m_host, &QLocalSocket::readyRead, [this]() {
+                const QByteArray data = m_host.readAll();
+                m_client->write(data);
+                count(data);
+            });
+        });
+    }
+
+    int packets;
+
+private:
+    void count(const QByteArray &data)
+    {
+        m_pending.append(data);
+        int pos = 0;
+        while (m_pending.size() - pos >= int(sizeof(quint32))) {
+            const int frameSize = sizeof(quint32) + qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(m_pending.constData() + pos));
+            if (m_pending.size() - pos < frameSize)
+                break;
+            pos += frameSize;
+            ++packets;
+        }
+        m_pending.remove(0, pos);
+    }
+
+    QLocalServer m_server;
+    QLocalSocket *m_client;
+    QLocalSocket m_host;
+    QString m_hostName;
+    QByteArray m_pending;
+};
+
+// The notify signal carries more than the new value, so a change is sent as
+// a PropertyChangePacket followed by an InvokePacket for the signal, the way
+// every property change was sent before PropertyChangePacket had a notify flag
+class TwoArgumentNotifySource : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int data1 READ data1 WRITE setData1 NOTIFY data1Changed)
+
+public:
+    TwoArgumentNotifySource() : m_data1(0) {}
+
+    int data1() const { return m_data1; }
+    void setData1(int data1)
+    {
+        const int previous = m_data1;
+        m_data1 = data1;
+        emit data1Changed(data1, previous);
+    }
+
+Q_SIGNALS:
+    void data1Changed(int data1, int previous);
+
+private:
+    int m_data1;
+};
+
 class BenchmarksTest : public QObject
 {
     Q_OBJECT
@@ -94,11 +179,24 @@ private:
     QRemoteObjectHost m_basicServer;
     QRemoteObjectNode m_basicClient;
     QScopedPointer<LocalDataCenterSimpleSource> dataCenterLocal;
+    BenchmarksCalculator m_calculator;
     BenchmarksModel m_sourceModel;
+    TwoArgumentNotifySource m_twoArgumentNotifySource;
 
 private Q_SLOTS:
     void initTestCase();
     void benchPropertyChangesInt();
+    void benchPropertyChangesIntCoalesced();
+    void benchPropertyChangePackets_data();
+    void benchPropertyChangePackets();
+    void benchPropertyReads();
+    void benchSlotInvocations();
+    void benchTransportThroughput_data();
+    void benchTransportThroughput();
+    void benchTransportLatency_data();
+    void benchTransportLatency();
+    void benchReplicasJoining();
+    void benchDynamicReplicasJoining();
     void benchQDataStreamInt();
     void benchQLocalSocketInt();
     void benchQLocalSocketQDataStreamInt();
@@ -114,7 +212,12 @@ void BenchmarksTest::initTestCase() {
     m_basicServer.setHostUrl(QUrl(QStringLiteral("local:benchmark_replica")));
     dataCenterLocal.reset(new LocalDataCenterSimpleSource);
     dataCenterLocal->setData1(5);
-    const bool remoted = m_basicServer.enableRemoting(dataCenterLocal.data());
+    bool remoted = m_basicServer.enableRemoting(dataCenterLocal.data());
+    Q_ASSERT(remoted);
+    remoted = m_basicServer.enableRemoting(&m_twoArgumentNotifySource, QStringLiteral("TwoArgumentNotify"));
+    Q_ASSERT(remoted);
+    m_calculator.setBase(5);
+    remoted = m_basicServer.enableRemoting(&m_calculator);
     Q_ASSERT(remoted);
     Q_UNUSED(remoted);
 
@@ -150,6 +253,232 @@ void BenchmarksTest::benchPropertyChangesInt()
         loop.exec();
     }
 }
+
+// Every timer shot is one event loop iteration changing the same properties
+// 20 times, which is sent as a single batch with coalescing enabled
+void BenchmarksTest::benchPropertyChangesIntCoalesced()
+{
+    m_basicServer.setPropertyChangeCoalescingEnabled(true);
+    QScopedPointer<LocalDataCenterReplica> center;
+    center.reset(m_basicClient.acquire<LocalDataCenterReplica>());
+    if (!center->isInitialized()) {
+        QEventLoop loop;
+        connect(center.data(), &LocalDataCenterReplica::initialized, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    const int bursts = 2500;
+    QEventLoop loop;
+    connect(center.data(), &LocalDataCenterReplica::data1Changed, [&center, &loop, bursts]() {
+        if (center->data1() == bursts - 1)
+            loop.quit();
+    });
+    QBENCHMARK {
+        int burst = 0;
+        QTimer timer;
+        connect(&timer, &QTimer::timeout, [this, &timer, &burst, bursts]() {
+            for (int i = 0; i < 20; ++i) {
+                dataCenterLocal->setData2(burst * 20 + i);
+                dataCenterLocal->setData1(-i - 1);
+            }
+            dataCenterLocal->setData1(burst);
+            if (++burst == bursts)
+                timer.stop();
+        });
+        timer.start(0);
+        loop.exec();
+    }
+    m_basicServer.setPropertyChangeCoalescingEnabled(false);
+}
+
+void BenchmarksTest::benchPropertyChangePackets_data()
+{
+    QTest::addColumn<QString>("sourceName");
+
+    QTest::newRow("value only notify") << QStringLiteral("LocalDataCenter");
+    QTest::newRow("two argument notify") << QStringLiteral("TwoArgumentNotify");
+}
+
+// Reports how many packets reach a replica per property change. The two
+// argument notify row is the baseline of two packets per change.
+void BenchmarksTest::benchPropertyChangePackets()
+{
+    QFETCH(QString, sourceName);
+    QObject *source = sourceName == QLatin1String("TwoArgumentNotify")
+            ? static_cast<QObject *>(&m_twoArgumentNotifySource) : dataCenterLocal.data();
+
+    PacketCounter counter(QStringLiteral("benchmark_packets"), QStringLiteral("benchmark_replica"));
+    QRemoteObjectNode client;
+    client.connectToNode(QUrl(QStringLiteral("local:benchmark_packets")));
+    QScopedPointer<QRemoteObjectDynamicReplica> replica(client.acquireDynamic(sourceName));
+    QVERIFY(replica->waitForSource());
+
+    const int changes = 10000;
+    const int last = source->property("data1").toInt() + changes;
+    const int packetsBefore = counter.packets;
+    for (int i = last - changes + 1; i <= last; ++i)
+        source->setProperty("data1", i);
+    QTRY_COMPARE(replica->property("data1").toInt(), last);
+
+    QTest::setBenchmarkResult(qreal(counter.packets - packetsBefore) / changes, QTest::Events);
+}
+
+// Reads the properties the way a binding does, through the generated getters
+void BenchmarksTest::benchPropertyReads()
+{
+    dataCenterLocal->setData3(QStringLiteral("benchmark"));
+    QScopedPointer<LocalDataCenterReplica> center;
+    center.reset(m_basicClient.acquire<LocalDataCenterReplica>());
+    if (!center->isInitialized()) {
+        QEventLoop loop;
+        connect(center.data(), &LocalDataCenterReplica::initialized, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    qint64 length = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 100000; ++i)
+            length += center->data3().size() + center->data1();
+    }
+    QVERIFY(length > 0);
+}
+
+// Calls a slot with a return value, waiting only for the reply of the last call
+void BenchmarksTest::benchSlotInvocations()
+{
+    QScopedPointer<CalculatorReplica> calculator;
+    calculator.reset(m_basicClient.acquire<CalculatorReplica>());
+    if (!calculator->isInitialized()) {
+        QEventLoop loop;
+        connect(calculator.data(), &CalculatorReplica::initialized, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    const int calls = 10000;
+    QBENCHMARK {
+        QRemoteObjectPendingReply<int> reply;
+        for (int i = 0; i < calls; ++i)
+            reply = calculator->add(i);
+        QVERIFY(reply.waitForFinished());
+        QCOMPARE(reply.returnValue(), m_calculator.base() + calls - 1);
+    }
+}
+
+static void addTransportRows()
+{
+    QTest::addColumn<QUrl>("url");
+    QTest::newRow("local") << QUrl(QStringLiteral("local:benchmark_transport"));
+#ifdef Q_OS_LINUX
+    QTest::newRow("shm") << QUrl(QStringLiteral("shm:benchmark_transport"));
+#endif
+}
+
+void BenchmarksTest::benchTransportThroughput_data()
+{
+    addTransportRows();
+}
+
+void BenchmarksTest::benchTransportThroughput()
+{
+    QFETCH(QUrl, url);
+    QRemoteObjectHost host(url);
+    LocalDataCenterSimpleSource source;
+    QVERIFY(host.enableRemoting(&source));
+    QRemoteObjectNode client;
+    client.connectToNode(url);
+    QScopedPointer<LocalDataCenterReplica> center;
+    center.reset(client.acquire<LocalDataCenterReplica>());
+    QVERIFY(center->waitForSource());
+
+    int value = 0;
+    QEventLoop loop;
+    connect(center.data(), &LocalDataCenterReplica::data1Changed, [&center, &loop, &value]() {
+        if (center->data1() == value)
+            loop.quit();
+    });
+    QBENCHMARK {
+        for (int i = 0; i < 50000; ++i)
+            source.setData1(++value);
+        loop.exec();
+    }
+}
+
+void BenchmarksTest::benchTransportLatency_data()
+{
+    addTransportRows();
+}
+
+// Time from a property change on the source until the replica emits it
+void BenchmarksTest::benchTransportLatency()
+{
+    QFETCH(QUrl, url);
+    QRemoteObjectHost host(url);
+    LocalDataCenterSimpleSource source;
+    QVERIFY(host.enableRemoting(&source));
+    QRemoteObjectNode client;
+    client.connectToNode(url);
+    QScopedPointer<LocalDataCenterReplica> center;
+    center.reset(client.acquire<LocalDataCenterReplica>());
+    QVERIFY(center->waitForSource());
+
+    int value = 0;
+    QEventLoop loop;
+    connect(center.data(), &LocalDataCenterReplica::data1Changed, &loop, &QEventLoop::quit);
+    QBENCHMARK {
+        source.setData1(++value);
+        loop.exec();
+    }
+}
+
+// Many replicas acquiring the same unchanged source, like after a restart of
+// the registry, all get the same Init packet
+void BenchmarksTest::benchReplicasJoining()
+{
+    const int count = 100;
+    QBENCHMARK {
+        QList<QSharedPointer<QRemoteObjectNode> > clients;
+        QList<QSharedPointer<LocalDataCenterReplica> > replicas;
+        int initialized = 0;
+        QEventLoop loop;
+        for (int i = 0; i < count; ++i) {
+            QSharedPointer<QRemoteObjectNode> client(new QRemoteObjectNode);
+            client->connectToNode(QUrl(QStringLiteral("local:benchmark_replica")));
+            QSharedPointer<LocalDataCenterReplica> replica(client->acquire<LocalDataCenterReplica>());
+            connect(replica.data(), &LocalDataCenterReplica::initialized, [&initialized, &loop, count]() {
+                if (++initialized == count)
+                    loop.quit();
+            });
+            clients.append(client);
+            replicas.append(replica);
+        }
+        loop.exec();
+        replicas.clear();
+    }
+}
+
+// Dynamic replicas after the first one pass the schema hash they know, and
+// only get the values of the properties
+void BenchmarksTest::benchDynamicReplicasJoining()
+{
+    const int count = 100;
+    QBENCHMARK {
+        QList<QSharedPointer<QRemoteObjectNode> > clients;
+        QList<QSharedPointer<QRemoteObjectDynamicReplica> > replicas;
+        int initialized = 0;
+        QEventLoop loop;
+        for (int i = 0; i < count; ++i) {
+            QSharedPointer<QRemoteObjectNode> client(new QRemoteObjectNode);
+            client->connectToNode(QUrl(QStringLiteral("local:benchmark_replica")));
+            QSharedPointer<QRemoteObjectDynamicReplica> replica(client->acquireDynamic(QStringLiteral("LocalDataCenter")));
+            connect(replica.data(), &QRemoteObjectDynamicReplica::initialized, [&initialized, &loop, count]() {
+                if (++initialized == count)
+                    loop.quit();
+            });
+            clients.append(client);
+            replicas.append(replica);
+        }
+        loop.exec();
+        replicas.clear();
+    }
+}
+
 // This ONLY tests the optimal case of a non resizing QByteArray
 void BenchmarksTest::benchQDataStreamInt()
 {
@@ -41,8 +41,11 @@
 
 #include "engine.h"
 
+#include <QThread>
+#include <QTimer>
+
 Engine::Engine(QObject *parent) :
-  EngineSimpleSource(parent)
+  EngineSimpleSource(parent), _calibrations(0)
 {
     setRpm(0);
     setpurchasedPart(false);
@@ -66,6 +69,39 @@ void Engine::increaseRpm(int deltaRpm)
     setRpm(rpm() + deltaRpm);
 }
 
+//Reports the rpm once msecs have passed, without blocking the event loop
+QFuture<int> Engine::warmUp(int msecs)
+{
+    QFutureInterface<int> promise;
+    promise.reportStarted();
+    QTimer::singleShot(msecs, this, [this, promise]() mutable {
+        const int value = rpm();
+        promise.reportFinished(&value);
+    });
+    return promise.future();
+}
+
+//Called on the worker threads of the host, see THREADSAFE in engine.rep
+int Engine::measure(int msecs)
+{
+    _measures.fetchAndAddOrdered(1);
+    const int concurrent = _concurrentMeasures.fetchAndAddOrdered(1) + 1;
+    int max = _maxConcurrentMeasures.load();
+    while (concurrent > max && !_maxConcurrentMeasures.testAndSetOrdered(max, concurrent))
+        max = _maxConcurrentMeasures.load();
+    QThread::msleep(msecs);
+    _concurrentMeasures.fetchAndAddOrdered(-1);
+    return msecs;
+}
+
+//Blocks the thread of the host, unlike measure()
+int Engine::calibrate(int msecs)
+{
+    ++_calibrations;
+    QThread::msleep(msecs);
+    return msecs;
+}
+
 Temperature Engine::temperature()
 {
     return _temperature;
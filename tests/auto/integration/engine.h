@@ -63,6 +63,13 @@ public:
 
     void setSharedTemperature(const Temperature::Ptr &) Q_DECL_OVERRIDE {}
 
+    QFuture<int> warmUp(int msecs) Q_DECL_OVERRIDE;
+    int measure(int msecs) Q_DECL_OVERRIDE;
+    int maxConcurrentMeasures() const { return _maxConcurrentMeasures.load(); }
+    int measureCount() const { return _measures.load(); }
+    int calibrate(int msecs) Q_DECL_OVERRIDE;
+    int calibrationCount() const { return _calibrations; }
+
     bool purchasedPart() {return _purchasedPart;}
 
 public Q_SLOTS:
@@ -75,6 +82,10 @@ private:
     bool _purchasedPart;
     QString _myTestString;
     Temperature _temperature;
+    QAtomicInt _concurrentMeasures;
+    QAtomicInt _maxConcurrentMeasures;
+    QAtomicInt _measures;
+    int _calibrations;
 };
 
 #endif
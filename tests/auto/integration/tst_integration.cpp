@@ -79,6 +79,62 @@ Q_SIGNALS:
     void send(const QByteArray &data);
 };
 
+class TestNumericData: public QObject
+{
+    Q_OBJECT
+
+Q_SIGNALS:
+    void send(const QVector<float> &samples, const QList<double> &values);
+};
+
+class SnapshotReader: public QThread
+{
+public:
+    SnapshotReader(const QRemoteObjectReplica *replica, int index)
+        : m_replica(replica), m_index(index), m_last(0), m_ordered(true) {}
+
+    void stop() { m_stop.storeRelease(1); }
+
+    QAtomicInt m_stop;
+    const QRemoteObjectReplica *m_replica;
+    const int m_index;
+    int m_last;
+    bool m_ordered;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        //Reads once more after being stopped, so the last value is the final one
+        forever {
+            const bool stopped = m_stop.loadAcquire();
+            const int value = m_replica->propertySnapshot().at(m_index).toInt();
+            if (value < m_last)
+                m_ordered = false;
+            m_last = value;
+            if (stopped)
+                break;
+        }
+    }
+};
+
+//Blocks in a wait of a replica without running an event loop
+class BlockingWaiter: public QThread
+{
+public:
+    explicit BlockingWaiter(QRemoteObjectReplica *replica) : m_replica(replica), m_result(false) {}
+    explicit BlockingWaiter(const QRemoteObjectPendingCall &call) : m_replica(Q_NULLPTR), m_call(call), m_result(false) {}
+
+    QRemoteObjectReplica *m_replica;
+    QRemoteObjectPendingCall m_call;
+    bool m_result;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        m_result = m_replica ? m_replica->waitForSource() : m_call.waitForFinished();
+    }
+};
+
 class tst_Integration: public QObject
 {
     Q_OBJECT
@@ -526,6 +582,41 @@ private slots:
         QCOMPARE(engine_r->started(), true);
     }
 
+    void slotTestWithContinuation() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting(&e);
+        e.setStarted(false);
+
+        QRemoteObjectNode client;
+        client.connectToNode(hostUrl);
+        Q_SET_OBJECT_NAME(client);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        QVERIFY(engine_r->waitForSource());
+
+        int calls = 0;
+        bool result = false;
+        QRemoteObjectPendingReply<bool> reply = engine_r->start();
+        reply.then(this, [&calls, &result](const QRemoteObjectPendingReply<bool> &finished) {
+            ++calls;
+            result = finished.returnValue();
+        });
+        {
+            //Dropped along with its context
+            QObject context;
+            reply.then(&context, [&calls](const QRemoteObjectPendingCall &) { ++calls; });
+        }
+        QTRY_COMPARE(calls, 1);
+        QCOMPARE(result, true);
+        QCOMPARE(engine_r->started(), true);
+
+        //Called right away once the call finished
+        reply.then(this, [&calls](const QRemoteObjectPendingCall &) { ++calls; });
+        QCOMPARE(calls, 2);
+    }
+
     void slotTestDynamicReplica() {
         QRemoteObjectHost host(hostUrl);
         SET_NODE_NAME(host);
@@ -905,6 +996,393 @@ private slots:
         QCOMPARE(engine_r_inProc->rpm(), e.rpm());
     }
 
+    void apiSlotTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+        e.setRpm(0);
+        e.setTemperature(Temperature(400, QStringLiteral("Kelvin")));
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        //Both sides come from engine.rep, so the arguments are sent without QVariants
+        QSignalSpy spy(engine_r.data(), SIGNAL(rpmChanged(int)));
+        engine_r->increaseRpm(1000);
+        spy.wait();
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(engine_r->rpm(), 1000);
+
+        engine_r->setMyTestString(QStringLiteral("typed"));
+        QRemoteObjectPendingReply<QString> stringReply = engine_r->myTestString();
+        QVERIFY(stringReply.waitForFinished());
+        QCOMPARE(stringReply.returnValue(), QStringLiteral("typed"));
+
+        QRemoteObjectPendingReply<Temperature> temperatureReply = engine_r->temperature();
+        QVERIFY(temperatureReply.waitForFinished());
+        QCOMPARE(temperatureReply.returnValue(), Temperature(400, QStringLiteral("Kelvin")));
+    }
+
+    void asyncSlotTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+        e.setRpm(0);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        QRemoteObjectPendingReply<int> reply = engine_r->warmUp(500);
+
+        //The source keeps handling packets until the future finishes
+        QSignalSpy spy(engine_r.data(), SIGNAL(rpmChanged(int)));
+        engine_r->increaseRpm(1000);
+        spy.wait();
+        QCOMPARE(spy.count(), 1);
+        QVERIFY(!reply.isFinished());
+
+        QVERIFY(reply.waitForFinished());
+        QCOMPARE(reply.returnValue(), 1000);
+    }
+
+    void threadSafeSlotTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        host.setWorkerThreadCount(4);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        //measure() is THREADSAFE 2, so no more than two of the calls run at once
+        QVector<QRemoteObjectPendingReply<int> > replies;
+        for (int i = 0; i < 4; ++i)
+            replies << engine_r->measure(100);
+        Q_FOREACH (QRemoteObjectPendingReply<int> reply, replies) {
+            QVERIFY(reply.waitForFinished());
+            QCOMPARE(reply.returnValue(), 100);
+        }
+        QVERIFY(e.maxConcurrentMeasures() <= 2);
+        QCOMPARE(host.runningInvocationCount(), 0);
+        QCOMPARE(host.queuedInvocationCount(), 0);
+    }
+
+    void callDeadlineTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        host.setWorkerThreadCount(4);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+        QCOMPARE(engine_r->callTimeout(), -1);
+        engine_r->setCallTimeout(100);
+        QCOMPARE(engine_r->callTimeout(), 100);
+
+        //Two of the calls run longer than the timeout, the other two wait
+        //for them and are dropped by the host once they expired
+        QVector<QRemoteObjectPendingReply<int> > replies;
+        for (int i = 0; i < 4; ++i)
+            replies << engine_r->measure(200);
+        Q_FOREACH (QRemoteObjectPendingReply<int> reply, replies) {
+            QVERIFY(reply.waitForFinished());
+            QCOMPARE(reply.error(), QRemoteObjectPendingCall::DeadlineExceeded);
+        }
+        QTRY_COMPARE(host.queuedInvocationCount(), 0);
+        QTRY_COMPARE(host.runningInvocationCount(), 0);
+        QCOMPARE(e.measureCount(), 2);
+
+        //The late replies were dropped, new calls still work
+        engine_r->setCallTimeout(-1);
+        QRemoteObjectPendingReply<int> reply = engine_r->measure(10);
+        QVERIFY(reply.waitForFinished());
+        QCOMPARE(reply.error(), QRemoteObjectPendingCall::NoError);
+        QCOMPARE(reply.returnValue(), 10);
+    }
+
+    void callDeadlineSynchronousTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting(&e);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        QVERIFY(engine_r->waitForSource());
+
+        //The host reads all calls at once and is blocked by the first one
+        //until the others expired
+        client.beginInvocationBatch();
+        engine_r->setCallTimeout(100);
+        QVector<QRemoteObjectPendingReply<int> > replies;
+        for (int i = 0; i < 3; ++i)
+            replies << engine_r->calibrate(200);
+        engine_r->setCallTimeout(-1);
+        QRemoteObjectPendingReply<int> last = engine_r->calibrate(0);
+        client.endInvocationBatch();
+
+        QVERIFY(last.waitForFinished());
+        QCOMPARE(last.returnValue(), 0);
+        Q_FOREACH (QRemoteObjectPendingReply<int> reply, replies)
+            QCOMPARE(reply.error(), QRemoteObjectPendingCall::DeadlineExceeded);
+        QCOMPARE(e.calibrationCount(), 2);
+    }
+
+    void cancelCallTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        host.setWorkerThreadCount(4);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        //The last two calls wait for the first two and are canceled before they run
+        QVector<QRemoteObjectPendingReply<int> > replies;
+        for (int i = 0; i < 4; ++i)
+            replies << engine_r->measure(200);
+        replies[2].cancel();
+        replies[3].cancel();
+        QVERIFY(replies[3].isFinished());
+        QCOMPARE(replies[3].error(), QRemoteObjectPendingCall::Canceled);
+
+        QVERIFY(replies[0].waitForFinished());
+        QCOMPARE(replies[0].returnValue(), 200);
+        QVERIFY(replies[1].waitForFinished());
+        QCOMPARE(replies[1].returnValue(), 200);
+        QTRY_COMPARE(host.queuedInvocationCount(), 0);
+        QTRY_COMPARE(host.runningInvocationCount(), 0);
+        QCOMPARE(e.measureCount(), 2);
+        QCOMPARE(replies[2].error(), QRemoteObjectPendingCall::Canceled);
+
+        //Canceling a finished call changes nothing
+        replies[0].cancel();
+        QCOMPARE(replies[0].error(), QRemoteObjectPendingCall::NoError);
+    }
+
+    void pendingCallOutlivesReplicaTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        //The calls still pending finish with the replica, waking whoever waits
+        QRemoteObjectPendingReply<int> reply = engine_r->measure(200);
+        BlockingWaiter waiter(reply);
+        waiter.start();
+        engine_r.reset();
+        QVERIFY(reply.isFinished());
+        QCOMPARE(reply.error(), QRemoteObjectPendingCall::Canceled);
+        QVERIFY(waiter.wait(5000));
+        QVERIFY(waiter.m_result);
+
+        //Nothing left to cancel
+        reply.cancel();
+        QCOMPARE(reply.error(), QRemoteObjectPendingCall::Canceled);
+    }
+
+    void sourceInOtherThreadTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+        e.setRpm(0);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        //The changes are made in the thread of the source, not the one of the host
+        QThread thread;
+        e.moveToThread(&thread);
+        thread.start();
+
+        QSignalSpy spy(engine_r.data(), SIGNAL(rpmChanged(int)));
+        for (int i = 0; i < 10; ++i)
+            QMetaObject::invokeMethod(&e, "increaseRpm", Qt::QueuedConnection, Q_ARG(int, 100));
+        QTRY_COMPARE(spy.count(), 10);
+        QCOMPARE(engine_r->rpm(), 1000);
+
+        thread.quit();
+        thread.wait();
+    }
+
+    void sourceDestroyedInOtherThreadTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine *e = new Engine;
+        host.enableRemoting<EngineSourceAPI>(e);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        QVERIFY(engine_r->waitForSource());
+
+        QThread thread;
+        e->moveToThread(&thread);
+        thread.start();
+
+        //The calls reach the host once the object was destroyed in its own
+        //thread, while its source may still wait to be deleted in this one
+        for (int i = 0; i < 10; ++i)
+            engine_r->start();
+        QMetaObject::invokeMethod(e, "deleteLater");
+        thread.quit();
+        QVERIFY(thread.wait(5000));
+        for (int i = 0; i < 10; ++i) {
+            engine_r->start();
+            engine_r->setRpm(i);
+            QCoreApplication::processEvents();
+        }
+
+        //Attaching doesn't read the properties of the destroyed object either
+        QRemoteObjectNode lateClient;
+        Q_SET_OBJECT_NAME(lateClient);
+        lateClient.connectToNode(hostUrl);
+        const QScopedPointer<EngineReplica> late_r(lateClient.acquire<EngineReplica>());
+        QVERIFY(!late_r->waitForSource(500));
+    }
+
+    void propertySnapshotTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+        e.setRpm(0);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        engine_r->waitForSource();
+
+        const QMetaObject *meta = engine_r->metaObject();
+        const int index = meta->indexOfProperty("rpm") - meta->propertyOffset();
+        QCOMPARE(engine_r->propertySnapshot().count(), meta->propertyCount() - meta->propertyOffset());
+        QCOMPARE(engine_r->propertySnapshot().at(index).toInt(), 0);
+
+        //The snapshots are read in another thread while the node applies the changes
+        SnapshotReader reader(engine_r.data(), index);
+        reader.start();
+
+        QSignalSpy spy(engine_r.data(), SIGNAL(rpmChanged(int)));
+        for (int i = 0; i < 10; ++i)
+            e.increaseRpm(100);
+        QTRY_COMPARE(spy.count(), 10);
+        QCOMPARE(engine_r->propertySnapshot().at(index).toInt(), 1000);
+
+        reader.stop();
+        reader.wait();
+        QVERIFY(reader.m_ordered);
+        QCOMPARE(reader.m_last, 1000);
+    }
+
+    void blockingWaitTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting(&e);
+        e.setStarted(false);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        //The waits block other threads, while the node keeps running in this one
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        BlockingWaiter sourceWaiter(engine_r.data());
+        sourceWaiter.start();
+        QTRY_VERIFY(sourceWaiter.isFinished());
+        QVERIFY(sourceWaiter.m_result);
+        QVERIFY(engine_r->isReplicaValid());
+
+        QRemoteObjectPendingReply<bool> reply = engine_r->start();
+        BlockingWaiter replyWaiter(reply);
+        replyWaiter.start();
+        QTRY_VERIFY(replyWaiter.isFinished());
+        QVERIFY(replyWaiter.m_result);
+        QCOMPARE(reply.returnValue(), true);
+        QCOMPARE(reply.error(), QRemoteObjectPendingCall::NoError);
+    }
+
+    void invocationBatchTest() {
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting(&e);
+        e.setRpm(0);
+        e.setStarted(false);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        QVERIFY(engine_r->waitForSource());
+
+        //Nothing is sent before the batch ends
+        client.beginInvocationBatch();
+        for (int i = 0; i < 100; ++i)
+            engine_r->increaseRpm(1);
+        QRemoteObjectPendingReply<bool> reply = engine_r->start();
+        QTest::qWait(50);
+        QCOMPARE(e.rpm(), 0);
+        client.endInvocationBatch();
+        QVERIFY(reply.waitForFinished());
+        QCOMPARE(reply.returnValue(), true);
+        QCOMPARE(e.rpm(), 100);
+
+        //Batched per event loop iteration, in order
+        client.setInvocationBatchingEnabled(true);
+        QVERIFY(client.isInvocationBatchingEnabled());
+        for (int i = 0; i < 100; ++i)
+            engine_r->increaseRpm(1);
+        QCOMPARE(e.rpm(), 100);
+        QTRY_COMPARE(engine_r->rpm(), 200);
+        QCOMPARE(e.rpm(), 200);
+    }
+
     void clientBeforeServerTest() {
         QRemoteObjectNode client;
         Q_SET_OBJECT_NAME(client);
@@ -950,6 +1428,72 @@ private slots:
         QVERIFY(host.disableRemoting(&t));
     }
 
+    void ioThreadTest() {
+        qputenv("QT_REMOTEOBJECT_IO_THREAD", "1");
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        Engine e;
+        host.enableRemoting<EngineSourceAPI>(&e);
+        TestLargeData t;
+        host.enableRemoting(&t, QStringLiteral("large"));
+        e.setStarted(false);
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+        qunsetenv("QT_REMOTEOBJECT_IO_THREAD");
+
+        const QScopedPointer<EngineReplica> engine_r(client.acquire<EngineReplica>());
+        QVERIFY(engine_r->waitForSource());
+        QCOMPARE(engine_r->started(), false);
+        QRemoteObjectPendingReply<bool> reply = engine_r->start();
+        QVERIFY(reply.waitForFinished());
+        QCOMPARE(reply.returnValue(), true);
+        QTRY_COMPARE(engine_r->started(), true);
+
+        //Larger than a single read, and large enough to be read into a buffer of its own
+        const QScopedPointer<QRemoteObjectDynamicReplica> rep(client.acquireDynamic(QStringLiteral("large")));
+        QVERIFY(rep->waitForSource());
+        QSignalSpy spy(rep.data(), SIGNAL(send(QByteArray)));
+        const QByteArray data(1024 * 1024, 'y');
+        emit t.send(data);
+        QTRY_COMPARE(spy.count(), 1);
+        QCOMPARE(spy.first().at(0).toByteArray(), data);
+        QVERIFY(host.disableRemoting(&t));
+    }
+
+    void numericArrayTest() {
+        qRegisterMetaType<QVector<float> >();
+        qRegisterMetaType<QList<double> >();
+        TestNumericData t;
+        QRemoteObjectHost host(hostUrl);
+        SET_NODE_NAME(host);
+        host.enableRemoting(&t, QStringLiteral("numeric"));
+
+        QRemoteObjectNode client;
+        Q_SET_OBJECT_NAME(client);
+        client.connectToNode(hostUrl);
+        const QScopedPointer<QRemoteObjectDynamicReplica> rep(client.acquireDynamic(QStringLiteral("numeric")));
+        rep->waitForSource();
+        QVERIFY(rep->isInitialized());
+        const QMetaObject *metaObject = rep->metaObject();
+        const int sigIndex = metaObject->indexOfSignal("send(QVector<float>,QList<double>)");
+        QVERIFY(sigIndex != -1);
+        const QMetaMethod mm =  metaObject->method(sigIndex);
+        QSignalSpy spy(rep.data(), QByteArray(QByteArrayLiteral("2")+mm.methodSignature().constData()));
+        QVector<float> samples(65536);
+        for (int i = 0; i < samples.size(); ++i)
+            samples[i] = i * 0.25f;
+        const QList<double> values = QList<double>() << -1.5 << 0.0 << 3.125;
+        emit t.send(samples, values);
+        spy.wait();
+        QCOMPARE(spy.count(), 1);
+        const QList<QVariant> &arguments = spy.first();
+        QCOMPARE(arguments.at(0).value<QVector<float> >(), samples);
+        QCOMPARE(arguments.at(1).value<QList<double> >(), values);
+        QVERIFY(host.disableRemoting(&t));
+    }
+
     void PODTest()
     {
         QRemoteObjectHost host(hostUrl);
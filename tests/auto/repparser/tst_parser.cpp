@@ -57,6 +57,8 @@ private Q_SLOTS:
     void testProperties();
     void testSlots_data();
     void testSlots();
+    void testThreadSafeSlots_data();
+    void testThreadSafeSlots();
     void testSignals_data();
     void testSignals();
     void testPods_data();
@@ -200,6 +202,48 @@ void tst_Parser::testSlots()
     QCOMPARE(QString("%1 %2(%3)").arg(slot.returnType).arg(slot.name).arg(slot.paramsAsString()), expectedSlot);
 }
 
+void tst_Parser::testThreadSafeSlots_data()
+{
+    QTest::addColumn<QString>("slotDeclaration");
+    QTest::addColumn<QString>("expectedSlot");
+    QTest::addColumn<bool>("expectedThreadSafe");
+    QTest::addColumn<int>("expectedMaxConcurrency");
+    QTest::newRow("slot") << "SLOT(int test(int value))" << "int test(int value)" << false << 0;
+    QTest::newRow("threadsafe") << "SLOT(int test(int value) THREADSAFE)" << "int test(int value)" << true << 0;
+    QTest::newRow("threadsafewithlimit") << "SLOT(int test(int value) THREADSAFE 4)" << "int test(int value)" << true << 4;
+    QTest::newRow("threadsafewithspaces") << "SLOT ( void test (QString value)   THREADSAFE   2  )" << "void test(QString value)" << true << 2;
+}
+
+void tst_Parser::testThreadSafeSlots()
+{
+    QFETCH(QString, slotDeclaration);
+    QFETCH(QString, expectedSlot);
+    QFETCH(bool, expectedThreadSafe);
+    QFETCH(int, expectedMaxConcurrency);
+
+    QTemporaryFile file;
+    file.open();
+    QTextStream stream(&file);
+    stream << "class TestClass" << endl;
+    stream << "{" << endl;
+    stream << slotDeclaration << endl;
+    stream << "};" << endl;
+    file.seek(0);
+
+    RepParser parser(file);
+    QVERIFY(parser.parse());
+
+    const AST ast = parser.ast();
+    QCOMPARE(ast.classes.count(), 1);
+
+    const QVector<ASTFunction> slotsList = ast.classes.first().slotsList;
+    QCOMPARE(slotsList.count(), 1);
+    const ASTFunction slot = slotsList.first();
+    QCOMPARE(QString("%1 %2(%3)").arg(slot.returnType).arg(slot.name).arg(slot.paramsAsString()), expectedSlot);
+    QCOMPARE(slot.threadSafe, expectedThreadSafe);
+    QCOMPARE(slot.maxConcurrency, expectedMaxConcurrency);
+}
+
 void tst_Parser::testSignals_data()
 {
     QTest::addColumn<QString>("signalDeclaration");
@@ -43,6 +43,7 @@
 
 #include "repparser.h"
 
+#include <QCryptographicHash>
 #include <QFileInfo>
 #include <QMetaType>
 #include <QTextStream>
@@ -105,6 +106,60 @@ static bool isBuiltinType(const QString &type)
     return (id < QMetaType::User);
 }
 
+/*
+  Returns the hash written to QCLASSINFO_REMOTEOBJECT_SIGNATURE. Replicas and
+  sources with the same hash exchange the arguments of slots without
+  wrapping them in QVariants, so it covers everything that changes the order
+  or the types of the methods.
+*/
+static QString interfaceHash(const ASTClass &astClass)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(astClass.name.toLatin1());
+    foreach (const ASTProperty &prop, astClass.properties)
+        hash.addData(QString::fromLatin1("%1 %2 %3;").arg(prop.type, prop.name).arg(prop.modifier).toLatin1());
+    foreach (const ASTFunction &sig, astClass.signalsList)
+        hash.addData(QString::fromLatin1("%1(%2);").arg(sig.name, sig.paramsAsString(ASTFunction::Normalized)).toLatin1());
+    foreach (const ASTFunction &slot, astClass.slotsList)
+        hash.addData(QString::fromLatin1("%1 %2(%3);").arg(slot.returnType, slot.name, slot.paramsAsString(ASTFunction::Normalized)).toLatin1());
+    return QString::fromLatin1(hash.result().left(4).toHex());
+}
+
+/*
+  Returns \c true if the arguments of the slot can be streamed by the code
+  generated for the class. The stream operators of enums are only emitted
+  after the class, so slots taking one keep sending QVariants.
+*/
+static bool hasTypedArguments(const ASTClass &astClass, const ASTFunction &slot)
+{
+    foreach (const ASTDeclaration &param, slot.params) {
+        if (isClassEnum(astClass, param.type) || param.type.contains(QLatin1String("::")))
+            return false;
+    }
+    return true;
+}
+
+/*
+  Returns T if the slot returns QFuture<T>, an empty string otherwise. The
+  source replies once the future has finished, so replicas wait for a T.
+*/
+static QString asyncResultType(const ASTFunction &slot)
+{
+    const QString type = slot.returnType.trimmed();
+    if (!type.startsWith(QLatin1String("QFuture<")) || !type.endsWith(QLatin1Char('>')))
+        return QString();
+    return type.mid(8, type.length() - 9).trimmed();
+}
+
+/*
+  Returns the type of the value replicas receive when calling the slot.
+*/
+static QString replyType(const ASTFunction &slot)
+{
+    const QString resultType = asyncResultType(slot);
+    return resultType.isEmpty() ? slot.returnType : resultType;
+}
+
 RepCodeGenerator::RepCodeGenerator(QIODevice *outputDevice)
     : m_outputDevice(outputDevice)
 {
@@ -137,7 +192,7 @@ void RepCodeGenerator::generate(const AST &ast, Mode mode, QString fileName)
         foreach (const ASTProperty &property, astClass.properties)
             metaTypes << property.type;
         foreach (const ASTFunction &function, astClass.signalsList + astClass.slotsList) {
-            metaTypes << function.returnType;
+            metaTypes << replyType(function);
             foreach (const ASTDeclaration &decl, function.params) {
                 metaTypes << decl.type;
             }
@@ -486,6 +541,17 @@ void RepCodeGenerator::generateClass(Mode mode, QTextStream &out, const ASTClass
     out << "{" << endl;
     out << "    Q_OBJECT" << endl;
     out << "    Q_CLASSINFO(QCLASSINFO_REMOTEOBJECT_TYPE, \"" << astClass.name << "\")" << endl;
+    out << "    Q_CLASSINFO(QCLASSINFO_REMOTEOBJECT_SIGNATURE, \"" << interfaceHash(astClass) << "\")" << endl;
+    if (mode != REPLICA) {
+        foreach (const ASTFunction &slot, astClass.slotsList) {
+            if (!slot.threadSafe)
+                continue;
+            out << "    Q_CLASSINFO(QCLASSINFO_REMOTEOBJECT_THREADSAFE, \"" << slot.name << "(" << slot.paramsAsString(ASTFunction::Normalized) << ")";
+            if (slot.maxConcurrency > 0)
+                out << ":" << slot.maxConcurrency;
+            out << "\")" << endl;
+        }
+    }
     out << "    friend class QRemoteObjectNode;" << endl;
     out << "public:" << endl;
 
@@ -510,15 +576,17 @@ void RepCodeGenerator::generateClass(Mode mode, QTextStream &out, const ASTClass
     if (!metaTypeRegistrationCode.isEmpty())
         out << metaTypeRegistrationCode << endl;
 
-    if (mode == REPLICA) {
-        out << "        QVariantList properties;" << endl;
-        out << "        properties.reserve(" << astClass.properties.size() << ");" << endl;
-        foreach (const ASTProperty &property, astClass.properties) {
-            out << "        properties << QVariant::fromValue(" << property.type << "(" << property.defaultValue << "));" << endl;
+    if (mode != REPLICA) {
+        foreach (const ASTFunction &slot, astClass.slotsList) {
+            const QString resultType = asyncResultType(slot);
+            if (!resultType.isEmpty())
+                out << "        QtRemoteObjects::registerFutureType<" << resultType << " >(\"QFuture<" << resultType << ">\");" << endl;
         }
-        out << "        setProperties(properties);" << endl;
     }
 
+    if (mode == REPLICA && !astClass.properties.isEmpty())
+        out << "        setPropertyStorage(new Storage);" << endl;
+
     out << "    }" << endl;
     out << "public:" << endl;
 
@@ -546,6 +614,8 @@ void RepCodeGenerator::generateClass(Mode mode, QTextStream &out, const ASTClass
         foreach (const ASTProperty &property, astClass.properties) {
             out << "    " << property.type << " " << property.name << "() const" << endl;
             out << "    {" << endl;
+            out << "        if (const Storage *__repc_storage = static_cast<const Storage *>(propertyStorage()))" << endl;
+            out << "            return __repc_storage->" << property.name << ";" << endl;
             out << "        const QVariant variant = propAsVariant(" << i << ");" << endl;
             out << "        if (!variant.canConvert<" << property.type << ">()) {" << endl;
             out << "            qWarning() << \"QtRO cannot convert the property " << property.name << " to type " << property.type << "\";" << endl;
@@ -609,14 +679,34 @@ void RepCodeGenerator::generateClass(Mode mode, QTextStream &out, const ASTClass
                 out << "    virtual " << slot.returnType << " " << slot.name << "(" << slot.paramsAsString() << ") = 0;" << endl;
             } else {
                 // TODO: Discuss whether it is a good idea to special-case for void here,
-                const bool isVoid = slot.returnType == QStringLiteral("void");
+                //Slots returning QFuture<T> are replied to with T
+                const QString returnType = replyType(slot);
+                const bool isVoid = returnType == QStringLiteral("void");
 
                 if (isVoid)
                     out << "    void " << slot.name << "(" << slot.paramsAsString() << ")" << endl;
                 else
-                    out << "    QRemoteObjectPendingReply<" << slot.returnType << "> " << slot.name << "(" << slot.paramsAsString()<< ")" << endl;
+                    out << "    QRemoteObjectPendingReply<" << returnType << "> " << slot.name << "(" << slot.paramsAsString()<< ")" << endl;
                 out << "    {" << endl;
                 out << "        static int __repc_index = " << className << "::staticMetaObject.indexOfSlot(\"" << slot.name << "(" << slot.paramsAsString(ASTFunction::Normalized) << ")\");" << endl;
+                if (hasTypedArguments(astClass, slot)) {
+                    const QString withReply = isVoid ? QString() : QStringLiteral(", true");
+                    if (slot.paramNames().isEmpty()) {
+                        out << "        if (beginTypedSend(__repc_index" << withReply << ")) {" << endl;
+                    } else {
+                        out << "        if (QDataStream *__repc_stream = beginTypedSend(__repc_index" << withReply << ")) {" << endl;
+                        out << "            *__repc_stream";
+                        foreach (const QString &name, slot.paramNames())
+                            out << " << " << name;
+                        out << ";" << endl;
+                    }
+                    if (isVoid) {
+                        out << "            endTypedSend();" << endl;
+                        out << "            return;" << endl;
+                    } else
+                        out << "            return QRemoteObjectPendingReply<" << returnType << ">(endTypedSend());" << endl;
+                    out << "        }" << endl;
+                }
                 out << "        QVariantList __repc_args;" << endl;
                 if (!slot.paramNames().isEmpty()) {
                     out << "        __repc_args" << endl;
@@ -627,12 +717,15 @@ void RepCodeGenerator::generateClass(Mode mode, QTextStream &out, const ASTClass
                 if (isVoid)
                     out << "        send(QMetaObject::InvokeMetaMethod, __repc_index, __repc_args);" << endl;
                 else
-                    out << "        return QRemoteObjectPendingReply<" << slot.returnType << ">(sendWithReply(QMetaObject::InvokeMetaMethod, __repc_index, __repc_args));" << endl;
+                    out << "        return QRemoteObjectPendingReply<" << returnType << ">(sendWithReply(QMetaObject::InvokeMetaMethod, __repc_index, __repc_args));" << endl;
                 out << "    }" << endl;
             }
         }
     }
 
+    if (mode == REPLICA && !astClass.properties.isEmpty())
+        generateReplicaStorage(out, astClass);
+
     if (mode == SIMPLE_SOURCE)
     {
         //Next output data members
@@ -657,6 +750,51 @@ void RepCodeGenerator::generateClass(Mode mode, QTextStream &out, const ASTClass
     out << "" << endl;
 }
 
+void RepCodeGenerator::generateReplicaStorage(QTextStream &out, const ASTClass &astClass)
+{
+    const int propCount = astClass.properties.count();
+    out << "" << endl;
+    out << "private:" << endl;
+    out << "    struct Storage : public QRemoteObjectReplicaStorage" << endl;
+    out << "    {" << endl;
+    out << "        Storage()" << endl;
+    for (int i = 0; i < propCount; ++i) {
+        const ASTProperty &property = astClass.properties.at(i);
+        out << "            " << (i == 0 ? ": " : ", ") << property.name << "(" << property.defaultValue << ")" << endl;
+    }
+    out << "        {}" << endl;
+    out << "        int propertyCount() const Q_DECL_OVERRIDE { return " << propCount << "; }" << endl;
+    out << "        QVariant property(int index) const Q_DECL_OVERRIDE" << endl;
+    out << "        {" << endl;
+    out << "            switch (index) {" << endl;
+    for (int i = 0; i < propCount; ++i)
+        out << "            case " << i << ": return QVariant::fromValue(" << astClass.properties.at(i).name << ");" << endl;
+    out << "            }" << endl;
+    out << "            return QVariant();" << endl;
+    out << "        }" << endl;
+    out << "        void setProperty(int index, const QVariant &value) Q_DECL_OVERRIDE" << endl;
+    out << "        {" << endl;
+    out << "            switch (index) {" << endl;
+    for (int i = 0; i < propCount; ++i) {
+        const ASTProperty &property = astClass.properties.at(i);
+        out << "            case " << i << ": " << property.name << " = value.value<" << property.type << " >(); break;" << endl;
+    }
+    out << "            }" << endl;
+    out << "        }" << endl;
+    out << "        void *propertyData(int index) Q_DECL_OVERRIDE" << endl;
+    out << "        {" << endl;
+    out << "            switch (index) {" << endl;
+    for (int i = 0; i < propCount; ++i)
+        out << "            case " << i << ": return &" << astClass.properties.at(i).name << ";" << endl;
+    out << "            }" << endl;
+    out << "            return Q_NULLPTR;" << endl;
+    out << "        }" << endl;
+    out << "" << endl;
+    foreach (const ASTProperty &property, astClass.properties)
+        out << "        " << property.type << " " << property.name << ";" << endl;
+    out << "    };" << endl;
+}
+
 void RepCodeGenerator::generateSourceAPI(QTextStream &out, const ASTClass &astClass)
 {
     const QString className = astClass.name + QStringLiteral("SourceAPI");
@@ -855,6 +993,55 @@ void RepCodeGenerator::generateSourceAPI(QTextStream &out, const ASTClass &astCl
     out << QStringLiteral("        return QByteArrayLiteral(\"\");") << endl;
     out << QStringLiteral("    }") << endl;
 
+    //interfaceHash method
+    out << QString::fromLatin1("    quint32 interfaceHash() const Q_DECL_OVERRIDE { return 0x%1u; }").arg(interfaceHash(astClass)) << endl;
+
+    //invokeTyped method
+    out << QStringLiteral("    bool invokeTyped(QObject *object, int index, QDataStream &in, QVariant *returnValue) const Q_DECL_OVERRIDE") << endl;
+    out << QStringLiteral("    {") << endl;
+    bool hasTypedSlots = false;
+    for (int i = 0; i < slotCount; ++i) {
+        const ASTFunction &slot = astClass.slotsList.at(i);
+        if (!hasTypedArguments(astClass, slot))
+            continue;
+        if (!hasTypedSlots)
+            out << QStringLiteral("        switch (index) {") << endl;
+        hasTypedSlots = true;
+        out << QString::fromLatin1("        case %1: {").arg(i) << endl;
+        QStringList args;
+        for (int j = 0; j < slot.params.size(); ++j) {
+            args << QString::fromLatin1("__repc_arg%1").arg(j);
+            out << QString::fromLatin1("            %1 %2;").arg(slot.params.at(j).type, args.last()) << endl;
+        }
+        if (!args.isEmpty()) {
+            out << QString::fromLatin1("            in >> %1;").arg(args.join(QStringLiteral(" >> "))) << endl;
+            out << QStringLiteral("            if (in.status() != QDataStream::Ok)") << endl;
+            out << QStringLiteral("                return false;") << endl;
+        }
+        const QString call = QString::fromLatin1("static_cast<ObjectType *>(object)->%1(%2)").arg(slot.name, args.join(QStringLiteral(", ")));
+        const QString resultType = asyncResultType(slot);
+        if (slot.returnType == QStringLiteral("void")) {
+            out << QString::fromLatin1("            %1;").arg(call) << endl;
+        } else if (!resultType.isEmpty()) {
+            //QFuture<T> has no Q_DECLARE_METATYPE, use the id registerFutureType() registered
+            const QString futureType = QString::fromLatin1("QFuture<%1>").arg(resultType);
+            out << QString::fromLatin1("            static const int __repc_futureType = QMetaType::type(\"%1\");").arg(futureType) << endl;
+            out << QString::fromLatin1("            const %1 __repc_future = %2;").arg(futureType, call) << endl;
+            out << QStringLiteral("            *returnValue = QVariant(__repc_futureType, &__repc_future);") << endl;
+        } else {
+            out << QString::fromLatin1("            *returnValue = QVariant::fromValue(%1);").arg(call) << endl;
+        }
+        out << QStringLiteral("            return true;") << endl;
+        out << QStringLiteral("        }") << endl;
+    }
+    if (hasTypedSlots)
+        out << QStringLiteral("        }") << endl;
+    else
+        out << QStringLiteral("        Q_UNUSED(object); Q_UNUSED(index);") << endl;
+    out << QStringLiteral("        Q_UNUSED(in); Q_UNUSED(returnValue);") << endl;
+    out << QStringLiteral("        return false;") << endl;
+    out << QStringLiteral("    }") << endl;
+
     out << QStringLiteral("") << endl;
     out << QString::fromLatin1("    int _properties[%1];").arg(propCount+1) << endl;
     out << QString::fromLatin1("    int _signals[%1];").arg(signalCount+changedCount+1) << endl;